@@ -1,13 +1,21 @@
 #include "client.h"
+#include "event_loop.h"
+#include "frame.h"
+#include "send_queue.h"
+#include "snapshot.h"
+#include "thread_config.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
 
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <endian.h>
+#include <poll.h>
 
 #ifdef ENABLE_DEBUG
 #include <stdio.h>
@@ -16,53 +24,936 @@
 #define DEBUG(...)
 #endif
 
+#define DEFAULT_TIMER_TICK_MS 10
+#define SESSION_TIMEOUT_MS    1000
+#define REPAIR_RETRY_MS       500
+#define DEFAULT_RECEIVE_BATCH 256
+#define SEND_QUEUE_SIZE       (256 * 1024)
+
 /** Server information */
 typedef struct
 {
-    in_addr_t ip;   ///< Address of server
-    uint16_t port;  ///< Port on which the server is listening
-} Server_t;
+    in_addr_t ip;   ///< Address of server
+    uint16_t port;  ///< Port on which the server is listening
+} Server_t;
+
+/* Client information */
+typedef struct
+{
+    ClientConfig config;        ///< Client configuration
+    int socket_fd;              ///< Connection file descriptor, 0 once disconnected
+    pthread_mutex_t send_lock;  ///< Serializes frames and socket release, never held while blocking
+    SendQueue queue;            ///< Outgoing bytes the socket did not take, drained on EPOLLOUT
+    pthread_cond_t sent_cond;   ///< Signaled as the queue drains or the connection is released
+    uint32_t events;            ///< Events registered for socket_fd
+    Server_t *detected_servers; ///< List of detected servers
+    int detected_servers_count; ///< Detected servers count
+    pthread_t network_thread;   ///< Network thread handler
+    EventLoop *loop;            ///< Network event loop
+    int release_on_exit;        ///< Deinitialized from the network thread
+    int conn_fd;                ///< Connection socket owned by the network thread
+    EventSource conn_source;    ///< Connection registration
+    FrameReader reader;         ///< Incoming stream
+    TimerEntry idle_timer;      ///< Server silence timeout
+    uint64_t last_activity_ms;  ///< Time of last received frame
+    int discovery_fd;           ///< Asynchronous discovery socket
+    EventSource discovery_source; ///< Discovery registration
+    TimerEntry discovery_timer; ///< Discovery timeout
+    ServerDetails *discovered;  ///< Asynchronous discovery results
+    uint16_t discovery_max;     ///< Servers wanted by asynchronous discovery
+    client_notify_cb_servers discovery_cb; ///< Handler to callback on discovery end
+    int has_session;            ///< A session was opened, see client_resume
+    Server_t session_server;    ///< Server of the session
+    uint32_t session_id;        ///< Client id of the session on the server
+    uint64_t session_token;     ///< Secret issued by the server
+    uint64_t received_count;    ///< Data frames received in the session, network thread only
+    uint64_t resume_received;   ///< received_count to restore on attach
+    int broadcast_fd;           ///< Broadcast group socket, 0 if not joined
+    EventSource broadcast_source; ///< Broadcast registration
+    in_addr_t broadcast_group;  ///< Joined group
+    uint16_t broadcast_port;    ///< Joined group port, network byte order
+    uint64_t broadcast_next;    ///< Next broadcast sequence to deliver, network thread only
+    uint64_t broadcast_nacked;  ///< Last broadcast sequence requested for repair
+    uint64_t broadcast_nack_ms; ///< Time of the last repair request
+    uint8_t *snapshots;         ///< Rebuilt snapshots, SNAPSHOT_HISTORY states of snapshot_size bytes
+    uint32_t snapshot_sequences[SNAPSHOT_HISTORY]; ///< Sequence held by each state, 0 if none
+    uint32_t snapshot_sizes[SNAPSHOT_HISTORY];     ///< Size of each state
+    uint32_t snapshot_pending;  ///< Snapshot being rebuilt, 0 if none
+    uint32_t snapshot_offset;   ///< Bytes of it rebuilt
+    EventFlush batch_flush;     ///< Delivers the batch after each dispatch round
+    ClientMessage *batch;       ///< Messages gathered for receive_batch_cb, NULL if disabled
+    uint32_t batch_count;       ///< Gathered messages
+} ClientInfo;
+
+typedef ClientInfo * ClientHandler_t;
+
+static void close_connection(ClientHandler_t instance)
+{
+    if (instance->conn_fd != 0)
+    {
+        event_loop_remove (instance->loop, instance->conn_fd);
+        timer_wheel_cancel (event_loop_timers (instance->loop), &instance->idle_timer);
+
+        close (instance->conn_fd);
+        instance->conn_fd = 0;
+    }
+}
+
+static void close_broadcast(ClientHandler_t instance)
+{
+    if (instance->broadcast_fd != 0)
+    {
+        event_loop_remove (instance->loop, instance->broadcast_fd);
+        close (instance->broadcast_fd);
+        instance->broadcast_fd = 0;
+    }
+}
+
+/** Hand the gathered messages to the application */
+static void deliver_batch(void *param)
+{
+    ClientHandler_t instance = (ClientHandler_t) param;
+    uint32_t count = instance->batch_count;
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Deliveries from within the callback find the batch empty
+    instance->batch_count = 0;
+    instance->config.receive_batch_cb (instance, instance->batch, count);
+
+    for (uint32_t index = 0; index < count; ++index)
+    {
+        buffer_release (instance->batch[index].message);
+    }
+}
+
+static void deliver_message(ClientHandler_t instance, const uint8_t *payload, uint32_t length)
+{
+    MessageBuffer *message;
+    ClientMessage *entry;
+
+    if (instance->batch == NULL)
+    {
+        instance->config.receive_cb (instance, (char *) payload, length);
+        return;
+    }
+
+    message = buffer_pool_alloc (length);
+
+    if (message == NULL)
+    {
+        DEBUG("Client: State update[Message dropped]\n");
+        return;
+    }
+
+    // The reader reuses its buffer on the next read
+    memcpy (message->data, payload, length);
+    message->size = length;
+
+    entry = &instance->batch[instance->batch_count++];
+    entry->buffer  = (char *) message->data;
+    entry->size    = length;
+    entry->message = message;
+
+    if (instance->batch_count == instance->config.receive_batch_size)
+    {
+        deliver_batch (instance);
+    }
+}
+
+static void connection_lost(ClientHandler_t instance)
+{
+    int socketFd = instance->conn_fd;
+
+    // Notify unless the application disconnected already
+    if (instance->socket_fd == socketFd)
+    {
+        // Messages received before come first
+        deliver_batch (instance);
+        client_disconnect (instance);
+    }
+
+    // Unless reconnected from within the callback
+    if (instance->conn_fd == socketFd)
+    {
+        close_connection (instance);
+    }
+}
+
+static void on_idle_timer(TimerEntry *timer, void *ctx)
+{
+    ClientHandler_t instance = (ClientHandler_t) ctx;
+    uint64_t idleMs = event_loop_now_ms () - instance->last_activity_ms;
+
+    if (idleMs >= instance->config.idle_timeout_ms)
+    {
+        DEBUG("Client: State update[Server idle timeout]\n");
+
+        connection_lost (instance);
+    }
+    else
+    {
+        timer_wheel_schedule (event_loop_timers (instance->loop), timer, instance->config.idle_timeout_ms - idleMs);
+    }
+}
+
+/** Register the events the connection waits for. Called with send_lock held. */
+static void update_events(ClientHandler_t instance)
+{
+    uint32_t events = EPOLLIN | ((instance->queue.length != 0) ? EPOLLOUT : 0);
+
+    if (events != instance->events)
+    {
+        instance->events = events;
+
+        // Fails until attach_task registers the socket, with these events
+        event_loop_modify (instance->loop, instance->socket_fd, events, &instance->conn_source);
+    }
+}
+
+/**
+ * Send a frame without blocking; what the socket does not take is queued
+ * and sent once it is writable. Called with send_lock held.
+ *
+ * @param[in] limit Most bytes the queue may hold
+ *
+ * @return 0 if sent or queued, -1 if the stream is broken and was shut down
+ */
+static int send_frame(ClientHandler_t instance, uint8_t type, const void *payload, size_t length, size_t limit)
+{
+    uint8_t header[FRAME_HEADER_LEN];
+
+    frame_encode_header (header, type, length);
+
+    if (send_queue_frame (&instance->queue, instance->socket_fd, header, payload, length, limit) != 0)
+    {
+        // Seen as end of stream by the network thread
+        shutdown (instance->socket_fd, SHUT_RDWR);
+        return -1;
+    }
+
+    update_events (instance);
+
+    return 0;
+}
+
+/**
+ * Send a frame from the network thread, never blocking. Control frames
+ * may fill the queue to twice the size messages are limited to, so a
+ * server that stops reading while messages fill it keeps the connection.
+ *
+ * @return 0 if sent or queued, -1 if not sent
+ */
+static int send_control(ClientHandler_t instance, uint8_t type, const void *payload, uint32_t length)
+{
+    int status = -1;
+
+    pthread_mutex_lock (&instance->send_lock);
+
+    if ((instance->socket_fd != 0) && (instance->socket_fd == instance->conn_fd))
+    {
+        status = send_frame (instance, type, payload, length, 2 * SEND_QUEUE_SIZE);
+    }
+
+    pthread_mutex_unlock (&instance->send_lock);
+
+    return status;
+}
+
+/** Send queued bytes once the socket is writable */
+static int flush_connection(ClientHandler_t instance)
+{
+    int status = 0;
+
+    pthread_mutex_lock (&instance->send_lock);
+
+    // Otherwise the queue was dropped with the connection
+    if (instance->socket_fd == instance->conn_fd)
+    {
+        status = send_queue_flush (&instance->queue, instance->socket_fd);
+
+        if (status >= 0)
+        {
+            update_events (instance);
+            pthread_cond_broadcast (&instance->sent_cond);
+        }
+    }
+
+    pthread_mutex_unlock (&instance->send_lock);
+
+    return status;
+}
+
+/** Ask the server for the broadcasts missed up to last, unless requested already */
+static void request_repair(ClientHandler_t instance, uint64_t last)
+{
+    BroadcastRange range;
+
+    if (last <= instance->broadcast_nacked)
+    {
+        return;
+    }
+
+    range.first = htobe64 ((instance->broadcast_nacked >= instance->broadcast_next) ?
+        instance->broadcast_nacked + 1 : instance->broadcast_next);
+    range.last  = htobe64 (last);
+
+    // Unsent without a connection, asked again on the next gap or sync
+    if (send_control (instance, FRAME_NACK, &range, sizeof(range)) == 0)
+    {
+        instance->broadcast_nacked  = last;
+        instance->broadcast_nack_ms = event_loop_now_ms ();
+    }
+}
+
+/** Deliver broadcasts in sequence order, from the group or repaired over the connection */
+static void receive_broadcast(ClientHandler_t instance, const BroadcastHeader *header, uint8_t *payload, uint32_t length)
+{
+    uint64_t sequence = be64toh (header->sequence);
+
+    if (header->type == BROADCAST_DATA)
+    {
+        if (sequence == instance->broadcast_next)
+        {
+            instance->broadcast_next++;
+            deliver_message (instance, payload, length);
+        }
+        else if (sequence > instance->broadcast_next)
+        {
+            // Not kept: repaired along with the gap
+            request_repair (instance, sequence);
+        }
+    }
+    else if ((header->type == BROADCAST_SYNC) && (sequence >= instance->broadcast_next))
+    {
+        if (event_loop_now_ms () - instance->broadcast_nack_ms >= REPAIR_RETRY_MS)
+        {
+            // Still behind long after asking: the request or its repairs
+            // were lost with a dropped connection, ask for the whole gap
+            instance->broadcast_nacked = instance->broadcast_next - 1;
+        }
+
+        request_repair (instance, sequence);
+    }
+    else if ((header->type == BROADCAST_LOST) && (sequence >= instance->broadcast_next))
+    {
+        DEBUG("Client: State update[Broadcasts lost up to %llu]\n", (unsigned long long) sequence);
+
+        instance->broadcast_next = sequence + 1;
+    }
+}
+
+static void on_broadcast_event(void *ctx, uint32_t events)
+{
+    ClientHandler_t instance = (ClientHandler_t) ctx;
+    int broadcastFd = instance->broadcast_fd;
+    uint8_t datagram[sizeof(BroadcastHeader) + MAX_MESSAGE_LEN];
+    BroadcastHeader header;
+    ssize_t size;
+
+    while ((instance->broadcast_fd == broadcastFd) &&
+           ((size = recv (broadcastFd, datagram, sizeof(datagram), MSG_DONTWAIT)) >= 0))
+    {
+        // Without a connection, missed broadcasts are repaired once resumed
+        if ((size >= (ssize_t) sizeof(header)) && (instance->conn_fd != 0))
+        {
+            memcpy (&header, datagram, sizeof(header));
+            receive_broadcast (instance, &header, datagram + sizeof(header), size - sizeof(header));
+        }
+    }
+}
+
+static int open_broadcast(ClientHandler_t instance, const BroadcastJoin *join)
+{
+    struct sockaddr_in sa = {0};
+    struct ip_mreq mreq;
+    int reuse = 1;
+    int broadcastFd = socket (AF_INET, SOCK_DGRAM, 0);
+
+    if (broadcastFd == -1)
+    {
+        return -1;
+    }
+
+    // Bound to the group so only its datagrams are received
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = join->group;
+    sa.sin_port = join->port;
+
+    mreq.imr_multiaddr.s_addr = join->group;
+    mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+
+    if ((setsockopt (broadcastFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) ||
+        (bind (broadcastFd, (struct sockaddr *) &sa, sizeof(sa)) != 0) ||
+        (setsockopt (broadcastFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) ||
+        (event_loop_add (instance->loop, broadcastFd, EPOLLIN, &instance->broadcast_source) != 0))
+    {
+        close (broadcastFd);
+        return -1;
+    }
+
+    instance->broadcast_fd    = broadcastFd;
+    instance->broadcast_group = join->group;
+    instance->broadcast_port  = join->port;
+
+    return 0;
+}
+
+static void join_broadcast(ClientHandler_t instance, const BroadcastJoin *join)
+{
+    uint64_t sequence = be64toh (join->sequence);
+
+    if ((instance->broadcast_fd != 0) &&
+        (instance->broadcast_group == join->group) &&
+        (instance->broadcast_port == join->port))
+    {
+        // Resumed: requests sent on the previous connection may be lost
+        instance->broadcast_nacked = instance->broadcast_next - 1;
+        request_repair (instance, sequence - 1);
+        return;
+    }
+
+    close_broadcast (instance);
+
+    instance->broadcast_next   = sequence;
+    instance->broadcast_nacked = sequence - 1;
+
+    if (open_broadcast (instance, join) != 0)
+    {
+        uint64_t next = htobe64 (sequence);
+
+        DEBUG("Client: State update[Broadcast group unavailable]\n");
+
+        // Broadcasts keep coming over the connection. Queued like every
+        // frame, so it arrives unless the connection is lost; the next
+        // join then repeats it
+        send_control (instance, FRAME_LEAVE, &next, sizeof(next));
+    }
+}
+
+static uint8_t *snapshot_state(ClientHandler_t instance, uint32_t sequence)
+{
+    return instance->snapshots + (size_t) (sequence % SNAPSHOT_HISTORY) * instance->config.snapshot_size;
+}
+
+static void receive_snapshot(ClientHandler_t instance, const uint8_t *payload, uint32_t length)
+{
+    SnapshotHeader header;
+    uint32_t acked = 0;
+
+    memcpy (&header, payload, sizeof(header));
+
+    uint32_t sequence = ntohl (header.sequence);
+    uint32_t baseline = ntohl (header.baseline);
+    uint32_t size     = ntohl (header.size);
+    uint32_t offset   = ntohl (header.offset);
+    const uint8_t *base = NULL;
+    uint32_t baselineSize = 0;
+
+    if ((instance->snapshots == NULL) || (sequence == 0) || (size > instance->config.snapshot_size))
+    {
+        return;
+    }
+
+    if (offset == 0)
+    {
+        // The state held in the slot is overwritten
+        instance->snapshot_sequences[sequence % SNAPSHOT_HISTORY] = 0;
+        instance->snapshot_pending = sequence;
+        instance->snapshot_offset  = 0;
+    }
+    else if ((sequence != instance->snapshot_pending) || (offset != instance->snapshot_offset))
+    {
+        // Rest of a snapshot whose start was not received
+        return;
+    }
+
+    if (baseline != 0)
+    {
+        if ((baseline >= sequence) ||
+            (sequence - baseline >= SNAPSHOT_HISTORY) ||
+            (instance->snapshot_sequences[baseline % SNAPSHOT_HISTORY] != baseline))
+        {
+            DEBUG("Client: State update[Snapshot baseline %u missing]\n", baseline);
+
+            // Ask for a full state
+            instance->snapshot_pending = 0;
+            send_control (instance, FRAME_SNAPSHOT_ACK, &acked, sizeof(acked));
+            return;
+        }
+
+        base = snapshot_state (instance, baseline);
+        baselineSize = instance->snapshot_sizes[baseline % SNAPSHOT_HISTORY];
+    }
+
+    if (snapshot_decode (snapshot_state (instance, sequence), size, base, baselineSize,
+            &instance->snapshot_offset, payload + sizeof(header), length - sizeof(header)) != 0)
+    {
+        instance->snapshot_pending = 0;
+        return;
+    }
+
+    if (instance->snapshot_offset == size)
+    {
+        instance->snapshot_sequences[sequence % SNAPSHOT_HISTORY] = sequence;
+        instance->snapshot_sizes[sequence % SNAPSHOT_HISTORY] = size;
+        instance->snapshot_pending = 0;
+
+        acked = htonl (sequence);
+        send_control (instance, FRAME_SNAPSHOT_ACK, &acked, sizeof(acked));
+
+        if (instance->config.snapshot_cb != NULL)
+        {
+            deliver_batch (instance);
+            instance->config.snapshot_cb (instance, (const char *) snapshot_state (instance, sequence), size);
+        }
+    }
+}
+
+static void on_connection_event(void *ctx, uint32_t events)
+{
+    ClientHandler_t instance = (ClientHandler_t) ctx;
+    int socketFd = instance->conn_fd;
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+    int status;
+
+    if (socketFd == 0)
+    {
+        // Closed earlier in the same dispatch round
+        return;
+    }
+
+    if ((events & EPOLLOUT) && (flush_connection (instance) < 0))
+    {
+        connection_lost (instance);
+        return;
+    }
+
+    ssize_t dataLength = frame_reader_recv (&instance->reader, socketFd, MSG_DONTWAIT);
+
+    if ((dataLength < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+    {
+        return;
+    }
+
+    if (dataLength <= 0)
+    {
+        connection_lost (instance);
+        return;
+    }
+
+    instance->last_activity_ms = event_loop_now_ms ();
+
+    while ((status = frame_reader_next (&instance->reader, &type, &payload, &length)) == 1)
+    {
+        if (type == FRAME_DATA)
+        {
+            instance->received_count++;
+            deliver_message (instance, payload, length);
+        }
+        else if (type == FRAME_PING)
+        {
+            send_control (instance, FRAME_PONG, payload, length);
+        }
+        else if ((type == FRAME_REPAIR) && (length >= sizeof(BroadcastHeader)))
+        {
+            BroadcastHeader header;
+
+            memcpy (&header, payload, sizeof(header));
+            receive_broadcast (instance, &header, payload + sizeof(header), length - sizeof(header));
+        }
+        else if ((type == FRAME_SNAPSHOT) && (length >= sizeof(SnapshotHeader)))
+        {
+            receive_snapshot (instance, payload, length);
+        }
+        else if ((type == FRAME_JOIN) && (length == sizeof(BroadcastJoin)) && instance->config.broadcast_channel)
+        {
+            BroadcastJoin join;
+
+            memcpy (&join, payload, sizeof(join));
+            join_broadcast (instance, &join);
+        }
+
+        if (instance->conn_fd != socketFd)
+        {
+            // Reconnected or released from within callback
+            return;
+        }
+    }
+
+    if (status < 0)
+    {
+        connection_lost (instance);
+    }
+}
+
+static void attach_task(void *param)
+{
+    ClientHandler_t instance = (ClientHandler_t) param;
+
+    // Reap a previous connection the network thread did not see closing yet
+    close_connection (instance);
+
+    instance->last_activity_ms = event_loop_now_ms ();
+    instance->received_count = instance->resume_received;
+    frame_reader_reset (&instance->reader);
+
+    // Messages may be queued already
+    pthread_mutex_lock (&instance->send_lock);
+    instance->conn_fd = instance->socket_fd;
+    instance->events  = EPOLLIN | ((instance->queue.length != 0) ? EPOLLOUT : 0);
+    event_loop_add (instance->loop, instance->conn_fd, instance->events, &instance->conn_source);
+    pthread_mutex_unlock (&instance->send_lock);
+
+    if (instance->config.idle_timeout_ms != 0)
+    {
+        timer_wheel_schedule (event_loop_timers (instance->loop), &instance->idle_timer, instance->config.idle_timeout_ms);
+    }
+
+    if (instance->config.broadcast_channel)
+    {
+        // Servers without a broadcast group ignore the request
+        send_control (instance, FRAME_JOIN, NULL, 0);
+    }
+}
+
+static void client_release(ClientHandler_t instance)
+{
+    if (instance->config.runtime != NULL)
+    {
+        runtime_detach (instance->config.runtime, instance->loop);
+    }
+    else
+    {
+        event_loop_destroy (instance->loop);
+    }
+
+    pthread_mutex_destroy (&instance->send_lock);
+    pthread_cond_destroy (&instance->sent_cond);
+    free (instance->batch);
+    free (instance->snapshots);
+    free (instance->discovered);
+    free (instance->detected_servers);
+    free (instance);
+}
+
+static void bind_memory_task(void *param)
+{
+    // Keeps the receive buffer close to the thread filling it
+    thread_bind_memory (param, sizeof(ClientInfo));
+}
+
+static void start_batch_task(void *param)
+{
+    ClientHandler_t instance = (ClientHandler_t) param;
+
+    event_loop_add_flush (instance->loop, &instance->batch_flush);
+}
+
+static void *network_thread(void *param)
+{
+    ClientHandler_t instance = (ClientHandler_t) param;
+
+    bind_memory_task (instance);
+
+    event_loop_run (instance->loop);
+
+    if (instance->release_on_exit)
+    {
+        // Deinitialized from a callback, nobody joins
+        pthread_detach (pthread_self ());
+        client_release (instance);
+    }
+
+    return NULL;
+}
+
+static void finish_discovery(ClientHandler_t instance)
+{
+    client_notify_cb_servers cb = instance->discovery_cb;
+
+    event_loop_remove (instance->loop, instance->discovery_fd);
+    timer_wheel_cancel (event_loop_timers (instance->loop), &instance->discovery_timer);
+    close (instance->discovery_fd);
+
+    instance->discovery_fd = 0;
+    instance->discovery_cb = NULL;
+
+    if (cb != NULL)
+    {
+        cb (instance, instance->discovered, instance->detected_servers_count);
+    }
+}
+
+static void on_discovery_timer(TimerEntry *timer, void *ctx)
+{
+    finish_discovery ((ClientHandler_t) ctx);
+}
+
+ClientHandler client_init(ClientConfig * config)
+{
+    ClientHandler_t handler = (ClientHandler_t) thread_alloc_pages (sizeof(ClientInfo));
+    ssize_t sizeofServerData = sizeof(Server_t) * config->max_nb_servers;
+
+    if (handler == NULL)
+    {
+        return NULL;
+    }
+
+    bzero (handler, sizeof(ClientInfo));
+    handler->detected_servers = (Server_t*) malloc (sizeofServerData);
+    handler->discovered = (ServerDetails*) malloc (sizeof(ServerDetails) * config->max_nb_servers);
+
+    if (config->snapshot_size != 0)
+    {
+        handler->snapshots = (uint8_t *) malloc ((size_t) SNAPSHOT_HISTORY * config->snapshot_size);
+    }
+
+    if (config->runtime != NULL)
+    {
+        handler->loop = runtime_attach (config->runtime);
+    }
+    else
+    {
+        handler->loop = event_loop_create (DEFAULT_TIMER_TICK_MS);
+
+        if (handler->loop != NULL)
+        {
+            event_loop_set_busy_poll (handler->loop, config->busy_poll_us);
+        }
+    }
+
+    if ((handler->detected_servers == NULL) ||
+        (handler->discovered == NULL) ||
+        ((handler->snapshots == NULL) && (config->snapshot_size != 0)) ||
+        (handler->loop == NULL))
+    {
+        if ((handler->loop != NULL) && (config->runtime != NULL))
+        {
+            runtime_detach (config->runtime, handler->loop);
+        }
+        else if (handler->loop != NULL)
+        {
+            event_loop_destroy (handler->loop);
+        }
+
+        free (handler->snapshots);
+        free (handler->discovered);
+        free (handler->detected_servers);
+        free (handler);
+        return NULL;
+    }
+
+    bzero (handler->detected_servers, sizeofServerData);
+    handler->config = *config;
+
+    pthread_mutex_init (&handler->send_lock, NULL);
+    pthread_cond_init (&handler->sent_cond, NULL);
+
+    handler->conn_source.cb  = on_connection_event;
+    handler->conn_source.ctx = handler;
+    handler->broadcast_source.cb  = on_broadcast_event;
+    handler->broadcast_source.ctx = handler;
+    timer_init (&handler->idle_timer, on_idle_timer, handler);
+    timer_init (&handler->discovery_timer, on_discovery_timer, handler);
+    handler->batch_flush.cb  = deliver_batch;
+    handler->batch_flush.ctx = handler;
+
+    if (config->receive_batch_cb != NULL)
+    {
+        if (handler->config.receive_batch_size == 0)
+        {
+            handler->config.receive_batch_size = DEFAULT_RECEIVE_BATCH;
+        }
+
+        handler->batch = (ClientMessage *) malloc (sizeof(ClientMessage) * handler->config.receive_batch_size);
+
+        if (handler->batch == NULL)
+        {
+            client_release (handler);
+            return NULL;
+        }
+    }
+
+    if ((config->runtime == NULL) &&
+        thread_create (&handler->network_thread, &config->network_thread, network_thread, handler))
+    {
+        client_release (handler);
+        return NULL;
+    }
+
+    if (config->runtime != NULL)
+    {
+        event_loop_call (handler->loop, bind_memory_task, handler);
+    }
+
+    if (handler->batch != NULL)
+    {
+        event_loop_call (handler->loop, start_batch_task, handler);
+    }
+
+    return handler;
+}
+
+void * client_get_user_data(ClientHandler handler)
+{
+    return ((ClientHandler_t) handler)->config.user_data;
+}
+
+void client_get_poll_stats(ClientHandler handler, EventLoopStats *stats)
+{
+    event_loop_get_stats (((ClientHandler_t) handler)->loop, stats);
+}
+
+static void release_task(void *param)
+{
+    ClientHandler_t instance = (ClientHandler_t) param;
+
+    close_connection (instance);
+    close_broadcast (instance);
+    event_loop_remove_flush (instance->loop, &instance->batch_flush);
+
+    // Undelivered messages are dropped, like the connection
+    while (instance->batch_count != 0)
+    {
+        buffer_release (instance->batch[--instance->batch_count].message);
+    }
+
+    if (instance->discovery_fd != 0)
+    {
+        // Pending discovery completes without notification
+        instance->discovery_cb = NULL;
+        finish_discovery (instance);
+    }
+}
+
+static void release_instance_task(void *param)
+{
+    client_release ((ClientHandler_t) param);
+}
 
-/* Client information */
-typedef struct
+void client_deinit(ClientHandler handler)
 {
-    ClientConfig config;        ///< Client configuration
-    int socket_fd;              ///< Connection file descriptor
-    Server_t *detected_servers; ///< List of detected servers
-    int detected_servers_count; ///< Detected servers count
-} ClientInfo;
+    ClientHandler_t instance = (ClientHandler_t) handler;
+    int isNetworkThread = event_loop_is_current (instance->loop);
 
-typedef ClientInfo * ClientHandler_t;
+    client_disconnect (handler);
 
-ClientHandler client_init(ClientConfig * config)
-{
-    ClientHandler_t handler = (ClientHandler_t) malloc (sizeof(ClientInfo));
-    ssize_t sizeofServerData = sizeof(Server_t) * config->max_nb_servers;
+    event_loop_call (instance->loop, release_task, instance);
 
-    if (handler == NULL)
+    if (instance->config.runtime != NULL)
     {
-        return NULL;
+        // The shared loop keeps running; when deinitialized from a callback
+        // the instance is released after the current dispatch round
+        if (!isNetworkThread)
+        {
+            client_release (instance);
+        }
+        else if (event_loop_post (instance->loop, release_instance_task, instance) != 0)
+        {
+            DEBUG ("Client: State update[Instance leaked on deinit]\n");
+        }
+
+        return;
     }
 
-    bzero (handler, sizeof(ClientInfo));
-    handler->detected_servers = (Server_t*) malloc (sizeofServerData);
+    event_loop_stop (instance->loop);
 
-    if (handler->detected_servers == NULL)
+    if (isNetworkThread)
     {
-        free (handler);
-        return NULL;
+        // Released once the loop unwinds
+        instance->release_on_exit = 1;
+        return;
     }
 
-    bzero (handler->detected_servers, sizeofServerData);
-    handler->config = *config;
+    pthread_join (instance->network_thread, NULL);
+    client_release (instance);
+}
 
-    return handler;
+/**
+ * Parse a discovery response.
+ *
+ * @param[in]  message    Received datagram
+ * @param[in]  bytesRcvd  Datagram size
+ * @param[out] serverInfo Advertised details, id and rtt_us untouched
+ * @param[out] port       Advertised game port
+ *
+ * @return 1 if the datagram is a discovery response, 0 otherwise
+ */
+static int parse_server_info(const char *message, int bytesRcvd, ServerDetails *serverInfo, uint16_t *port)
+{
+    const int offset = sizeof(ADVERTISING_RESPONSE);
+    AdvertisingInfo info = {0};
+
+    if ((bytesRcvd < offset + 2) ||
+        (strncmp(message, ADVERTISING_RESPONSE, sizeof(ADVERTISING_RESPONSE)) != 0))
+    {
+        return 0;
+    }
+
+    // Shorter responses come from servers predating versioning
+    size_t available = (size_t) (bytesRcvd - offset);
+
+    memcpy (&info, &message[offset], (available < sizeof(info)) ? available : sizeof(info));
+
+    int nameLength = bytesRcvd - (offset + 2);
+    int maxlen     = (nameLength > (int) sizeof(serverInfo->name)) ?
+        (int) sizeof(serverInfo->name) : nameLength;
+
+    strncpy (serverInfo->name, info.name, maxlen);
+
+    *port                      = ntohs (info.port);
+    serverInfo->version        = info.version;
+    serverInfo->nb_clients     = ntohs (info.nb_clients);
+    serverInfo->max_nb_clients = ntohs (info.max_nb_clients);
+    serverInfo->load           = info.load;
+    serverInfo->capabilities   = ntohl (info.capabilities);
+
+    return 1;
 }
 
-void client_deinit(ClientHandler handler)
+static int parse_advertisement(
+    ClientHandler_t handler,
+    const char *message,
+    int bytesRcvd,
+    in_addr_t ip,
+    ServerDetails *serverInfo)
 {
-    client_disconnect (handler);
-    free (handler);
+    Server_t * server = &handler->detected_servers[handler->detected_servers_count];
+
+    if (parse_server_info (message, bytesRcvd, serverInfo, &server->port))
+    {
+        // Expected response received.
+        DEBUG ("Received %d bytes", bytesRcvd);
+
+        serverInfo->id     = handler->detected_servers_count;
+        serverInfo->rtt_us = 0;
+        server->ip         = ip;
+
+        DEBUG ("Server detected: %s %d\n", serverInfo->name, server->port);
+
+        ++handler->detected_servers_count;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static int send_discovery_request(ClientHandler_t handler, int sock)
+{
+    struct sockaddr_in addr = {0};
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr ((const char *) handler->config.ip);
+    addr.sin_port = htons (handler->config.port);
+
+    return sendto (sock, ADVERTISING_REQUEST, sizeof(ADVERTISING_REQUEST), 0, (struct sockaddr *) &addr, sizeof(addr));
 }
 
 uint16_t client_list_servers(
@@ -85,16 +976,12 @@ uint16_t client_list_servers(
         return 0;
     }
 
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr ((const char *) handler->config.ip);
-    addr.sin_port = htons (handler->config.port);
-
     struct timeval tv;
     tv.tv_sec = 0;
     tv.tv_usec = timeoutMs * 1000;
     setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, (const char*) &tv, sizeof(tv));
 
-    status = sendto (sock, ADVERTISING_REQUEST, sizeof(ADVERTISING_REQUEST), 0, (struct sockaddr *) &addr, sizeof(addr));
+    status = send_discovery_request (handler, sock);
 
     if (status == -1)
     {
@@ -123,58 +1010,337 @@ uint16_t client_list_servers(
             // Timeout or error, exit
             break;
         }
-        else if ((bytesRcvd >= 6) &&
-            (strncmp(message, ADVERTISING_RESPONSE, sizeof(ADVERTISING_RESPONSE)) == 0))
-        {
-            // Expected response received.
-            int offset = sizeof(ADVERTISING_RESPONSE);
-            Server_t * server = &handler->detected_servers[handler->detected_servers_count];
-            ServerDetails * serverInfo = &servers[handler->detected_servers_count];
-            DEBUG ("Received %d bytes", bytesRcvd);
 
-            int nameLength = bytesRcvd - (offset + 2);
-            int maxlen     = (nameLength > sizeof(serverInfo->name)) ?
-                sizeof(serverInfo->name) : nameLength;
+        parse_advertisement (
+            handler,
+            message,
+            bytesRcvd,
+            addr.sin_addr.s_addr,
+            &servers[handler->detected_servers_count]);
+    }
+
+    close (sock);
+
+    return handler->detected_servers_count;
+}
+
+static void on_discovery_event(void *ctx, uint32_t events)
+{
+    ClientHandler_t instance = (ClientHandler_t) ctx;
+    struct sockaddr_in addr = {0};
+    socklen_t addrlen = sizeof(addr);
+    char message[1024] = {0};
+
+    if (instance->discovery_fd == 0)
+    {
+        // Finished earlier in the same dispatch round
+        return;
+    }
+
+    int bytesRcvd = recvfrom (
+        instance->discovery_fd,
+        message,
+        sizeof(message),
+        MSG_DONTWAIT,
+        (struct sockaddr *) &addr,
+        &addrlen);
+
+    if (bytesRcvd > 0)
+    {
+        parse_advertisement (
+            instance,
+            message,
+            bytesRcvd,
+            addr.sin_addr.s_addr,
+            &instance->discovered[instance->detected_servers_count]);
+    }
+
+    if (instance->detected_servers_count >= instance->discovery_max)
+    {
+        finish_discovery (instance);
+    }
+}
+
+/** Discovery request executed on the network thread */
+typedef struct
+{
+    ClientHandler_t instance;        ///< Client handler
+    uint16_t max_servers;            ///< Servers wanted
+    uint16_t timeout_ms;             ///< Discovery duration
+    client_notify_cb_servers cb;     ///< Completion handler
+    Status status;                   ///< Result
+} DiscoveryRequest;
 
-            serverInfo->id = handler->detected_servers_count;
-            memcpy  (&server->port,    &message[offset],   2);
-            strncpy (serverInfo->name, &message[offset+2], maxlen);
+static void discovery_task(void *param)
+{
+    DiscoveryRequest * request = (DiscoveryRequest *) param;
+    ClientHandler_t instance = request->instance;
 
-            server->ip   = addr.sin_addr.s_addr;
-            server->port = ntohs (server->port);
+    if (instance->discovery_fd != 0)
+    {
+        // One discovery at a time
+        request->status = E_NOT_MANAGED;
+        return;
+    }
 
-            DEBUG ("Server detected: %s %d\n", serverInfo->name, server->port);
+    int sock = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
 
-            ++handler->detected_servers_count;
+    if ((sock == -1) || (send_discovery_request (instance, sock) == -1))
+    {
+        if (sock != -1)
+        {
+            close (sock);
         }
+
+        request->status = E_ERR_ON_SEND;
+        return;
     }
 
-    close (sock);
+    instance->discovery_fd = sock;
+    instance->discovery_cb = request->cb;
+    instance->discovery_max =
+        (request->max_servers > instance->config.max_nb_servers) ?
+            instance->config.max_nb_servers : request->max_servers;
+    instance->detected_servers_count = 0;
 
-    return handler->detected_servers_count;
+    instance->discovery_source.cb  = on_discovery_event;
+    instance->discovery_source.ctx = instance;
+
+    event_loop_add (instance->loop, sock, EPOLLIN, &instance->discovery_source);
+    timer_wheel_schedule (event_loop_timers (instance->loop), &instance->discovery_timer, request->timeout_ms);
+
+    request->status = E_OK;
+}
+
+Status client_list_servers_async(
+    ClientHandler handler,
+    uint16_t maxServerCount,
+    uint16_t timeoutMs,
+    client_notify_cb_servers cb)
+{
+    ClientHandler_t instance = (ClientHandler_t) handler;
+    DiscoveryRequest request = { instance, maxServerCount, timeoutMs, cb, E_NOT_INITIALIZED };
+
+    event_loop_call (instance->loop, discovery_task, &request);
+
+    return request.status;
+}
+
+static int is_full(const ServerDetails *server)
+{
+    return (server->max_nb_clients != 0) && (server->nb_clients >= server->max_nb_clients);
+}
+
+static uint64_t server_cost(const ServerDetails *server)
+{
+    uint32_t occupancy = (server->max_nb_clients != 0) ?
+        (100 * server->nb_clients) / server->max_nb_clients : 0;
+
+    // A fully loaded or occupied server weighs as if twice as far
+    return (uint64_t) server->rtt_us * (100 + server->load + occupancy);
 }
 
-void *receive_thread(void *handler)
+static int compare_servers(const void *a, const void *b)
+{
+    const ServerDetails * first  = (const ServerDetails *) a;
+    const ServerDetails * second = (const ServerDetails *) b;
+    int firstRank  = (first->rtt_us == 0) ? 2 : is_full (first);
+    int secondRank = (second->rtt_us == 0) ? 2 : is_full (second);
+
+    if (firstRank != secondRank)
+    {
+        return firstRank - secondRank;
+    }
+
+    return (server_cost (first) > server_cost (second)) - (server_cost (first) < server_cost (second));
+}
+
+uint16_t client_rank_servers(
+    ClientHandler handler,
+    ServerDetails *servers,
+    uint16_t count,
+    uint16_t timeoutMs)
 {
-    char buffer[1024];
     ClientHandler_t instance = (ClientHandler_t) handler;
+    struct sockaddr_in addr = {0};
+    uint16_t pending = 0;
+    uint16_t answered = 0;
+    char message[1024];
+
+    int sock = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+    if (sock == -1)
+    {
+        return 0;
+    }
 
-    pthread_detach(pthread_self());
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (instance->config.port);
+
+    uint64_t startUs = event_loop_now_us ();
+    uint64_t deadlineUs = startUs + (uint64_t) timeoutMs * 1000;
+
+    // Servers listen for discovery on unicast too; all probes leave at once
+    for (uint16_t index = 0; index < count; ++index)
+    {
+        servers[index].rtt_us = 0;
+
+        if (servers[index].id < instance->detected_servers_count)
+        {
+            addr.sin_addr.s_addr = instance->detected_servers[servers[index].id].ip;
+
+            if (sendto (sock, ADVERTISING_REQUEST, sizeof(ADVERTISING_REQUEST), 0, (struct sockaddr *) &addr, sizeof(addr)) > 0)
+            {
+                ++pending;
+            }
+        }
+    }
 
-    while (1)
+    while (answered < pending)
     {
-        int dataLength = recv (instance->socket_fd, buffer, sizeof(buffer), 0);
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        socklen_t addrlen = sizeof(addr);
+        uint64_t nowUs = event_loop_now_us ();
+        ServerDetails reply;
+        uint16_t port;
 
-        if (dataLength <= 0)
+        if ((nowUs >= deadlineUs) || (poll (&pfd, 1, (deadlineUs - nowUs + 999) / 1000) <= 0))
         {
-            client_disconnect (instance);
             break;
         }
 
-        instance->config.receive_cb (instance, buffer, dataLength);
+        int bytesRcvd = recvfrom (sock, message, sizeof(message), MSG_DONTWAIT, (struct sockaddr *) &addr, &addrlen);
+        uint32_t rttUs = (uint32_t) (event_loop_now_us () - startUs);
+
+        if (!parse_server_info (message, bytesRcvd, &reply, &port))
+        {
+            continue;
+        }
+
+        // Servers sharing an address each answer with their own port
+        for (uint16_t index = 0; index < count; ++index)
+        {
+            ServerDetails * server = &servers[index];
+
+            if ((server->rtt_us == 0) &&
+                (server->id < instance->detected_servers_count) &&
+                (instance->detected_servers[server->id].ip == addr.sin_addr.s_addr) &&
+                (instance->detected_servers[server->id].port == port))
+            {
+                server->rtt_us         = (rttUs != 0) ? rttUs : 1;
+                server->version        = reply.version;
+                server->nb_clients     = reply.nb_clients;
+                server->max_nb_clients = reply.max_nb_clients;
+                server->load           = reply.load;
+                server->capabilities   = reply.capabilities;
+                ++answered;
+            }
+        }
+    }
+
+    close (sock);
+
+    qsort (servers, count, sizeof(ServerDetails), compare_servers);
+
+    return answered;
+}
+
+static int connect_server(ClientHandler_t instance, const Server_t *server)
+{
+    struct sockaddr_in sa = {0};
+    int socketFd = socket (PF_INET, SOCK_STREAM, 0);
+
+    if (socketFd == -1)
+    {
+        return -1;
+    }
+
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = server->ip;
+    sa.sin_port = htons (server->port);
+
+    if (instance->config.busy_poll_us != 0)
+    {
+        int busyPollUs = instance->config.busy_poll_us;
+
+        setsockopt (socketFd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs));
+    }
+
+    if (connect (socketFd, (const struct sockaddr *)&sa, (socklen_t)sizeof(sa)))
+    {
+        close (socketFd);
+        return -1;
+    }
+
+    return socketFd;
+}
+
+/**
+ * Open or resume a session on a new connection. Only the session reply
+ * is read here; the frames following it are left to the network thread.
+ *
+ * @param[in] instance Reference to client instance
+ * @param[in] socketFd Connected socket
+ * @param[in] type     FRAME_HELLO or FRAME_RESUME
+ *
+ * @return 1 if the session resumed, 0 if a new one started, -1 on error
+ */
+static int open_session(ClientHandler_t instance, int socketFd, uint8_t type)
+{
+    struct timeval tv = { SESSION_TIMEOUT_MS / 1000, (SESSION_TIMEOUT_MS % 1000) * 1000 };
+    SessionFrame request = {0};
+    SessionFrame reply;
+    uint8_t header[FRAME_HEADER_LEN];
+    uint8_t expected[FRAME_HEADER_LEN];
+
+    request.client_id = htonl (instance->session_id);
+    request.token     = htobe64 (instance->session_token);
+    request.received  = htobe64 (instance->resume_received);
+
+    frame_encode_header (expected, FRAME_SESSION, sizeof(reply));
+    setsockopt (socketFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if ((frame_send (socketFd, type, &request, (type == FRAME_RESUME) ? sizeof(request) : 0, 0) != 0) ||
+        (recv (socketFd, header, sizeof(header), MSG_WAITALL) != sizeof(header)) ||
+        (memcmp (header, expected, sizeof(header)) != 0) ||
+        (recv (socketFd, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply)))
+    {
+        return -1;
+    }
+
+    tv.tv_sec  = 0;
+    tv.tv_usec = 0;
+    setsockopt (socketFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    instance->has_session   = 1;
+    instance->session_id    = ntohl (reply.client_id);
+    instance->session_token = be64toh (reply.token);
+
+    if (!reply.is_resumed)
+    {
+        instance->resume_received = 0;
     }
 
-    pthread_exit(NULL);
+    return reply.is_resumed;
+}
+
+static void new_session_task(void *param)
+{
+    ClientHandler_t instance = (ClientHandler_t) param;
+
+    // Broadcasts and snapshot baselines of the previous session are not reused
+    close_broadcast (instance);
+    bzero (instance->snapshot_sequences, sizeof(instance->snapshot_sequences));
+    instance->snapshot_pending = 0;
+}
+
+static void attach_connection(ClientHandler_t instance, int socketFd)
+{
+    pthread_mutex_lock (&instance->send_lock);
+    instance->socket_fd = socketFd;
+    pthread_mutex_unlock (&instance->send_lock);
+
+    event_loop_call (instance->loop, attach_task, instance);
 }
 
 Status client_connect(ClientHandler handler, ServerId serverId)
@@ -184,54 +1350,107 @@ Status client_connect(ClientHandler handler, ServerId serverId)
 
     if (serverId < instance->detected_servers_count)
     {
-        struct sockaddr_in sa = {0};
+        Server_t server = instance->detected_servers[serverId];
+        int socketFd = connect_server (instance, &server);
 
-        instance->socket_fd = socket (PF_INET, SOCK_STREAM, 0);
+        instance->resume_received = 0;
 
-        if (instance->socket_fd != -1)
+        if ((socketFd != -1) && instance->config.session_resume && (open_session (instance, socketFd, FRAME_HELLO) < 0))
         {
-            pthread_t threadId;
-            sa.sin_family = AF_INET;
-            sa.sin_addr.s_addr = instance->detected_servers[serverId].ip;
-            sa.sin_port = instance->detected_servers[serverId].port;
-
-            if (connect (instance->socket_fd, (const struct sockaddr *)&sa, (socklen_t)sizeof(sa)) ||
-                (pthread_create (&threadId, NULL, receive_thread, instance)))
-            {
-                close (instance->socket_fd);
-                instance->socket_fd = 0;
-
-                status = E_NOT_INITIALIZED;
-            }
-            else
-            {
-                DEBUG("Client: State update[Connected to server]\n");
+            close (socketFd);
+            socketFd = -1;
+        }
 
-                status = E_OK;
-            }
+        if (socketFd == -1)
+        {
+            status = E_NOT_INITIALIZED;
         }
         else
         {
-            instance->socket_fd = 0;
+            DEBUG("Client: State update[Connected to server]\n");
 
-            status = E_NOT_INITIALIZED;
+            instance->session_server = server;
+
+            event_loop_call (instance->loop, new_session_task, instance);
+            attach_connection (instance, socketFd);
+
+            status = E_OK;
         }
     }
 
     return status;
 }
 
+static void detach_task(void *param)
+{
+    ClientHandler_t instance = (ClientHandler_t) param;
+
+    // Nothing more is received on the previous connection past this point
+    close_connection (instance);
+    instance->resume_received = instance->received_count;
+}
+
+Status client_resume(ClientHandler handler)
+{
+    ClientHandler_t instance = (ClientHandler_t) handler;
+    int socketFd = -1;
+    int isResumed = -1;
+
+    pthread_mutex_lock (&instance->send_lock);
+    int isConnected = instance->socket_fd != 0;
+    pthread_mutex_unlock (&instance->send_lock);
+
+    if (!instance->config.session_resume || !instance->has_session || isConnected)
+    {
+        return E_NOT_INITIALIZED;
+    }
+
+    // Connect first: the new socket must not reuse the descriptor of the
+    // previous connection while the network thread may still track it
+    socketFd = connect_server (instance, &instance->session_server);
+
+    if (socketFd != -1)
+    {
+        event_loop_call (instance->loop, detach_task, instance);
+        isResumed = open_session (instance, socketFd, FRAME_RESUME);
+    }
+
+    if (isResumed < 0)
+    {
+        if (socketFd != -1)
+        {
+            close (socketFd);
+        }
+
+        return E_NOT_INITIALIZED;
+    }
+
+    DEBUG("Client: State update[Reconnected to server, session %s]\n", isResumed ? "resumed" : "renewed");
+
+    attach_connection (instance, socketFd);
+
+    return isResumed ? E_OK : E_NOT_MANAGED;
+}
+
 Status client_disconnect(ClientHandler handler)
 {
     ClientHandler_t instance = (ClientHandler_t) handler;
     Status status = E_NOT_INITIALIZED;
 
-    if (instance->socket_fd != 0)
+    pthread_mutex_lock (&instance->send_lock);
+    int socketFd = instance->socket_fd;
+    instance->socket_fd = 0;
+    instance->events = 0;
+    send_queue_clear (&instance->queue);
+    pthread_cond_broadcast (&instance->sent_cond);
+    pthread_mutex_unlock (&instance->send_lock);
+
+    if (socketFd != 0)
     {
         DEBUG("Client: State update[Disconnecting from server]\n");
 
-        shutdown (instance->socket_fd, SHUT_RDWR);
-        instance->socket_fd = 0;
+        // The network thread closes the socket on end of stream
+        shutdown (socketFd, SHUT_RDWR);
 
         if (instance->config.disconnect_cb != NULL)
         {
@@ -249,14 +1468,48 @@ Status client_send_message(ClientHandler handler, void * buffer, ssize_t bufferS
     ClientHandler_t instance = (ClientHandler_t) handler;
     Status status = E_NOT_INITIALIZED;
 
+    int isNetworkThread = event_loop_is_current (instance->loop);
+
+    if ((bufferSize < 0) || (bufferSize > MAX_MESSAGE_LEN))
+    {
+        return E_ERR_ON_SEND;
+    }
+
+    pthread_mutex_lock (&instance->send_lock);
+
+    size_t total = FRAME_HEADER_LEN + (size_t) bufferSize;
+
+    // Wait for the network thread to drain the queue, unless called from it
+    while (!isNetworkThread && (instance->socket_fd != 0) && (instance->queue.length + total > SEND_QUEUE_SIZE))
+    {
+        pthread_cond_wait (&instance->sent_cond, &instance->send_lock);
+    }
+
     if (instance->socket_fd != 0)
     {
         DEBUG("Client: State update[Sending message to server]\n");
 
-        ssize_t len = send (instance->socket_fd, buffer, bufferSize, 0);
-
-        status = (len < 0) ? E_ERR_ON_SEND : E_OK;
+        // Refused without room, the connection stays intact
+        status = ((instance->queue.length + total > SEND_QUEUE_SIZE) ||
+                  (send_frame (instance, FRAME_DATA, buffer, bufferSize, SEND_QUEUE_SIZE) < 0)) ?
+            E_ERR_ON_SEND : E_OK;
     }
 
+    pthread_mutex_unlock (&instance->send_lock);
+
+    return status;
+}
+
+MessageBuffer *client_alloc_buffer(ClientHandler handler, uint32_t capacity)
+{
+    return buffer_pool_alloc (capacity);
+}
+
+Status client_send_buffer(ClientHandler handler, MessageBuffer *buffer)
+{
+    Status status = client_send_message (handler, buffer->data, buffer->size);
+
+    buffer_release (buffer);
+
     return status;
 }
@@ -1,7 +1,9 @@
 #ifndef NETWORKING_CLIENT_H_
 #define NETWORKING_CLIENT_H_
 
+#include "buffer_pool.h"
 #include "client_server_cfg.h"
+#include "runtime.h"
 
 #include <stdint.h>
 #include <sys/types.h>
@@ -14,8 +16,51 @@ extern "C"
 
     typedef uint16_t ServerId;
     typedef void * ClientHandler;
+
+    /**
+     * Callback prototype for receiving data.
+     * Called once per message, on the client network thread.
+     *
+     * @param[in] handler Reference to client instance.
+     * @param[in] buffer  Reference to received data
+     * @param[in] size    Size of data received
+     */
     typedef void (*client_notify_cb_receive)(ClientHandler handler, char *buffer, int size);
 
+    /** Message delivered in a batch */
+    typedef struct
+    {
+        char *buffer;           ///< Received data, valid during the callback
+        int size;               ///< Size of data received
+        MessageBuffer *message; ///< Pooled storage of buffer; buffer_ref keeps it past the callback
+    } ClientMessage;
+
+    /**
+     * Callback prototype for receiving data in batches.
+     * Called once per network thread wakeup with the messages received
+     * since, in arrival order, and before a snapshot or disconnect
+     * notification that follows them.
+     *
+     * @param[in] handler  Reference to client instance.
+     * @param[in] messages Received messages
+     * @param[in] count    Number of messages
+     */
+    typedef void (*client_notify_cb_receive_batch)(
+        ClientHandler handler,
+        const ClientMessage *messages,
+        uint32_t count);
+
+    /**
+     * Callback prototype for rebuilt snapshots, see server_send_snapshot.
+     * Called on the client network thread.
+     *
+     * @param[in] handler Reference to client instance.
+     * @param[in] state   Server state, valid during the callback; kept as
+     *     a baseline for later snapshots, must not be modified
+     * @param[in] size    State size
+     */
+    typedef void (*client_notify_cb_snapshot)(ClientHandler handler, const char *state, int size);
+
     /**
      * Callback prototype for client error
      *
@@ -23,6 +68,28 @@ extern "C"
      */
     typedef void (*client_notify_cb_disconnect)(ClientHandler handler);
 
+    /** Server details */
+    typedef struct
+    {
+        ServerId id;              ///< Server id
+        char name[MAX_NAME_LEN];  ///< Server name
+        uint8_t version;          ///< Advertising version, 0 if the server reports no load
+        uint16_t nb_clients;      ///< Occupied client slots
+        uint16_t max_nb_clients;  ///< Client limit
+        uint8_t load;             ///< Network thread busy time, percent
+        uint32_t capabilities;    ///< ADVERTISING_CAP_* flags
+        uint32_t rtt_us;          ///< Round trip time measured by client_rank_servers, 0 if unreachable
+    } ServerDetails;
+
+    /**
+     * Callback prototype for asynchronous discovery completion.
+     *
+     * @param[in] handler Reference to client instance.
+     * @param[in] servers Detected servers, valid during the callback
+     * @param[in] count   Number of detected servers
+     */
+    typedef void (*client_notify_cb_servers)(ClientHandler handler, ServerDetails *servers, uint16_t count);
+
     /** Client configuration */
     typedef struct
     {
@@ -31,22 +98,45 @@ extern "C"
         uint16_t max_nb_servers;                   ///< Maximum number of servers to list
         client_notify_cb_receive receive_cb;       ///< Handler for callback on new data
         client_notify_cb_disconnect disconnect_cb; ///< Handler for callback on disconnect
+        uint32_t idle_timeout_ms;                  ///< Disconnect if server silent for longer (0 disables)
+        void * user_data;                          ///< Application context, see client_get_user_data
+        Runtime * runtime;                         ///< Shared I/O threads (NULL starts a dedicated network thread)
+        ThreadConfig network_thread;               ///< Dedicated network thread attributes (ignored with a runtime)
+        uint32_t busy_poll_us;                     ///< Spin this long after activity before sleeping; also SO_BUSY_POLL on the connection (0 disables)
+        int session_resume;                        ///< Open resumable sessions, requires resume_grace_ms on the server
+        int broadcast_channel;                     ///< Receive server broadcasts from its multicast group when offered
+        client_notify_cb_snapshot snapshot_cb;     ///< Handler for callback on new snapshot
+        uint32_t snapshot_size;                    ///< Largest snapshot accepted, must cover the server states (0 disables snapshots)
+        client_notify_cb_receive_batch receive_batch_cb; ///< Handler for callback on new data, replaces receive_cb (NULL disables)
+        uint32_t receive_batch_size;               ///< Most messages per batch, a full batch is delivered early (0 selects 256)
     } ClientConfig;
 
-    /** Server details */
-    typedef struct
-    {
-        ServerId id;             ///< Server id
-        char name[MAX_NAME_LEN]; ///< Server name
-    } ServerDetails;
-
     /**
      * Starts a new client based on the provided configuration.
+     * With a runtime, the client runs on one of its I/O threads.
+     * Client state is moved to the NUMA node of the network thread when
+     * the thread is pinned.
      *
      * @param[in] config Reference to client configuration
      */
     ClientHandler client_init(ClientConfig * config);
 
+    /**
+     * Get application context provided in the configuration.
+     *
+     * @param[in] handler Reference to client instance.
+     */
+    void * client_get_user_data(ClientHandler handler);
+
+    /**
+     * Get time the network thread spent spinning versus sleeping. With a
+     * runtime, covers every instance sharing the same I/O thread.
+     *
+     * @param[in]  handler Reference to client instance.
+     * @param[out] stats   Waiting statistics
+     */
+    void client_get_poll_stats(ClientHandler handler, EventLoopStats *stats);
+
     /**
      * Stops client and release any resources.
      *
@@ -63,6 +153,20 @@ extern "C"
      */
     Status client_connect(ClientHandler handler, ServerId serverId);
 
+    /**
+     * Reconnect to the server of the last session and resume it. The
+     * server resends the messages missed since the connection dropped,
+     * without discovery. Requires session_resume.
+     *
+     * @param[in] handler Reference to client instance.
+     *
+     * @return E_OK if the session resumed, E_NOT_MANAGED if connected
+     *     under a new session (application state must be resynchronized),
+     *     E_NOT_INITIALIZED if still connected, without a previous session
+     *     or if the server cannot be reached.
+     */
+    Status client_resume(ClientHandler handler);
+
     /**
      * Close existing connection to server
      *
@@ -86,7 +190,47 @@ extern "C"
         uint16_t timeoutMs);
 
     /**
-     * Send message to server
+     * Check servers that advertise on the configured instance without
+     * blocking. Runs on the client network thread; the callback is invoked
+     * from it once maxServerCount servers answered or the timeout elapsed.
+     * Only one discovery may be in progress.
+     *
+     * @param[in] handler        Reference to client instance.
+     * @param[in] maxServerCount Maximum number of servers to be retrieved.
+     * @param[in] timeoutMs      Discovery duration in milliseconds.
+     * @param[in] cb             Handler to callback with the results.
+     */
+    Status client_list_servers_async(
+        ClientHandler handler,
+        uint16_t maxServerCount,
+        uint16_t timeoutMs,
+        client_notify_cb_servers cb);
+
+    /**
+     * Measure the round trip time to each server in parallel and sort them
+     * best first: reachable servers with room by round trip time, weighted
+     * by their load and occupancy, then full servers, then servers that did
+     * not answer. Load details are refreshed from the answers.
+     * Servers must come from the last discovery of this instance.
+     *
+     * @param[in]     handler   Reference to client instance.
+     * @param[in,out] servers   Servers to rank, sorted in place
+     * @param[in]     count     Number of servers
+     * @param[in]     timeoutMs Time to wait for answers
+     *
+     * @return Number of servers that answered
+     */
+    uint16_t client_rank_servers(
+        ClientHandler handler,
+        ServerDetails *servers,
+        uint16_t count,
+        uint16_t timeoutMs);
+
+    /**
+     * Send message to server. What the socket does not take is queued
+     * and sent by the network thread. While the server reads slower,
+     * the call waits for room in the queue; from a callback, on the
+     * network thread, a message without room is refused instead.
      *
      * @param[in] handler    Reference to sever instance
      * @param[in] buffer     Reference to data to be sent
@@ -94,6 +238,26 @@ extern "C"
      */
     Status client_send_message(ClientHandler handler, void * buffer, ssize_t bufferSize);
 
+    /**
+     * Get a pooled buffer to build a message in. Hand it over with
+     * client_send_buffer or drop it with buffer_release.
+     *
+     * @param[in] handler  Reference to sever instance
+     * @param[in] capacity Bytes needed, at most MAX_MESSAGE_LEN
+     *
+     * @return Buffer with size 0, NULL on error
+     */
+    MessageBuffer *client_alloc_buffer(ClientHandler handler, uint32_t capacity);
+
+    /**
+     * Send a pooled message to server. Takes over the caller's reference,
+     * also on error; add one with buffer_ref to send the same buffer again.
+     *
+     * @param[in] handler Reference to sever instance
+     * @param[in] buffer  Message of buffer->size bytes
+     */
+    Status client_send_buffer(ClientHandler handler, MessageBuffer *buffer);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,227 @@
+#ifndef NETWORKING_CLIENT_HPP_
+#define NETWORKING_CLIENT_HPP_
+
+/*
+ * Header-only C++20 layer over client.h.
+ *
+ * The handler type is a template parameter, see server.hpp.
+ *
+ *     struct Session
+ *     {
+ *         void on_receive(net::ClientRef client, std::span<const std::byte> data);
+ *         void on_disconnect(net::ClientRef client);
+ *         void on_snapshot(net::ClientRef client, std::span<const std::byte> state);
+ *     };
+ *
+ *     net::Client<Session> client (config, Session {});
+ *
+ * A plain lambda taking (ClientRef, std::span<const std::byte>) is accepted
+ * as a receive-only handler. A handler implementing
+ *
+ *         void on_receive_batch(net::ClientRef client, std::span<const ClientMessage> messages);
+ *
+ * receives once per network thread wakeup instead, see receive_batch_cb.
+ */
+
+#include "client.h"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <utility>
+
+namespace net
+{
+    /** Non-owning reference to a client instance, valid inside callbacks */
+    class ClientRef
+    {
+        public:
+            explicit ClientRef(ClientHandler handle) : handle_ (handle) {}
+
+            ClientHandler handle() const { return handle_; }
+
+            /**
+             * Check servers that advertise on the configured instance.
+             *
+             * @return Detected servers, a prefix of the provided storage
+             */
+            std::span<ServerDetails> list_servers(std::span<ServerDetails> servers, uint16_t timeoutMs) const
+            {
+                uint16_t count = client_list_servers (handle_, servers.data (), servers.size (), timeoutMs);
+
+                return servers.first (count);
+            }
+
+            /**
+             * Rank servers by round trip time, load and occupancy.
+             *
+             * @return Servers that answered, best first
+             */
+            std::span<ServerDetails> rank_servers(std::span<ServerDetails> servers, uint16_t timeoutMs) const
+            {
+                uint16_t count = client_rank_servers (handle_, servers.data (), servers.size (), timeoutMs);
+
+                return servers.first (count);
+            }
+
+            Status connect(ServerId serverId) const
+            {
+                return client_connect (handle_, serverId);
+            }
+
+            Status resume() const
+            {
+                return client_resume (handle_);
+            }
+
+            Status disconnect() const
+            {
+                return client_disconnect (handle_);
+            }
+
+            Status send(std::span<const std::byte> data) const
+            {
+                return client_send_message (handle_, const_cast<std::byte *> (data.data ()), data.size ());
+            }
+
+        protected:
+            ClientHandler handle_;
+    };
+
+    namespace detail
+    {
+        template <typename Handler>
+        concept HasClientReceive = requires (Handler &h, ClientHandler c, std::span<const std::byte> d)
+        {
+            h.on_receive (ClientRef (c), d);
+        };
+
+        template <typename Handler>
+        concept IsClientReceive = requires (Handler &h, ClientHandler c, std::span<const std::byte> d)
+        {
+            h (ClientRef (c), d);
+        };
+    }
+
+    /**
+     * Owning, move-only client instance.
+     *
+     * @tparam Handler Type implementing any of on_receive, on_receive_batch,
+     *     on_disconnect and on_snapshot
+     */
+    template <typename Handler>
+    class Client : public ClientRef
+    {
+        public:
+            Client(ClientConfig config, Handler handler)
+                : ClientRef (nullptr), state_ (std::make_unique<Handler> (std::move (handler)))
+            {
+                config.user_data = state_.get ();
+                config.receive_cb = on_receive;
+                config.disconnect_cb = nullptr;
+                config.snapshot_cb = nullptr;
+                config.receive_batch_cb = nullptr;
+
+                if constexpr (requires (Handler &h, ClientRef c) { h.on_disconnect (c); })
+                {
+                    config.disconnect_cb = on_disconnect;
+                }
+
+                if constexpr (requires (Handler &h, ClientRef c, std::span<const std::byte> s) { h.on_snapshot (c, s); })
+                {
+                    config.snapshot_cb = on_snapshot;
+                }
+
+                if constexpr (requires (Handler &h, ClientRef c, std::span<const ClientMessage> m) { h.on_receive_batch (c, m); })
+                {
+                    config.receive_batch_cb = on_receive_batch;
+                }
+
+                handle_ = client_init (&config);
+            }
+
+            ~Client()
+            {
+                reset ();
+            }
+
+            Client(Client &&other) noexcept
+                : ClientRef (std::exchange (other.handle_, nullptr)), state_ (std::move (other.state_))
+            {
+            }
+
+            Client &operator=(Client &&other) noexcept
+            {
+                if (this != &other)
+                {
+                    reset ();
+                    handle_ = std::exchange (other.handle_, nullptr);
+                    state_ = std::move (other.state_);
+                }
+
+                return *this;
+            }
+
+            Client(const Client &) = delete;
+            Client &operator=(const Client &) = delete;
+
+            /** Check if the client was initialized */
+            explicit operator bool() const { return handle_ != nullptr; }
+
+            Handler &handler() { return *state_; }
+
+            /** Disconnect and release the client */
+            void reset()
+            {
+                if (handle_ != nullptr)
+                {
+                    client_deinit (handle_);
+                }
+
+                handle_ = nullptr;
+                state_.reset ();
+            }
+
+        private:
+            static Handler &state(ClientHandler handle)
+            {
+                return *static_cast<Handler *> (client_get_user_data (handle));
+            }
+
+            static void on_receive(ClientHandler handle, char *buffer, int size)
+            {
+                std::span<const std::byte> data (reinterpret_cast<const std::byte *> (buffer), size);
+
+                if constexpr (detail::HasClientReceive<Handler>)
+                {
+                    state (handle).on_receive (ClientRef (handle), data);
+                }
+                else if constexpr (detail::IsClientReceive<Handler>)
+                {
+                    state (handle) (ClientRef (handle), data);
+                }
+            }
+
+            static void on_receive_batch(ClientHandler handle, const ClientMessage *messages, uint32_t count)
+            {
+                state (handle).on_receive_batch (ClientRef (handle), std::span<const ClientMessage> (messages, count));
+            }
+
+            static void on_disconnect(ClientHandler handle)
+            {
+                state (handle).on_disconnect (ClientRef (handle));
+            }
+
+            static void on_snapshot(ClientHandler handle, const char *snapshot, int size)
+            {
+                std::span<const std::byte> data (reinterpret_cast<const std::byte *> (snapshot), size);
+
+                state (handle).on_snapshot (ClientRef (handle), data);
+            }
+
+            /** Heap allocated so the context address survives moves */
+            std::unique_ptr<Handler> state_;
+    };
+}
+
+#endif /* NETWORKING_CLIENT_HPP_*/
@@ -0,0 +1,163 @@
+#ifndef NETWORKING_CLIENT_CORO_HPP_
+#define NETWORKING_CLIENT_CORO_HPP_
+
+/*
+ * C++20 coroutine interface over client.h, see server_coro.hpp.
+ *
+ *     net::co::Task play(net::co::Client &client)
+ *     {
+ *         auto servers = co_await client.discover (1000);
+ *
+ *         if (servers.empty () || client.connect (servers[0].id) != E_OK)
+ *         {
+ *             co_return;
+ *         }
+ *
+ *         while (auto data = co_await client.recv ())
+ *         {
+ *             ...
+ *         }
+ *     }
+ *
+ * Coroutines are resumed on the client network thread.
+ */
+
+#include "client.hpp"
+#include "../common/coro.hpp"
+
+#include <coroutine>
+#include <span>
+
+namespace net::co
+{
+    /** Client instance driven by coroutines. Not movable. */
+    class Client
+    {
+        public:
+            class DiscoverAwaiter
+            {
+                public:
+                    DiscoverAwaiter(Client &client, uint16_t maxServerCount, uint16_t timeoutMs)
+                        : client_ (client), max_server_count_ (maxServerCount), timeout_ms_ (timeoutMs)
+                    {
+                    }
+
+                    bool await_ready() const noexcept { return false; }
+
+                    bool await_suspend(std::coroutine_handle<> handle)
+                    {
+                        handle_ = handle;
+                        client_.discoverer_ = this;
+
+                        ClientHandler clientHandle = client_.client_.handle ();
+                        uint16_t maxServerCount = max_server_count_;
+                        uint16_t timeoutMs = timeout_ms_;
+
+                        // On success the coroutine may already run on the network thread
+                        return client_list_servers_async (clientHandle, maxServerCount, timeoutMs, on_servers) == E_OK;
+                    }
+
+                    std::span<const ServerDetails> await_resume() const noexcept { return result_; }
+
+                private:
+                    static void on_servers(ClientHandler handle, ServerDetails *servers, uint16_t count)
+                    {
+                        Client &client = *static_cast<Handler *> (client_get_user_data (handle))->self;
+                        DiscoverAwaiter *discoverer = std::exchange (client.discoverer_, nullptr);
+
+                        discoverer->result_ = std::span<const ServerDetails> (servers, count);
+                        discoverer->handle_.resume ();
+                    }
+
+                    Client &client_;
+                    uint16_t max_server_count_;
+                    uint16_t timeout_ms_;
+                    std::coroutine_handle<> handle_;
+                    std::span<const ServerDetails> result_;
+            };
+
+            explicit Client(ClientConfig config)
+                : max_nb_servers_ (config.max_nb_servers), client_ (config, Handler { this })
+            {
+            }
+
+            /** Releases the client, a pending recv completes empty on this thread */
+            ~Client()
+            {
+                client_.reset ();
+                mailbox_.close ();
+            }
+
+            Client(const Client &) = delete;
+            Client &operator=(const Client &) = delete;
+
+            /** Check if the client was initialized */
+            explicit operator bool() const { return static_cast<bool> (client_); }
+
+            ClientRef ref() const { return client_; }
+
+            /**
+             * Check servers that advertise on the configured instance.
+             * One discovery may be in progress at a time.
+             *
+             * @return Detected servers, valid until the next discovery
+             */
+            DiscoverAwaiter discover(uint16_t timeoutMs)
+            {
+                return DiscoverAwaiter (*this, max_nb_servers_, timeoutMs);
+            }
+
+            /** Connect to discovered server, blocks until connected */
+            Status connect(ServerId serverId)
+            {
+                mailbox_.open ();
+
+                Status status = client_.connect (serverId);
+
+                if (status != E_OK)
+                {
+                    mailbox_.close ();
+                }
+
+                return status;
+            }
+
+            Status disconnect() { return client_.disconnect (); }
+
+            /**
+             * Wait for the next message.
+             *
+             * @return Message, valid until the coroutine suspends again;
+             *     empty once disconnected
+             */
+            Mailbox::Awaiter recv() { return mailbox_.receive (); }
+
+            /** Send message, completes without suspending */
+            Ready<Status> send(std::span<const std::byte> data) { return { client_.send (data) }; }
+
+        private:
+            struct Handler
+            {
+                Client *self;
+
+                void on_receive(ClientRef client, std::span<const std::byte> data)
+                {
+                    self->mailbox_.deliver (data);
+                }
+
+                void on_disconnect(ClientRef client)
+                {
+                    self->mailbox_.close ();
+                }
+            };
+
+            uint16_t max_nb_servers_;
+            Mailbox mailbox_;
+            DiscoverAwaiter *discoverer_ = nullptr;
+
+            // Last member so callbacks never see the others uninitialized
+            net::Client<Handler> client_;
+    };
+}
+
+#endif /* NETWORKING_CLIENT_CORO_HPP_*/
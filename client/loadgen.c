@@ -0,0 +1,613 @@
+/*
+ * Simulates many clients against a game server from a few threads and
+ * reports connect latency, throughput and response latency.
+ *
+ * Usage: client-loadgen [options] <server ip> <game port>
+ *
+ *   -n clients   Simulated clients (default 1000)
+ *   -c rate      Connections opened per second (default 1000, 0 opens all at once)
+ *   -t threads   I/O threads (default 2)
+ *   -s size      Message size in bytes (default 64)
+ *   -r rate      Messages per second per client (default 1, 0 only connects)
+ *   -k think     Closed loop: send the next message this many ms after
+ *                the response to the previous one, instead of at -r rate
+ *   -d seconds   Run time (default 10)
+ *   -S           Open a session on connect, for servers with resume_grace_ms
+ *
+ * Clients speak the framing of the client library without its threads:
+ * each I/O thread runs one event loop over its share of the connections.
+ * Connect latency runs until the connection is established, or until the
+ * session reply with -S. Response latency runs from a message to the next
+ * message the server sends on the same connection. Sockets never block:
+ * a message the socket buffer has no room for is dropped, and a
+ * connection that took only part of a frame is closed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "event_loop.h"
+#include "frame.h"
+
+#define LOADGEN_TICK_MS    1
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_BUCKETS  (64 << HISTOGRAM_SUB_BITS)
+
+/** Latency histogram, buckets within 1/16 of their value */
+typedef struct
+{
+    uint64_t counts[HISTOGRAM_BUCKETS]; ///< Samples per bucket
+    uint64_t count;                     ///< Samples
+    uint64_t max_us;                    ///< Largest sample
+} Histogram;
+
+/** Run parameters */
+typedef struct
+{
+    struct sockaddr_in server; ///< Server under test
+    uint32_t clients;          ///< Simulated clients
+    uint32_t connect_rate;     ///< Connections per second, 0 for all at once
+    uint32_t threads;          ///< I/O threads
+    uint32_t message_size;     ///< Message size
+    uint32_t send_rate;        ///< Messages per second per client
+    int32_t think_ms;          ///< Closed loop think time, -1 for open loop
+    uint32_t duration_s;       ///< Run time
+    int is_session;            ///< Open a session on connect
+} Settings;
+
+struct Worker;
+
+/** Simulated client */
+typedef struct
+{
+    int fd;                 ///< Connection to the server, 0 if closed
+    EventSource source;     ///< Loop registration
+    FrameReader reader;     ///< Incoming stream
+    TimerEntry timer;       ///< Next message
+    struct Worker *worker;  ///< Owning worker
+    uint64_t connect_us;    ///< Time the connect started
+    uint64_t sent_us;       ///< Time of the oldest unanswered message, 0 if none
+    int is_open;            ///< Connect completed
+    int is_connected;       ///< Connect latency recorded
+} Connection;
+
+/** I/O thread and the clients it simulates */
+typedef struct Worker
+{
+    const Settings *settings;    ///< Run parameters
+    pthread_t thread;            ///< I/O thread
+    EventLoop *loop;             ///< Loop driving the clients
+    Connection *connections;     ///< Simulated clients
+    uint32_t count;              ///< Size of connections
+    uint32_t opened;             ///< Connections started
+    uint64_t start_us;           ///< Run start
+    TimerEntry connect_timer;    ///< Paces connection opening
+    TimerEntry stop_timer;       ///< Ends the run
+    uint8_t *message;            ///< Message sent by every client
+    Histogram connect_latency;   ///< Connect latencies
+    Histogram response_latency;  ///< Response latencies
+    uint64_t connected;          ///< Established connections
+    uint64_t failed;             ///< Refused or failed connections
+    uint64_t closed;             ///< Established connections closed by the server
+    uint64_t broken;             ///< Connections closed after a partial frame
+    uint64_t messages_sent;      ///< Messages sent
+    uint64_t messages_dropped;   ///< Messages not sent, socket buffer full
+    uint64_t messages_received;  ///< Messages received
+    uint64_t bytes_sent;         ///< Payload bytes sent
+    uint64_t bytes_received;     ///< Payload bytes received
+} Worker;
+
+static uint32_t histogram_index(uint64_t valueUs)
+{
+    if (valueUs < (1 << HISTOGRAM_SUB_BITS))
+    {
+        return (uint32_t) valueUs;
+    }
+
+    uint32_t msb = 63 - __builtin_clzll (valueUs);
+    uint32_t sub = (valueUs >> (msb - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+
+    return ((msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+static uint64_t histogram_value(uint32_t index)
+{
+    if (index < (1 << HISTOGRAM_SUB_BITS))
+    {
+        return index;
+    }
+
+    uint32_t msb = (index >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = index & ((1 << HISTOGRAM_SUB_BITS) - 1);
+
+    return ((1ULL << HISTOGRAM_SUB_BITS) + sub) << (msb - HISTOGRAM_SUB_BITS);
+}
+
+static void histogram_record(Histogram *histogram, uint64_t valueUs)
+{
+    histogram->counts[histogram_index (valueUs)]++;
+    histogram->count++;
+
+    if (valueUs > histogram->max_us)
+    {
+        histogram->max_us = valueUs;
+    }
+}
+
+static void histogram_merge(Histogram *histogram, const Histogram *other)
+{
+    for (uint32_t index = 0; index < HISTOGRAM_BUCKETS; ++index)
+    {
+        histogram->counts[index] += other->counts[index];
+    }
+
+    histogram->count += other->count;
+
+    if (other->max_us > histogram->max_us)
+    {
+        histogram->max_us = other->max_us;
+    }
+}
+
+static uint64_t histogram_percentile(const Histogram *histogram, double percentile)
+{
+    uint64_t rank = (uint64_t) (histogram->count * percentile / 100.0);
+    uint64_t seen = 0;
+
+    for (uint32_t index = 0; index < HISTOGRAM_BUCKETS; ++index)
+    {
+        seen += histogram->counts[index];
+
+        if (seen > rank)
+        {
+            return histogram_value (index);
+        }
+    }
+
+    return histogram->max_us;
+}
+
+static void print_histogram(const char *name, const Histogram *histogram)
+{
+    if (histogram->count == 0)
+    {
+        printf ("%s: no samples\n", name);
+        return;
+    }
+
+    printf ("%s (us): p50 %llu, p99 %llu, p99.9 %llu, max %llu over %llu samples\n",
+        name,
+        (unsigned long long) histogram_percentile (histogram, 50.0),
+        (unsigned long long) histogram_percentile (histogram, 99.0),
+        (unsigned long long) histogram_percentile (histogram, 99.9),
+        (unsigned long long) histogram->max_us,
+        (unsigned long long) histogram->count);
+}
+
+static void close_connection(Connection *connection)
+{
+    Worker *worker = connection->worker;
+
+    if (connection->fd != 0)
+    {
+        timer_wheel_cancel (event_loop_timers (worker->loop), &connection->timer);
+        event_loop_remove (worker->loop, connection->fd);
+        close (connection->fd);
+        connection->fd = 0;
+    }
+}
+
+/**
+ * Send a frame without blocking.
+ *
+ * @return 0 if sent, -1 if the socket buffer was full or the connection
+ *     was closed because only part of the frame went out
+ */
+static int send_frame(Connection *connection, uint8_t type, const void *payload, uint32_t length)
+{
+    if (frame_send (connection->fd, type, payload, length, MSG_DONTWAIT) == 0)
+    {
+        return 0;
+    }
+
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+    {
+        // The rest of the frame would have to be sent before anything else
+        connection->worker->broken++;
+        close_connection (connection);
+    }
+
+    return -1;
+}
+
+static void send_message(Connection *connection)
+{
+    Worker *worker = connection->worker;
+
+    // A full socket buffer means the server is not keeping up
+    if (send_frame (connection, FRAME_DATA, worker->message, worker->settings->message_size) != 0)
+    {
+        worker->messages_dropped++;
+        return;
+    }
+
+    if (connection->sent_us == 0)
+    {
+        connection->sent_us = event_loop_now_us ();
+    }
+
+    worker->messages_sent++;
+    worker->bytes_sent += worker->settings->message_size;
+}
+
+static void on_send_timer(TimerEntry *timer, void *ctx)
+{
+    Connection *connection = (Connection *) ctx;
+    const Settings *settings = connection->worker->settings;
+
+    send_message (connection);
+
+    if ((settings->think_ms < 0) && (connection->fd != 0))
+    {
+        timer_wheel_schedule (event_loop_timers (connection->worker->loop), timer, 1000 / settings->send_rate);
+    }
+}
+
+static void start_sending(Connection *connection)
+{
+    Worker *worker = connection->worker;
+    const Settings *settings = worker->settings;
+
+    histogram_record (&worker->connect_latency, event_loop_now_us () - connection->connect_us);
+    connection->is_connected = 1;
+
+    if (settings->think_ms >= 0)
+    {
+        send_message (connection);
+    }
+    else if (settings->send_rate != 0)
+    {
+        // Spread the clients over the send period
+        timer_wheel_schedule (event_loop_timers (worker->loop), &connection->timer,
+            (uint32_t) (rand () % (1000 / settings->send_rate + 1)));
+    }
+}
+
+static void on_response(Connection *connection, uint32_t length)
+{
+    Worker *worker = connection->worker;
+
+    worker->messages_received++;
+    worker->bytes_received += length;
+
+    if (connection->sent_us == 0)
+    {
+        return;
+    }
+
+    histogram_record (&worker->response_latency, event_loop_now_us () - connection->sent_us);
+    connection->sent_us = 0;
+
+    if (worker->settings->think_ms >= 0)
+    {
+        timer_wheel_schedule (event_loop_timers (worker->loop), &connection->timer, worker->settings->think_ms);
+    }
+}
+
+static void on_connected(Connection *connection)
+{
+    Worker *worker = connection->worker;
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+
+    getsockopt (connection->fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+
+    if ((error != 0) ||
+        (event_loop_modify (worker->loop, connection->fd, EPOLLIN, &connection->source) != 0) ||
+        (worker->settings->is_session && (frame_send (connection->fd, FRAME_HELLO, NULL, 0, MSG_DONTWAIT) != 0)))
+    {
+        worker->failed++;
+        close_connection (connection);
+        return;
+    }
+
+    connection->is_open = 1;
+    worker->connected++;
+
+    if (!worker->settings->is_session)
+    {
+        start_sending (connection);
+    }
+}
+
+static void on_connection_event(void *ctx, uint32_t events)
+{
+    Connection *connection = (Connection *) ctx;
+    Worker *worker = connection->worker;
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+    int status;
+
+    if (!connection->is_open)
+    {
+        on_connected (connection);
+        return;
+    }
+
+    ssize_t bytesRcvd = frame_reader_recv (&connection->reader, connection->fd, MSG_DONTWAIT);
+
+    if ((bytesRcvd < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+    {
+        return;
+    }
+
+    if (bytesRcvd <= 0)
+    {
+        worker->closed++;
+        close_connection (connection);
+        return;
+    }
+
+    while ((connection->fd != 0) &&
+        ((status = frame_reader_next (&connection->reader, &type, &payload, &length)) == 1))
+    {
+        if (type == FRAME_DATA)
+        {
+            on_response (connection, length);
+        }
+        else if (type == FRAME_PING)
+        {
+            send_frame (connection, FRAME_PONG, payload, length);
+        }
+        else if ((type == FRAME_SESSION) && !connection->is_connected)
+        {
+            start_sending (connection);
+        }
+    }
+
+    if (status < 0)
+    {
+        worker->closed++;
+        close_connection (connection);
+    }
+}
+
+static void open_connection(Worker *worker, Connection *connection)
+{
+    const Settings *settings = worker->settings;
+    int fd = socket (PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    connection->worker = worker;
+    connection->connect_us = event_loop_now_us ();
+    connection->source.cb = on_connection_event;
+    connection->source.ctx = connection;
+    timer_init (&connection->timer, on_send_timer, connection);
+    frame_reader_reset (&connection->reader);
+
+    if ((fd == -1) ||
+        ((connect (fd, (const struct sockaddr *) &settings->server, sizeof(settings->server)) != 0) &&
+            (errno != EINPROGRESS)) ||
+        (event_loop_add (worker->loop, fd, EPOLLOUT, &connection->source) != 0))
+    {
+        if (fd != -1)
+        {
+            close (fd);
+        }
+
+        worker->failed++;
+        return;
+    }
+
+    connection->fd = fd;
+}
+
+static void on_connect_timer(TimerEntry *timer, void *ctx)
+{
+    Worker *worker = (Worker *) ctx;
+    uint64_t elapsedUs = event_loop_now_us () - worker->start_us;
+    const Settings *settings = worker->settings;
+    uint64_t due = (settings->connect_rate == 0) ? worker->count :
+        (elapsedUs * settings->connect_rate / (1000000ULL * settings->threads) + 1);
+
+    while ((worker->opened < worker->count) && (worker->opened < due))
+    {
+        open_connection (worker, &worker->connections[worker->opened++]);
+    }
+
+    if (worker->opened < worker->count)
+    {
+        timer_wheel_schedule (event_loop_timers (worker->loop), timer, LOADGEN_TICK_MS);
+    }
+}
+
+static void on_stop_timer(TimerEntry *timer, void *ctx)
+{
+    event_loop_stop (((Worker *) ctx)->loop);
+}
+
+static void start_task(void *ctx)
+{
+    Worker *worker = (Worker *) ctx;
+
+    worker->start_us = event_loop_now_us ();
+    timer_init (&worker->connect_timer, on_connect_timer, worker);
+    timer_init (&worker->stop_timer, on_stop_timer, worker);
+    timer_wheel_schedule (event_loop_timers (worker->loop), &worker->stop_timer, worker->settings->duration_s * 1000);
+    on_connect_timer (&worker->connect_timer, worker);
+}
+
+static void *worker_thread(void *param)
+{
+    Worker *worker = (Worker *) param;
+
+    event_loop_run (worker->loop);
+
+    return NULL;
+}
+
+static void usage(const char *name)
+{
+    fprintf (stderr,
+        "Usage: %s [-n clients] [-c connects/s] [-t threads] [-s size] [-r messages/s] [-k think ms]"
+        " [-d seconds] [-S] <server ip> <game port>\n", name);
+}
+
+static void raise_file_limit(uint32_t needed)
+{
+    struct rlimit limit;
+
+    if (getrlimit (RLIMIT_NOFILE, &limit) != 0)
+    {
+        return;
+    }
+
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit (RLIMIT_NOFILE, &limit);
+
+    if (limit.rlim_cur < needed)
+    {
+        fprintf (stderr, "File descriptor limit %llu is below %u, connections will fail\n",
+            (unsigned long long) limit.rlim_cur, needed);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Settings settings = {0};
+    Worker *workers;
+    Worker total = {0};
+    int option;
+
+    settings.clients      = 1000;
+    settings.connect_rate = 1000;
+    settings.threads      = 2;
+    settings.message_size = 64;
+    settings.send_rate    = 1;
+    settings.think_ms     = -1;
+    settings.duration_s   = 10;
+
+    while ((option = getopt (argc, argv, "n:c:t:s:r:k:d:S")) != -1)
+    {
+        switch (option)
+        {
+            case 'n': settings.clients      = atoi (optarg); break;
+            case 'c': settings.connect_rate = atoi (optarg); break;
+            case 't': settings.threads      = atoi (optarg); break;
+            case 's': settings.message_size = atoi (optarg); break;
+            case 'r': settings.send_rate    = atoi (optarg); break;
+            case 'k': settings.think_ms     = atoi (optarg); break;
+            case 'd': settings.duration_s   = atoi (optarg); break;
+            case 'S': settings.is_session   = 1; break;
+            default:
+                usage (argv[0]);
+                return 1;
+        }
+    }
+
+    if ((argc - optind != 2) || (settings.threads == 0) || (settings.message_size > MAX_MESSAGE_LEN))
+    {
+        usage (argv[0]);
+        return 1;
+    }
+
+    if (settings.send_rate > 1000)
+    {
+        // Bounded by the timer resolution
+        settings.send_rate = 1000;
+    }
+
+    settings.server.sin_family = AF_INET;
+    settings.server.sin_addr.s_addr = inet_addr (argv[optind]);
+    settings.server.sin_port = htons (atoi (argv[optind + 1]));
+
+    raise_file_limit (settings.clients + 64);
+
+    workers = (Worker *) calloc (settings.threads, sizeof(Worker));
+
+    if (workers == NULL)
+    {
+        fprintf (stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (uint32_t index = 0; index < settings.threads; ++index)
+    {
+        Worker *worker = &workers[index];
+
+        worker->settings = &settings;
+        worker->count = settings.clients / settings.threads + (index < settings.clients % settings.threads);
+        worker->connections = (Connection *) calloc (worker->count + 1, sizeof(Connection));
+        worker->message = (uint8_t *) malloc (settings.message_size + 1);
+        worker->loop = event_loop_create (LOADGEN_TICK_MS);
+
+        if ((worker->connections == NULL) || (worker->message == NULL) || (worker->loop == NULL))
+        {
+            fprintf (stderr, "Out of memory\n");
+            return 1;
+        }
+
+        memset (worker->message, 'x', settings.message_size);
+        event_loop_post (worker->loop, start_task, worker);
+
+        if (pthread_create (&worker->thread, NULL, worker_thread, worker) != 0)
+        {
+            fprintf (stderr, "Cannot start thread\n");
+            return 1;
+        }
+    }
+
+    for (uint32_t index = 0; index < settings.threads; ++index)
+    {
+        Worker *worker = &workers[index];
+
+        pthread_join (worker->thread, NULL);
+
+        for (uint32_t connection = 0; connection < worker->count; ++connection)
+        {
+            close_connection (&worker->connections[connection]);
+        }
+
+        histogram_merge (&total.connect_latency, &worker->connect_latency);
+        histogram_merge (&total.response_latency, &worker->response_latency);
+        total.connected         += worker->connected;
+        total.failed            += worker->failed;
+        total.closed            += worker->closed;
+        total.broken            += worker->broken;
+        total.messages_sent     += worker->messages_sent;
+        total.messages_dropped  += worker->messages_dropped;
+        total.messages_received += worker->messages_received;
+        total.bytes_sent        += worker->bytes_sent;
+        total.bytes_received    += worker->bytes_received;
+
+        event_loop_destroy (worker->loop);
+        free (worker->connections);
+        free (worker->message);
+    }
+
+    printf ("Clients: %llu connected, %llu failed, %llu closed by the server, %llu closed on a partial frame\n",
+        (unsigned long long) total.connected, (unsigned long long) total.failed, (unsigned long long) total.closed,
+        (unsigned long long) total.broken);
+    print_histogram ("Connect latency", &total.connect_latency);
+    printf ("Sent: %llu messages, %llu bytes (%.0f messages/s), %llu dropped on full socket buffer\n",
+        (unsigned long long) total.messages_sent, (unsigned long long) total.bytes_sent,
+        (double) total.messages_sent / settings.duration_s, (unsigned long long) total.messages_dropped);
+    printf ("Received: %llu messages, %llu bytes (%.0f messages/s)\n",
+        (unsigned long long) total.messages_received, (unsigned long long) total.bytes_received,
+        (double) total.messages_received / settings.duration_s);
+    print_histogram ("Response latency", &total.response_latency);
+
+    free (workers);
+
+    return 0;
+}
@@ -18,19 +18,23 @@ void error_cb(ClientHandler handler)
 
 int main(void)
 {
-    ClientConfig clientConfig;
+    ClientConfig clientConfig = {0};
 
     memcpy (clientConfig.ip, "224.0.0.26", sizeof(clientConfig.ip));
 
     clientConfig.max_nb_servers = 5;
     clientConfig.port = 6000;
     clientConfig.receive_cb = recive_data_cb;
+    clientConfig.idle_timeout_ms = 5000;
 
     ServerDetails servers[10];
     ClientHandler handler = client_init (&clientConfig);
 
     int count = client_list_servers (handler, servers, 10, 500);
 
+    // Prefer the closest, least busy server
+    count = client_rank_servers (handler, servers, count, 200);
+
     if (count > 0)
     {
         printf ("Server found. Connecting to %s\n", servers[0].name);
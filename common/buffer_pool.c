@@ -0,0 +1,186 @@
+#include "buffer_pool.h"
+#include "client_server_cfg.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define BUFFER_CLASSES    3
+#define BUFFER_CACHE_SIZE 64
+#define BUFFER_SLAB_SIZE  32
+
+static const uint32_t class_capacity[BUFFER_CLASSES] = { 256, 1024, MAX_MESSAGE_LEN };
+
+/** Free buffers shared by all threads, per class */
+typedef struct
+{
+    pthread_mutex_t lock;  ///< Protects the list
+    MessageBuffer *free;   ///< Free list
+} SharedClass;
+
+/** Free buffers of one thread, per class */
+typedef struct
+{
+    MessageBuffer *free[BUFFER_CLASSES][BUFFER_CACHE_SIZE]; ///< Free buffers
+    uint32_t count[BUFFER_CLASSES];                         ///< Free buffers per class
+    int is_registered;                                      ///< Flushed on thread exit
+} ThreadCache;
+
+static SharedClass shared[BUFFER_CLASSES] =
+{
+    { PTHREAD_MUTEX_INITIALIZER, NULL },
+    { PTHREAD_MUTEX_INITIALIZER, NULL },
+    { PTHREAD_MUTEX_INITIALIZER, NULL }
+};
+
+static __thread ThreadCache cache;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static uint64_t allocated;
+
+/** Move free buffers from the cache to the shared list, keeping some */
+static void flush_class(ThreadCache *threadCache, int sizeClass, uint32_t keep)
+{
+    SharedClass *list = &shared[sizeClass];
+
+    pthread_mutex_lock (&list->lock);
+
+    while (threadCache->count[sizeClass] > keep)
+    {
+        MessageBuffer *buffer = threadCache->free[sizeClass][--threadCache->count[sizeClass]];
+
+        buffer->next = list->free;
+        list->free = buffer;
+    }
+
+    pthread_mutex_unlock (&list->lock);
+}
+
+static void flush_cache(void *param)
+{
+    // Buffers cached by an exiting thread stay usable by the others
+    for (int sizeClass = 0; sizeClass < BUFFER_CLASSES; ++sizeClass)
+    {
+        flush_class ((ThreadCache *) param, sizeClass, 0);
+    }
+}
+
+static void create_cache_key(void)
+{
+    pthread_key_create (&cache_key, flush_cache);
+}
+
+static void register_cache(void)
+{
+    if (!cache.is_registered)
+    {
+        pthread_once (&cache_key_once, create_cache_key);
+        pthread_setspecific (cache_key, &cache);
+        cache.is_registered = 1;
+    }
+}
+
+static void refill_class(int sizeClass)
+{
+    SharedClass *list = &shared[sizeClass];
+    uint32_t capacity = class_capacity[sizeClass];
+
+    pthread_mutex_lock (&list->lock);
+
+    while ((list->free != NULL) && (cache.count[sizeClass] < BUFFER_CACHE_SIZE / 2))
+    {
+        cache.free[sizeClass][cache.count[sizeClass]++] = list->free;
+        list->free = list->free->next;
+    }
+
+    pthread_mutex_unlock (&list->lock);
+
+    if (cache.count[sizeClass] != 0)
+    {
+        return;
+    }
+
+    // Grow by a slab, kept until exit
+    size_t stride = (sizeof(MessageBuffer) + capacity + 15) & ~(size_t) 15;
+    uint8_t *slab = (uint8_t *) malloc (stride * BUFFER_SLAB_SIZE);
+
+    if (slab == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t index = 0; index < BUFFER_SLAB_SIZE; ++index)
+    {
+        MessageBuffer *buffer = (MessageBuffer *) (slab + index * stride);
+
+        buffer->data       = (uint8_t *) (buffer + 1);
+        buffer->capacity   = capacity;
+        buffer->size_class = sizeClass;
+        cache.free[sizeClass][cache.count[sizeClass]++] = buffer;
+    }
+
+    __atomic_add_fetch (&allocated, BUFFER_SLAB_SIZE, __ATOMIC_RELAXED);
+}
+
+MessageBuffer *buffer_pool_alloc(uint32_t capacity)
+{
+    int sizeClass = 0;
+
+    while ((sizeClass < BUFFER_CLASSES) && (class_capacity[sizeClass] < capacity))
+    {
+        ++sizeClass;
+    }
+
+    if (sizeClass == BUFFER_CLASSES)
+    {
+        return NULL;
+    }
+
+    register_cache ();
+
+    if (cache.count[sizeClass] == 0)
+    {
+        refill_class (sizeClass);
+
+        if (cache.count[sizeClass] == 0)
+        {
+            return NULL;
+        }
+    }
+
+    MessageBuffer *buffer = cache.free[sizeClass][--cache.count[sizeClass]];
+
+    buffer->size = 0;
+    buffer->refs = 1;
+
+    return buffer;
+}
+
+void buffer_ref(MessageBuffer *buffer)
+{
+    __atomic_add_fetch (&buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+void buffer_release(MessageBuffer *buffer)
+{
+    int sizeClass = buffer->size_class;
+
+    if (__atomic_sub_fetch (&buffer->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+        return;
+    }
+
+    register_cache ();
+
+    if (cache.count[sizeClass] == BUFFER_CACHE_SIZE)
+    {
+        // Released on another thread than allocated: hand half over
+        flush_class (&cache, sizeClass, BUFFER_CACHE_SIZE / 2);
+    }
+
+    cache.free[sizeClass][cache.count[sizeClass]++] = buffer;
+}
+
+void buffer_pool_get_stats(BufferPoolStats *stats)
+{
+    stats->allocated = __atomic_load_n (&allocated, __ATOMIC_RELAXED);
+}
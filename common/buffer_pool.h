@@ -0,0 +1,69 @@
+#ifndef NETWORKING_BUFFER_POOL_H_
+#define NETWORKING_BUFFER_POOL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Message buffer from the process wide pool. Buffers come in a few
+     * size classes up to MAX_MESSAGE_LEN; each thread keeps a cache of free
+     * buffers per class, so allocating and releasing only takes a lock
+     * when a cache runs empty or full, and only allocates memory while the
+     * pool grows to its peak use. Pool memory is kept until exit.
+     */
+    typedef struct MessageBuffer
+    {
+        uint8_t *data;              ///< Message, capacity bytes
+        uint32_t size;              ///< Message size, set by the writer
+        uint32_t capacity;          ///< Usable bytes
+        uint32_t refs;              ///< References, see buffer_ref
+        uint8_t size_class;         ///< Pool class, library use
+        struct MessageBuffer *next; ///< Free list link, library use
+    } MessageBuffer;
+
+    /** Pool usage */
+    typedef struct
+    {
+        uint64_t allocated; ///< Buffers created since start; stops growing in steady state
+    } BufferPoolStats;
+
+    /**
+     * Get a buffer with one reference.
+     *
+     * @param[in] capacity Bytes needed, at most MAX_MESSAGE_LEN
+     *
+     * @return Buffer with size 0, NULL if too large or out of memory
+     */
+    MessageBuffer *buffer_pool_alloc(uint32_t capacity);
+
+    /**
+     * Add a reference. Safe to call from any thread.
+     *
+     * @param[in] buffer Referenced buffer
+     */
+    void buffer_ref(MessageBuffer *buffer);
+
+    /**
+     * Drop a reference; the last one returns the buffer to the pool.
+     * Safe to call from any thread.
+     *
+     * @param[in] buffer Referenced buffer
+     */
+    void buffer_release(MessageBuffer *buffer);
+
+    /**
+     * Get pool usage.
+     *
+     * @param[out] stats Usage
+     */
+    void buffer_pool_get_stats(BufferPoolStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_BUFFER_POOL_H_*/
@@ -1,9 +1,34 @@
 #ifndef NETWORKING_CLIENT_SERVER_CFG_H_
 #define NETWORKING_CLIENT_SERVER_CFG_H_
 
+#include <stdint.h>
+
 #define MAX_NAME_LEN 64
+#define MAX_MESSAGE_LEN 4096
 #define ADVERTISING_REQUEST  "Marco"
 #define ADVERTISING_RESPONSE "Polo"
+#define ADVERTISING_VERSION  1
+
+/** Advertised capabilities; the upper 16 bits are application defined */
+#define ADVERTISING_CAP_RESUME    0x0001 ///< Sessions can be resumed, see client_resume
+#define ADVERTISING_CAP_HEARTBEAT 0x0002 ///< Server pings its clients
+#define ADVERTISING_CAP_BROADCAST 0x0004 ///< Broadcasts can be received from a multicast group
+
+/**
+ * Discovery response following ADVERTISING_RESPONSE, network byte order.
+ * Servers predating versioning stop after the name; later versions only
+ * append fields.
+ */
+typedef struct __attribute__((packed))
+{
+    uint16_t port;            ///< Game port
+    char name[MAX_NAME_LEN];  ///< Server name, NUL padded
+    uint8_t version;          ///< ADVERTISING_VERSION
+    uint16_t nb_clients;      ///< Occupied client slots
+    uint16_t max_nb_clients;  ///< Client limit
+    uint8_t load;             ///< Network thread busy time over the last second, percent
+    uint32_t capabilities;    ///< ADVERTISING_CAP_* flags
+} AdvertisingInfo;
 
 typedef enum
 {
@@ -0,0 +1,205 @@
+#ifndef NETWORKING_CORO_HPP_
+#define NETWORKING_CORO_HPP_
+
+/*
+ * C++20 coroutine building blocks shared by server_coro.hpp and
+ * client_coro.hpp.
+ *
+ * Awaiters are resumed from the library network thread, inside the
+ * callback that completes them, so no thread is parked per awaiter. The
+ * awaiter lives in the coroutine frame; completing an operation does not
+ * allocate unless data arrives while nobody is waiting for it.
+ */
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace net::co
+{
+    /**
+     * Fire and forget coroutine. Starts immediately and releases its frame
+     * on completion.
+     */
+    struct Task
+    {
+        struct promise_type
+        {
+            Task get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate (); }
+        };
+    };
+
+    /** Awaiter for operations that complete synchronously */
+    template <typename T>
+    struct Ready
+    {
+        T value;
+
+        bool await_ready() const noexcept { return true; }
+        void await_suspend(std::coroutine_handle<>) const noexcept {}
+        T await_resume() noexcept { return std::move (value); }
+    };
+
+    /**
+     * Message queue with a single waiting coroutine.
+     * Messages delivered while a coroutine waits are handed over without
+     * copying and stay valid until that coroutine suspends again.
+     * Each open() starts a new generation: a receive started in an older
+     * one completes empty, never with messages of the next generation.
+     */
+    class Mailbox
+    {
+        public:
+            using Message = std::optional<std::span<const std::byte>>;
+
+            class Awaiter
+            {
+                public:
+                    explicit Awaiter(Mailbox &box) : box_ (box)
+                    {
+                        std::lock_guard<std::mutex> guard (box_.lock_);
+
+                        generation_ = box_.generation_;
+                    }
+
+                    bool await_ready()
+                    {
+                        std::lock_guard<std::mutex> guard (box_.lock_);
+
+                        return box_.is_ready (generation_);
+                    }
+
+                    bool await_suspend(std::coroutine_handle<> handle)
+                    {
+                        std::lock_guard<std::mutex> guard (box_.lock_);
+
+                        if (box_.is_ready (generation_))
+                        {
+                            return false;
+                        }
+
+                        handle_ = handle;
+                        box_.waiter_ = this;
+
+                        return true;
+                    }
+
+                    Message await_resume()
+                    {
+                        if (delivered_)
+                        {
+                            return result_;
+                        }
+
+                        std::lock_guard<std::mutex> guard (box_.lock_);
+
+                        if (generation_ != box_.generation_)
+                        {
+                            return std::nullopt;
+                        }
+
+                        return box_.pop ();
+                    }
+
+                private:
+                    friend class Mailbox;
+
+                    Mailbox &box_;
+                    uint64_t generation_;
+                    std::coroutine_handle<> handle_;
+                    Message result_;
+                    bool delivered_ = false;
+            };
+
+            /** Wait for the next message, empty once closed and drained */
+            Awaiter receive() { return Awaiter (*this); }
+
+            /** Accept messages again, in a new generation */
+            void open()
+            {
+                std::lock_guard<std::mutex> guard (lock_);
+
+                backlog_.clear ();
+                closed_ = false;
+                generation_++;
+            }
+
+            /** Deliver message, resuming the waiter inline if any */
+            void deliver(std::span<const std::byte> data)
+            {
+                std::unique_lock<std::mutex> guard (lock_);
+
+                if (waiter_ == nullptr)
+                {
+                    backlog_.emplace_back (data.begin (), data.end ());
+                    return;
+                }
+
+                resume (guard, data);
+            }
+
+            /** Stop accepting messages, resuming the waiter with an empty result */
+            void close()
+            {
+                std::unique_lock<std::mutex> guard (lock_);
+
+                closed_ = true;
+
+                if (waiter_ != nullptr)
+                {
+                    resume (guard, std::nullopt);
+                }
+            }
+
+        private:
+            bool is_ready(uint64_t generation) const
+            {
+                return (generation != generation_) || !backlog_.empty () || closed_;
+            }
+
+            Message pop()
+            {
+                if (backlog_.empty ())
+                {
+                    return std::nullopt;
+                }
+
+                current_ = std::move (backlog_.front ());
+                backlog_.pop_front ();
+
+                return std::span<const std::byte> (current_);
+            }
+
+            void resume(std::unique_lock<std::mutex> &guard, Message result)
+            {
+                Awaiter *waiter = std::exchange (waiter_, nullptr);
+                std::coroutine_handle<> handle = waiter->handle_;
+
+                waiter->result_ = result;
+                waiter->delivered_ = true;
+
+                guard.unlock ();
+                handle.resume ();
+            }
+
+            std::mutex lock_;
+            std::deque<std::vector<std::byte>> backlog_;
+            std::vector<std::byte> current_;
+            Awaiter *waiter_ = nullptr;
+            uint64_t generation_ = 0;
+            bool closed_ = true;
+    };
+}
+
+#endif /* NETWORKING_CORO_HPP_*/
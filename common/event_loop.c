@@ -0,0 +1,400 @@
+#include "event_loop.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MAX_EVENTS 64
+
+/** EventTask states */
+#define TASK_EMBEDDED  0 ///< Owned by the poster, left alone after execution
+#define TASK_ALLOCATED 1 ///< Freed after execution
+#define TASK_CALL      2 ///< Synchronous call waiting for completion
+#define TASK_DONE      3 ///< Synchronous call completed
+
+struct EventLoop
+{
+    int epoll_fd;              ///< Epoll instance
+    int wake_fd;               ///< Eventfd used to wake the loop
+    EventSource wake_source;   ///< Wake event source
+    int is_running;            ///< Loop is dispatching
+    volatile int stop;         ///< Stop requested
+    pthread_t thread;          ///< Thread running the loop
+    pthread_mutex_t lock;      ///< Protects task queue and running state
+    pthread_cond_t task_done;  ///< Signaled after synchronous calls
+    EventTask *tasks_head;     ///< Queued tasks
+    EventTask *tasks_tail;     ///< Last queued task
+    TimerWheel timers;         ///< Timers driven by the loop
+    EventFlush *flushes;       ///< Work run after each dispatch round
+    EventFlush *flush_next;    ///< Next flush to run, moved on removal
+    uint32_t busy_poll_us;     ///< Spin budget after activity, 0 disables spinning
+    uint64_t last_event_us;    ///< Time of last returned event
+    EventLoopStats stats;      ///< Waiting statistics
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t event_loop_now_ms(void)
+{
+    return now_ns () / 1000000ULL;
+}
+
+uint64_t event_loop_now_us(void)
+{
+    return now_ns () / 1000ULL;
+}
+
+static void run_flushes(EventLoop *loop)
+{
+    EventFlush *flush = loop->flushes;
+
+    while (flush != NULL)
+    {
+        // A flush may remove the next one
+        loop->flush_next = flush->next;
+        flush->cb (flush->ctx);
+        flush = loop->flush_next;
+    }
+}
+
+static void run_tasks(EventLoop *loop)
+{
+    pthread_mutex_lock (&loop->lock);
+    EventTask *task = loop->tasks_head;
+    loop->tasks_head = NULL;
+    loop->tasks_tail = NULL;
+    pthread_mutex_unlock (&loop->lock);
+
+    while (task != NULL)
+    {
+        // Embedded tasks may be gone once executed
+        EventTask *next = task->next;
+        int state = task->state;
+
+        task->cb (task->ctx);
+
+        if (state == TASK_ALLOCATED)
+        {
+            free (task);
+        }
+        else if (state == TASK_CALL)
+        {
+            pthread_mutex_lock (&loop->lock);
+            task->state = TASK_DONE;
+            pthread_cond_broadcast (&loop->task_done);
+            pthread_mutex_unlock (&loop->lock);
+        }
+
+        task = next;
+    }
+}
+
+static void wake(EventLoop *loop)
+{
+    uint64_t one = 1;
+
+    if (write (loop->wake_fd, &one, sizeof(one)) < 0)
+    {
+        // Counter saturated, loop is awake anyway
+    }
+}
+
+static void on_wake(void *ctx, uint32_t events)
+{
+    EventLoop *loop = (EventLoop *) ctx;
+    uint64_t count;
+
+    if (read (loop->wake_fd, &count, sizeof(count)) < 0)
+    {
+        // Spurious wakeup
+    }
+}
+
+EventLoop *event_loop_create(uint32_t tickMs)
+{
+    EventLoop *loop = (EventLoop *) malloc (sizeof(EventLoop));
+
+    if (loop == NULL)
+    {
+        return NULL;
+    }
+
+    bzero (loop, sizeof(EventLoop));
+
+    loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    loop->wake_fd  = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    loop->wake_source.cb  = on_wake;
+    loop->wake_source.ctx = loop;
+
+    if ((loop->epoll_fd == -1) || (loop->wake_fd == -1) ||
+        (event_loop_add (loop, loop->wake_fd, EPOLLIN, &loop->wake_source) != 0))
+    {
+        if (loop->epoll_fd != -1)
+        {
+            close (loop->epoll_fd);
+        }
+
+        if (loop->wake_fd != -1)
+        {
+            close (loop->wake_fd);
+        }
+
+        free (loop);
+        return NULL;
+    }
+
+    pthread_mutex_init (&loop->lock, NULL);
+    pthread_cond_init (&loop->task_done, NULL);
+    timer_wheel_init (&loop->timers, tickMs, event_loop_now_ms ());
+
+    return loop;
+}
+
+void event_loop_destroy(EventLoop *loop)
+{
+    // Execute whatever was posted after the loop exited
+    run_tasks (loop);
+
+    close (loop->wake_fd);
+    close (loop->epoll_fd);
+
+    pthread_cond_destroy (&loop->task_done);
+    pthread_mutex_destroy (&loop->lock);
+
+    free (loop);
+}
+
+void event_loop_run(EventLoop *loop)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    pthread_mutex_lock (&loop->lock);
+    loop->thread     = pthread_self ();
+    loop->is_running = 1;
+    pthread_mutex_unlock (&loop->lock);
+
+    while (!loop->stop)
+    {
+        uint64_t beforeUs = event_loop_now_us ();
+        uint32_t busyPollUs = __atomic_load_n (&loop->busy_poll_us, __ATOMIC_RELAXED);
+        int isSpinning = (beforeUs - loop->last_event_us) < busyPollUs;
+        int timeoutMs = isSpinning ? 0 : timer_wheel_next_timeout (&loop->timers, beforeUs / 1000);
+        int count = epoll_wait (loop->epoll_fd, events, MAX_EVENTS, timeoutMs);
+        uint64_t afterUs = event_loop_now_us ();
+
+        if ((count < 0) && (errno != EINTR))
+        {
+            break;
+        }
+
+        if (count > 0)
+        {
+            loop->last_event_us = afterUs;
+        }
+
+        if (isSpinning)
+        {
+            __atomic_fetch_add (&loop->stats.spin_us, afterUs - beforeUs, __ATOMIC_RELAXED);
+            __atomic_fetch_add (&loop->stats.spin_hits, count > 0, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            __atomic_fetch_add (&loop->stats.sleep_us, afterUs - beforeUs, __ATOMIC_RELAXED);
+            __atomic_fetch_add (&loop->stats.wakeups, count > 0, __ATOMIC_RELAXED);
+        }
+
+        timer_wheel_advance (&loop->timers, event_loop_now_ms ());
+
+        for (int i = 0; (i < count) && !loop->stop; ++i)
+        {
+            EventSource *source = (EventSource *) events[i].data.ptr;
+
+            source->cb (source->ctx, events[i].events);
+        }
+
+        run_flushes (loop);
+        run_tasks (loop);
+    }
+
+    pthread_mutex_lock (&loop->lock);
+    loop->is_running = 0;
+    pthread_mutex_unlock (&loop->lock);
+
+    // Complete calls that raced with the stop request
+    run_tasks (loop);
+}
+
+void event_loop_set_busy_poll(EventLoop *loop, uint32_t budgetUs)
+{
+    __atomic_store_n (&loop->busy_poll_us, budgetUs, __ATOMIC_RELAXED);
+}
+
+void event_loop_get_stats(EventLoop *loop, EventLoopStats *stats)
+{
+    stats->spin_us   = __atomic_load_n (&loop->stats.spin_us, __ATOMIC_RELAXED);
+    stats->sleep_us  = __atomic_load_n (&loop->stats.sleep_us, __ATOMIC_RELAXED);
+    stats->spin_hits = __atomic_load_n (&loop->stats.spin_hits, __ATOMIC_RELAXED);
+    stats->wakeups   = __atomic_load_n (&loop->stats.wakeups, __ATOMIC_RELAXED);
+}
+
+void event_loop_stop(EventLoop *loop)
+{
+    loop->stop = 1;
+    wake (loop);
+}
+
+int event_loop_is_current(EventLoop *loop)
+{
+    int isCurrent;
+
+    pthread_mutex_lock (&loop->lock);
+    isCurrent = loop->is_running && pthread_equal (loop->thread, pthread_self ());
+    pthread_mutex_unlock (&loop->lock);
+
+    return isCurrent;
+}
+
+void event_loop_add_flush(EventLoop *loop, EventFlush *flush)
+{
+    flush->next = loop->flushes;
+    loop->flushes = flush;
+}
+
+void event_loop_remove_flush(EventLoop *loop, EventFlush *flush)
+{
+    EventFlush **link = &loop->flushes;
+
+    while ((*link != NULL) && (*link != flush))
+    {
+        link = &(*link)->next;
+    }
+
+    if (*link == NULL)
+    {
+        return;
+    }
+
+    *link = flush->next;
+
+    if (loop->flush_next == flush)
+    {
+        loop->flush_next = flush->next;
+    }
+}
+
+int event_loop_add(EventLoop *loop, int fd, uint32_t events, EventSource *source)
+{
+    struct epoll_event event = {0};
+
+    event.events   = events;
+    event.data.ptr = source;
+
+    return epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int event_loop_modify(EventLoop *loop, int fd, uint32_t events, EventSource *source)
+{
+    struct epoll_event event = {0};
+
+    event.events   = events;
+    event.data.ptr = source;
+
+    return epoll_ctl (loop->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void event_loop_remove(EventLoop *loop, int fd)
+{
+    epoll_ctl (loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void enqueue(EventLoop *loop, EventTask *task)
+{
+    task->next = NULL;
+
+    if (loop->tasks_tail != NULL)
+    {
+        loop->tasks_tail->next = task;
+    }
+    else
+    {
+        loop->tasks_head = task;
+    }
+
+    loop->tasks_tail = task;
+}
+
+int event_loop_post(EventLoop *loop, event_task_cb cb, void *ctx)
+{
+    EventTask *task = (EventTask *) malloc (sizeof(EventTask));
+
+    if (task == NULL)
+    {
+        return -1;
+    }
+
+    task->cb = cb;
+    task->ctx = ctx;
+    task->state = TASK_ALLOCATED;
+
+    pthread_mutex_lock (&loop->lock);
+    enqueue (loop, task);
+    pthread_mutex_unlock (&loop->lock);
+
+    wake (loop);
+
+    return 0;
+}
+
+void event_loop_post_task(EventLoop *loop, EventTask *task)
+{
+    task->state = TASK_EMBEDDED;
+
+    pthread_mutex_lock (&loop->lock);
+    enqueue (loop, task);
+    pthread_mutex_unlock (&loop->lock);
+
+    wake (loop);
+}
+
+void event_loop_call(EventLoop *loop, event_task_cb cb, void *ctx)
+{
+    EventTask task = { cb, ctx, TASK_CALL, NULL };
+
+    pthread_mutex_lock (&loop->lock);
+
+    if (!loop->is_running || pthread_equal (loop->thread, pthread_self ()))
+    {
+        pthread_mutex_unlock (&loop->lock);
+        cb (ctx);
+        return;
+    }
+
+    enqueue (loop, &task);
+    wake (loop);
+
+    while (task.state != TASK_DONE)
+    {
+        pthread_cond_wait (&loop->task_done, &loop->lock);
+    }
+
+    pthread_mutex_unlock (&loop->lock);
+}
+
+TimerWheel *event_loop_timers(EventLoop *loop)
+{
+    return &loop->timers;
+}
@@ -0,0 +1,226 @@
+#ifndef NETWORKING_EVENT_LOOP_H_
+#define NETWORKING_EVENT_LOOP_H_
+
+#include "timer_wheel.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct EventLoop EventLoop;
+
+    /**
+     * Callback prototype for file descriptor readiness.
+     *
+     * @param[in] ctx    Context registered with the event source
+     * @param[in] events Ready events (EPOLLIN, EPOLLHUP, ...)
+     */
+    typedef void (*event_cb)(void *ctx, uint32_t events);
+
+    /**
+     * Callback prototype for work executed on the loop thread.
+     *
+     * @param[in] ctx Context provided when posting
+     */
+    typedef void (*event_task_cb)(void *ctx);
+
+    /** Event source. Embedded by the owner of the file descriptor. */
+    typedef struct
+    {
+        event_cb cb; ///< Handler to callback on readiness
+        void *ctx;   ///< Callback context
+    } EventSource;
+
+    /**
+     * Work run once per loop wakeup, after the ready events were
+     * dispatched. Embedded by the owner.
+     */
+    typedef struct EventFlush
+    {
+        event_task_cb cb;        ///< Work to execute
+        void *ctx;               ///< Work context
+        struct EventFlush *next; ///< Next registration, loop use
+    } EventFlush;
+
+    /**
+     * Work queued with event_loop_post_task. Embedded by the owner, which
+     * may release it from its own callback.
+     */
+    typedef struct EventTask
+    {
+        event_task_cb cb;        ///< Work to execute
+        void *ctx;               ///< Work context
+        int state;               ///< Loop use
+        struct EventTask *next;  ///< Next queued task, loop use
+    } EventTask;
+
+    /** Time spent waiting for events. Updated by the loop thread. */
+    typedef struct
+    {
+        uint64_t spin_us;   ///< Time spent polling without blocking
+        uint64_t sleep_us;  ///< Time spent blocked waiting for events
+        uint64_t spin_hits; ///< Polls that found events while spinning
+        uint64_t wakeups;   ///< Blocking waits that returned events
+    } EventLoopStats;
+
+    /**
+     * Get monotonic time in milliseconds.
+     */
+    uint64_t event_loop_now_ms(void);
+
+    /**
+     * Get monotonic time in microseconds.
+     */
+    uint64_t event_loop_now_us(void);
+
+    /**
+     * Create a new event loop. The loop does not own a thread; it runs on
+     * whichever thread calls event_loop_run.
+     *
+     * @param[in] tickMs Timer wheel resolution in milliseconds
+     */
+    EventLoop *event_loop_create(uint32_t tickMs);
+
+    /**
+     * Release loop resources. The loop must not be running.
+     *
+     * @param[in] loop Reference to loop
+     */
+    void event_loop_destroy(EventLoop *loop);
+
+    /**
+     * Dispatch events and timers until event_loop_stop is called.
+     *
+     * @param[in] loop Reference to loop
+     */
+    void event_loop_run(EventLoop *loop);
+
+    /**
+     * Keep polling without blocking for a while after each event, trading
+     * CPU for wakeup latency. The loop blocks again once no event arrived
+     * for the budget. Takes effect on the next wait.
+     *
+     * @param[in] loop     Reference to loop
+     * @param[in] budgetUs Spin budget in microseconds, 0 disables spinning
+     */
+    void event_loop_set_busy_poll(EventLoop *loop, uint32_t budgetUs);
+
+    /**
+     * Get waiting statistics. Safe to call from any thread.
+     *
+     * @param[in]  loop  Reference to loop
+     * @param[out] stats Statistics since creation
+     */
+    void event_loop_get_stats(EventLoop *loop, EventLoopStats *stats);
+
+    /**
+     * Request the loop to exit. Safe to call from any thread.
+     *
+     * @param[in] loop Reference to loop
+     */
+    void event_loop_stop(EventLoop *loop);
+
+    /**
+     * Check if the caller runs on the loop thread.
+     *
+     * @param[in] loop Reference to loop
+     */
+    int event_loop_is_current(EventLoop *loop);
+
+    /**
+     * Register file descriptor. Level triggered.
+     *
+     * @param[in] loop   Reference to loop
+     * @param[in] fd     File descriptor
+     * @param[in] events Events of interest (EPOLLIN, ...)
+     * @param[in] source Event source, must outlive the registration
+     *
+     * @return 0 on success, -1 on error
+     */
+    int event_loop_add(EventLoop *loop, int fd, uint32_t events, EventSource *source);
+
+    /**
+     * Change events of interest for a registered file descriptor.
+     *
+     * @param[in] loop   Reference to loop
+     * @param[in] fd     File descriptor
+     * @param[in] events Events of interest, 0 to pause
+     * @param[in] source Event source
+     */
+    int event_loop_modify(EventLoop *loop, int fd, uint32_t events, EventSource *source);
+
+    /**
+     * Unregister file descriptor.
+     *
+     * @param[in] loop Reference to loop
+     * @param[in] fd   File descriptor
+     */
+    void event_loop_remove(EventLoop *loop, int fd);
+
+    /**
+     * Register work to run after each dispatch round, e.g. to hand over
+     * what the event handlers gathered. Only to be used from the loop
+     * thread.
+     *
+     * @param[in] loop  Reference to loop
+     * @param[in] flush Registration, must outlive it
+     */
+    void event_loop_add_flush(EventLoop *loop, EventFlush *flush);
+
+    /**
+     * Unregister flush work, also from within a flush. Only to be used
+     * from the loop thread.
+     *
+     * @param[in] loop  Reference to loop
+     * @param[in] flush Registration, ignored if not registered
+     */
+    void event_loop_remove_flush(EventLoop *loop, EventFlush *flush);
+
+    /**
+     * Queue work to be executed on the loop thread. Safe to call from any
+     * thread.
+     *
+     * @param[in] loop Reference to loop
+     * @param[in] cb   Work to execute
+     * @param[in] ctx  Work context
+     *
+     * @return 0 on success, -1 on error
+     */
+    int event_loop_post(EventLoop *loop, event_task_cb cb, void *ctx);
+
+    /**
+     * Queue work to be executed on the loop thread without allocating.
+     * Safe to call from any thread.
+     *
+     * @param[in] loop Reference to loop
+     * @param[in] task Work with cb and ctx set, not queued again before it ran
+     */
+    void event_loop_post_task(EventLoop *loop, EventTask *task);
+
+    /**
+     * Execute work on the loop thread and wait for completion. Executes
+     * inline when called from the loop thread or when the loop is not
+     * running.
+     *
+     * @param[in] loop Reference to loop
+     * @param[in] cb   Work to execute
+     * @param[in] ctx  Work context
+     */
+    void event_loop_call(EventLoop *loop, event_task_cb cb, void *ctx);
+
+    /**
+     * Get timer wheel driven by the loop. Only to be used from the loop
+     * thread.
+     *
+     * @param[in] loop Reference to loop
+     */
+    TimerWheel *event_loop_timers(EventLoop *loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_EVENT_LOOP_H_*/
@@ -0,0 +1,161 @@
+#include "frame.h"
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+void frame_encode_header(uint8_t *header, uint8_t type, uint32_t length)
+{
+    uint32_t networkLength = htonl (length);
+
+    memcpy (header, &networkLength, sizeof(networkLength));
+    header[4] = type;
+}
+
+int frame_send(int fd, uint8_t type, const void *payload, size_t length, int flags)
+{
+    uint8_t header[FRAME_HEADER_LEN];
+
+    if (length > MAX_MESSAGE_LEN)
+    {
+        return -1;
+    }
+
+    frame_encode_header (header, type, length);
+
+    return frame_send_encoded (fd, header, payload, length, flags);
+}
+
+int frame_send_encoded(int fd, const uint8_t *header, const void *payload, size_t length, int flags)
+{
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    size_t total = FRAME_HEADER_LEN + length;
+    size_t sent = 0;
+
+    iov[0].iov_base = (void *) header;
+    iov[0].iov_len  = FRAME_HEADER_LEN;
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len  = length;
+
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = (length > 0) ? 2 : 1;
+
+    while (sent < total)
+    {
+        ssize_t len = sendmsg (fd, &msg, flags | MSG_NOSIGNAL);
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if ((sent > 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            {
+                // Part of the frame is on the stream, it cannot be retried
+                errno = ENOBUFS;
+            }
+
+            return -1;
+        }
+
+        sent += len;
+
+        // Skip what was written
+        while ((msg.msg_iovlen > 0) && ((size_t) len >= msg.msg_iov[0].iov_len))
+        {
+            len -= msg.msg_iov[0].iov_len;
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov[0].iov_base = (uint8_t *) msg.msg_iov[0].iov_base + len;
+            msg.msg_iov[0].iov_len -= len;
+        }
+    }
+
+    return 0;
+}
+
+void frame_reader_reset(FrameReader *reader)
+{
+    reader->start  = 0;
+    reader->length = 0;
+}
+
+ssize_t frame_reader_recv(FrameReader *reader, int fd, int flags)
+{
+    if (reader->start > 0)
+    {
+        // Compact consumed bytes
+        memmove (reader->buffer, &reader->buffer[reader->start], reader->length - reader->start);
+        reader->length -= reader->start;
+        reader->start = 0;
+    }
+
+    ssize_t len = recv (
+        fd,
+        &reader->buffer[reader->length],
+        sizeof(reader->buffer) - reader->length,
+        flags);
+
+    if (len > 0)
+    {
+        reader->length += len;
+    }
+
+    return len;
+}
+
+int frame_reader_peek(FrameReader *reader, uint8_t *type, uint8_t **payload, uint32_t *length)
+{
+    size_t available = reader->length - reader->start;
+    uint32_t networkLength;
+
+    if (available < FRAME_HEADER_LEN)
+    {
+        return 0;
+    }
+
+    memcpy (&networkLength, &reader->buffer[reader->start], sizeof(networkLength));
+    *length = ntohl (networkLength);
+
+    if (*length > MAX_MESSAGE_LEN)
+    {
+        return -1;
+    }
+
+    if (available < FRAME_HEADER_LEN + *length)
+    {
+        return 0;
+    }
+
+    *type    = reader->buffer[reader->start + 4];
+    *payload = &reader->buffer[reader->start + FRAME_HEADER_LEN];
+
+    return 1;
+}
+
+void frame_reader_consume(FrameReader *reader, uint32_t length)
+{
+    reader->start += FRAME_HEADER_LEN + length;
+}
+
+int frame_reader_next(FrameReader *reader, uint8_t *type, uint8_t **payload, uint32_t *length)
+{
+    int status = frame_reader_peek (reader, type, payload, length);
+
+    if (status == 1)
+    {
+        frame_reader_consume (reader, *length);
+    }
+
+    return status;
+}
@@ -0,0 +1,181 @@
+#ifndef NETWORKING_FRAME_H_
+#define NETWORKING_FRAME_H_
+
+#include "client_server_cfg.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Frame header: 4 bytes payload length (network order) + 1 byte type */
+#define FRAME_HEADER_LEN 5
+
+    /** Frame types carried over the game connection */
+    typedef enum
+    {
+        FRAME_DATA, ///< Application message
+        FRAME_PING,    ///< Heartbeat request, payload echoed back
+        FRAME_PONG,    ///< Heartbeat response
+        FRAME_HELLO,   ///< Client opens a new session, no payload
+        FRAME_RESUME,  ///< Client resumes a session, SessionFrame payload
+        FRAME_SESSION, ///< Server session reply, SessionFrame payload
+        FRAME_JOIN,    ///< Client asks for the broadcast group, no payload; server reply, BroadcastJoin payload
+        FRAME_LEAVE,   ///< Client cannot receive the group, payload is the next sequence it expects (8 bytes)
+        FRAME_NACK,    ///< Client missed broadcasts, BroadcastRange payload
+        FRAME_REPAIR,  ///< Missed broadcast, BroadcastHeader followed by the message
+        FRAME_SNAPSHOT,    ///< State range, SnapshotHeader followed by the delta, see snapshot.h
+        FRAME_SNAPSHOT_ACK ///< Client rebuilt a snapshot, payload is its sequence (4 bytes), 0 asks for a full one
+    } FrameType;
+
+    /** Broadcast datagram and repair types */
+    typedef enum
+    {
+        BROADCAST_DATA = 1, ///< Message follows the header
+        BROADCAST_SYNC,     ///< Datagram only: sequence of the last message sent, lets a lost tail be detected
+        BROADCAST_LOST      ///< Repair only: messages up to the sequence are no longer available
+    } BroadcastType;
+
+    /** Header of broadcast datagrams and repairs, network byte order */
+    typedef struct __attribute__((packed))
+    {
+        uint64_t sequence; ///< Broadcast sequence, starting at 1
+        uint8_t type;      ///< BroadcastType
+    } BroadcastHeader;
+
+    /** Broadcast group offered to a client, network byte order */
+    typedef struct __attribute__((packed))
+    {
+        uint32_t group;     ///< Multicast address
+        uint16_t port;      ///< Group port
+        uint64_t sequence;  ///< First sequence the client receives from the group
+    } BroadcastJoin;
+
+    /** Range of missed broadcasts, network byte order */
+    typedef struct __attribute__((packed))
+    {
+        uint64_t first; ///< First missed sequence
+        uint64_t last;  ///< Last missed sequence
+    } BroadcastRange;
+
+    /** Snapshot frame header, network byte order */
+    typedef struct __attribute__((packed))
+    {
+        uint32_t sequence; ///< Snapshot sequence, starting at 1
+        uint32_t baseline; ///< Sequence the delta applies to, 0 for none
+        uint32_t size;     ///< State size
+        uint32_t offset;   ///< First state byte covered by the frame
+    } SnapshotHeader;
+
+    /** Session handshake payload, network byte order */
+    typedef struct __attribute__((packed))
+    {
+        uint32_t client_id;  ///< Server slot of the session
+        uint64_t token;      ///< Secret issued by the server
+        uint64_t received;   ///< FRAME_RESUME: data frames received in the session
+        uint8_t is_resumed;  ///< FRAME_SESSION: previous session resumed, 0 if a new one started
+    } SessionFrame;
+
+    /** Incoming stream reassembly buffer */
+    typedef struct
+    {
+        size_t start;  ///< Offset of first unconsumed byte
+        size_t length; ///< Offset past last received byte
+        uint8_t buffer[FRAME_HEADER_LEN + MAX_MESSAGE_LEN]; ///< Received bytes
+    } FrameReader;
+
+    /**
+     * Encode frame header.
+     *
+     * @param[out] header Destination, FRAME_HEADER_LEN bytes
+     * @param[in]  type   Frame type
+     * @param[in]  length Payload length
+     */
+    void frame_encode_header(uint8_t *header, uint8_t type, uint32_t length);
+
+    /**
+     * Send a complete frame.
+     * With MSG_DONTWAIT in flags the call never blocks: errno is EAGAIN if
+     * the socket buffer was full and nothing was sent, ENOBUFS if it filled
+     * part way through the frame. The stream is then broken and the
+     * connection must be closed.
+     *
+     * @param[in] fd      Connected socket
+     * @param[in] type    Frame type
+     * @param[in] payload Payload
+     * @param[in] length  Payload length, at most MAX_MESSAGE_LEN
+     * @param[in] flags   Extra send flags
+     *
+     * @return 0 on success, -1 on error
+     */
+    int frame_send(int fd, uint8_t type, const void *payload, size_t length, int flags);
+
+    /**
+     * Send a complete frame with a header encoded by frame_encode_header.
+     * Lets a header be shared across recipients of the same payload.
+     * MSG_DONTWAIT behaves as for frame_send.
+     *
+     * @param[in] fd      Connected socket
+     * @param[in] header  Encoded header, FRAME_HEADER_LEN bytes
+     * @param[in] payload Payload
+     * @param[in] length  Payload length, must match the header
+     * @param[in] flags   Extra send flags
+     *
+     * @return 0 on success, -1 on error
+     */
+    int frame_send_encoded(int fd, const uint8_t *header, const void *payload, size_t length, int flags);
+
+    /**
+     * Reset reader state.
+     *
+     * @param[in] reader Reference to reader
+     */
+    void frame_reader_reset(FrameReader *reader);
+
+    /**
+     * Receive available bytes from socket into the reader.
+     *
+     * @param[in] reader Reference to reader
+     * @param[in] fd     Connected socket
+     * @param[in] flags  recv flags
+     *
+     * @return recv result: >0 bytes read, 0 on orderly shutdown, -1 on error
+     */
+    ssize_t frame_reader_recv(FrameReader *reader, int fd, int flags);
+
+    /**
+     * Extract next complete frame. The payload stays valid until the next
+     * frame_reader_recv call.
+     *
+     * @param[in]  reader  Reference to reader
+     * @param[out] type    Frame type
+     * @param[out] payload Frame payload
+     * @param[out] length  Payload length
+     *
+     * @return 1 if a frame was extracted, 0 if more data is needed,
+     *     -1 on malformed stream
+     */
+    int frame_reader_next(FrameReader *reader, uint8_t *type, uint8_t **payload, uint32_t *length);
+
+    /**
+     * Same as frame_reader_next without consuming the frame.
+     */
+    int frame_reader_peek(FrameReader *reader, uint8_t *type, uint8_t **payload, uint32_t *length);
+
+    /**
+     * Consume the frame returned by the last frame_reader_peek.
+     *
+     * @param[in] reader Reference to reader
+     * @param[in] length Payload length of the peeked frame
+     */
+    void frame_reader_consume(FrameReader *reader, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_FRAME_H_*/
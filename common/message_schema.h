@@ -0,0 +1,223 @@
+#ifndef NETWORKING_MESSAGE_SCHEMA_H_
+#define NETWORKING_MESSAGE_SCHEMA_H_
+
+/*
+ * Compile time message schema.
+ *
+ * Messages are declared once as an X-macro field list:
+ *
+ *     #define PLAYER_MOVE_FIELDS(FIELD, M) \
+ *         FIELD(M, uint32_t, player)       \
+ *         FIELD(M, int16_t,  x)            \
+ *         FIELD(M, int16_t,  y)
+ *
+ *     NET_MESSAGE(PlayerMove, 1, PLAYER_MOVE_FIELDS)
+ *
+ * which generates:
+ *   - PlayerMove          plain struct used for encoding
+ *   - PlayerMove_TYPE     message type id
+ *   - PlayerMove_SIZE     encoded size
+ *   - PlayerMove_encode   packs a PlayerMove into a buffer
+ *   - PlayerMove_view     zero-copy view over a received buffer
+ *   - PlayerMove_player() field accessors reading straight from the buffer
+ *
+ * Wire format: 2 bytes type followed by the fields, packed, little endian.
+ * Received buffers may be longer than the message to allow appending fields.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Size of the type id prefixing every message */
+#define NET_MESSAGE_TYPE_LEN 2
+
+    static inline void net_store(uint8_t *dst, const void *src, size_t size)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (size_t i = 0; i < size; ++i)
+        {
+            dst[i] = ((const uint8_t *) src)[size - 1 - i];
+        }
+#else
+        memcpy (dst, src, size);
+#endif
+    }
+
+    static inline void net_load(void *dst, const uint8_t *src, size_t size)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (size_t i = 0; i < size; ++i)
+        {
+            ((uint8_t *) dst)[i] = src[size - 1 - i];
+        }
+#else
+        memcpy (dst, src, size);
+#endif
+    }
+
+    /**
+     * Get message type id.
+     *
+     * @param[in] buffer Received message
+     * @param[in] size   Size of received message
+     *
+     * @return Type id, -1 if the buffer is too short
+     */
+    static inline int net_message_type(const void *buffer, size_t size)
+    {
+        uint16_t type;
+
+        if (size < NET_MESSAGE_TYPE_LEN)
+        {
+            return -1;
+        }
+
+        net_load (&type, (const uint8_t *) buffer, sizeof(type));
+
+        return type;
+    }
+
+    /**
+     * Handler prototype used by dispatch tables.
+     *
+     * @param[in] ctx    Context passed to net_dispatch
+     * @param[in] buffer Message, at least the registered size
+     * @param[in] size   Size of message
+     */
+    typedef void (*net_message_handler)(void *ctx, const uint8_t *buffer, size_t size);
+
+    /** Dispatch table entry, indexed by message type */
+    typedef struct
+    {
+        net_message_handler handler; ///< Handler, NULL for unknown types
+        size_t min_size;             ///< Encoded size of the message
+    } NetDispatchEntry;
+
+    /**
+     * Dispatch a received message to the handler registered for its type.
+     *
+     * @param[in] table     Dispatch table, indexed by message type
+     * @param[in] tableSize Number of entries in table
+     * @param[in] ctx       Handler context
+     * @param[in] buffer    Received message
+     * @param[in] size      Size of received message
+     *
+     * @return 0 if handled, -1 for unknown type or truncated message
+     */
+    static inline int net_dispatch(
+        const NetDispatchEntry *table,
+        size_t tableSize,
+        void *ctx,
+        const void *buffer,
+        size_t size)
+    {
+        int type = net_message_type (buffer, size);
+
+        if ((type < 0) || ((size_t) type >= tableSize) ||
+            (table[type].handler == NULL) || (size < table[type].min_size))
+        {
+            return -1;
+        }
+
+        table[type].handler (ctx, (const uint8_t *) buffer, size);
+
+        return 0;
+    }
+
+/* Field expansions */
+#define NET_FIELD_MEMBER(M, type, name)  type name;
+#define NET_FIELD_SIZE(M, type, name)    + sizeof(type)
+#define NET_FIELD_ENCODE(M, type, name) \
+    net_store (&out[offsetof(M##_wire, name)], &msg->name, sizeof(type));
+#define NET_FIELD_GETTER(M, type, name)                                  \
+    static inline type M##_##name(M##_view view)                         \
+    {                                                                    \
+        type value;                                                      \
+        net_load (&value, &view.data[offsetof(M##_wire, name)], sizeof(type)); \
+        return value;                                                    \
+    }
+
+/**
+ * Declare a message.
+ *
+ * @param M      Message name
+ * @param TYPE   Message type id, small values keep dispatch tables compact
+ * @param FIELDS X-macro field list taking (FIELD, M)
+ */
+#define NET_MESSAGE(M, TYPE, FIELDS)                                           \
+    enum { M##_TYPE = (TYPE) };                                                \
+                                                                               \
+    typedef struct                                                             \
+    {                                                                          \
+        FIELDS(NET_FIELD_MEMBER, M)                                            \
+    } M;                                                                       \
+                                                                               \
+    typedef struct __attribute__((packed))                                     \
+    {                                                                          \
+        uint16_t net_type;                                                     \
+        FIELDS(NET_FIELD_MEMBER, M)                                              \
+    } M##_wire;                                                                \
+                                                                               \
+    enum { M##_SIZE = NET_MESSAGE_TYPE_LEN FIELDS(NET_FIELD_SIZE, M) };        \
+                                                                               \
+    typedef struct                                                             \
+    {                                                                          \
+        const uint8_t *data;                                                   \
+    } M##_view;                                                                \
+                                                                               \
+    static inline size_t M##_encode(void *buffer, size_t size, const M *msg)   \
+    {                                                                          \
+        uint8_t *out = (uint8_t *) buffer;                                     \
+        uint16_t type = M##_TYPE;                                              \
+        if (size < M##_SIZE)                                                   \
+        {                                                                      \
+            return 0;                                                          \
+        }                                                                      \
+        net_store (out, &type, sizeof(type));                                  \
+        FIELDS(NET_FIELD_ENCODE, M)                                            \
+        return M##_SIZE;                                                       \
+    }                                                                          \
+                                                                               \
+    static inline int M##_view_init(M##_view *view, const void *buffer, size_t size) \
+    {                                                                          \
+        if ((size < M##_SIZE) || (net_message_type (buffer, size) != M##_TYPE)) \
+        {                                                                      \
+            return -1;                                                         \
+        }                                                                      \
+        view->data = (const uint8_t *) buffer;                                 \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    FIELDS(NET_FIELD_GETTER, M)
+
+/**
+ * Define a dispatch thunk for a typed handler `void fn(void *ctx, M_view view)`.
+ */
+#define NET_HANDLER(M, fn)                                                     \
+    static void fn##_dispatch(void *ctx, const uint8_t *buffer, size_t size)   \
+    {                                                                          \
+        M##_view view = { buffer };                                            \
+        (void) size;                                                           \
+        fn (ctx, view);                                                        \
+    }
+
+/**
+ * Dispatch table entry for a handler declared with NET_HANDLER:
+ *
+ *     static const NetDispatchEntry handlers[] = {
+ *         NET_DISPATCH_ENTRY(PlayerMove, on_move),
+ *     };
+ */
+#define NET_DISPATCH_ENTRY(M, fn) [M##_TYPE] = { fn##_dispatch, M##_SIZE }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_MESSAGE_SCHEMA_H_*/
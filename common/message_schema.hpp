@@ -0,0 +1,230 @@
+#ifndef NETWORKING_MESSAGE_SCHEMA_HPP_
+#define NETWORKING_MESSAGE_SCHEMA_HPP_
+
+/*
+ * Compile time message schema, C++20 counterpart of message_schema.h.
+ * Same wire format: 2 bytes type followed by the fields, packed, little
+ * endian.
+ *
+ *     using PlayerMove = net::Message<1, uint32_t, int16_t, int16_t>;
+ *     enum PlayerMoveField { player, x, y };
+ *
+ *     std::array<std::byte, PlayerMove::size> buffer;
+ *     PlayerMove::encode (buffer, 7, -3, 12);
+ *
+ *     if (auto view = PlayerMove::View::from (received))
+ *     {
+ *         uint32_t id = view->get<player> ();
+ *     }
+ *
+ *     net::Dispatcher<PlayerMove, Chat>::dispatch (received, handler);
+ */
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+
+namespace net
+{
+    namespace detail
+    {
+        template <typename T>
+        inline void store(std::byte *dst, T value)
+        {
+            static_assert (std::is_trivially_copyable_v<T>, "Fields must be trivially copyable");
+
+            auto bytes = std::bit_cast<std::array<std::byte, sizeof(T)>> (value);
+
+            if constexpr (std::endian::native == std::endian::big)
+            {
+                for (std::size_t i = 0; i < sizeof(T); ++i)
+                {
+                    dst[i] = bytes[sizeof(T) - 1 - i];
+                }
+            }
+            else
+            {
+                std::memcpy (dst, bytes.data (), sizeof(T));
+            }
+        }
+
+        template <typename T>
+        inline T load(const std::byte *src)
+        {
+            std::array<std::byte, sizeof(T)> bytes;
+
+            if constexpr (std::endian::native == std::endian::big)
+            {
+                for (std::size_t i = 0; i < sizeof(T); ++i)
+                {
+                    bytes[i] = src[sizeof(T) - 1 - i];
+                }
+            }
+            else
+            {
+                std::memcpy (bytes.data (), src, sizeof(T));
+            }
+
+            return std::bit_cast<T> (bytes);
+        }
+
+        /** Offset of field I, after the type id */
+        template <std::size_t I, typename... Fields>
+        constexpr std::size_t offset()
+        {
+            constexpr std::size_t sizes[] = { sizeof(Fields)..., 0 };
+            std::size_t result = sizeof(uint16_t);
+
+            for (std::size_t i = 0; i < I; ++i)
+            {
+                result += sizes[i];
+            }
+
+            return result;
+        }
+    }
+
+    /** Size of the type id prefixing every message */
+    inline constexpr std::size_t message_type_len = sizeof(uint16_t);
+
+    /**
+     * Get message type id.
+     *
+     * @return Type id, empty if the buffer is too short
+     */
+    inline std::optional<uint16_t> message_type(std::span<const std::byte> buffer)
+    {
+        if (buffer.size () < message_type_len)
+        {
+            return std::nullopt;
+        }
+
+        return detail::load<uint16_t> (buffer.data ());
+    }
+
+    /**
+     * Message declaration.
+     *
+     * @tparam Type   Message type id
+     * @tparam Fields Field types, in wire order
+     */
+    template <uint16_t Type, typename... Fields>
+    struct Message
+    {
+        static constexpr uint16_t type = Type;
+        static constexpr std::size_t size = message_type_len + (sizeof(Fields) + ... + 0);
+
+        template <std::size_t I>
+        using field_type = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+        template <std::size_t I>
+        static constexpr std::size_t offset = detail::offset<I, Fields...> ();
+
+        /**
+         * Encode message into buffer.
+         *
+         * @return Encoded size, 0 if the buffer is too small
+         */
+        static std::size_t encode(std::span<std::byte> buffer, const Fields &... values)
+        {
+            if (buffer.size () < size)
+            {
+                return 0;
+            }
+
+            detail::store<uint16_t> (buffer.data (), Type);
+            encode_fields (buffer.data (), std::index_sequence_for<Fields...> {}, values...);
+
+            return size;
+        }
+
+        /** Zero-copy view over a received message */
+        class View
+        {
+            public:
+                /**
+                 * Validate buffer and create view. The buffer must outlive the view.
+                 */
+                static std::optional<View> from(std::span<const std::byte> buffer)
+                {
+                    if ((buffer.size () < size) || (message_type (buffer) != Type))
+                    {
+                        return std::nullopt;
+                    }
+
+                    return View (buffer.data ());
+                }
+
+                /** Read field I straight from the buffer */
+                template <std::size_t I>
+                field_type<I> get() const
+                {
+                    return detail::load<field_type<I>> (data_ + offset<I>);
+                }
+
+            private:
+                explicit View(const std::byte *data) : data_ (data) {}
+
+                const std::byte *data_;
+        };
+
+    private:
+        template <std::size_t... I>
+        static void encode_fields(std::byte *out, std::index_sequence<I...>, const Fields &... values)
+        {
+            (detail::store<Fields> (out + offset<I>, values), ...);
+        }
+    };
+
+    /**
+     * Compile time dispatch over a closed set of messages. The message
+     * list expands to a short-circuit chain of type comparisons, one per
+     * message in declaration order, so handlers are called directly and
+     * can be inlined. The compiler may turn the chain into a jump table.
+     *
+     * @tparam Messages Message declarations
+     */
+    template <typename... Messages>
+    struct Dispatcher
+    {
+        /**
+         * Dispatch buffer to the overload of handler taking Message::View.
+         *
+         * @return true if handled, false for unknown type or truncated message
+         */
+        template <typename Handler>
+        static bool dispatch(std::span<const std::byte> buffer, Handler &&handler)
+        {
+            auto type = message_type (buffer);
+
+            return type.has_value () && (try_dispatch<Messages> (*type, buffer, handler) || ...);
+        }
+
+    private:
+        template <typename M, typename Handler>
+        static bool try_dispatch(uint16_t type, std::span<const std::byte> buffer, Handler &handler)
+        {
+            if (type != M::type)
+            {
+                return false;
+            }
+
+            auto view = M::View::from (buffer);
+
+            if (view)
+            {
+                handler (*view);
+            }
+
+            return view.has_value ();
+        }
+    };
+}
+
+#endif /* NETWORKING_MESSAGE_SCHEMA_HPP_*/
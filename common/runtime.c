@@ -0,0 +1,422 @@
+#include "runtime.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_TIMER_TICK_MS 10
+#define MAX_DISCOVERY_REQUEST 256
+
+/** I/O thread */
+typedef struct
+{
+    EventLoop *loop;    ///< Loop run by the thread
+    pthread_t thread;   ///< Thread handler
+    uint32_t attached;  ///< Instances and sockets assigned to the loop
+    int cpu;            ///< CPU the thread is pinned to, -1 if not pinned
+} Worker;
+
+/** Discovery socket shared by the listeners of one address and port */
+typedef struct DiscoveryChannel
+{
+    Runtime *runtime;              ///< Owning runtime
+    EventLoop *loop;               ///< Loop receiving requests
+    int fd;                        ///< Shared socket
+    in_addr_t ip;                  ///< Multicast address
+    uint16_t port;                 ///< Discovery port
+    EventSource source;            ///< Socket registration
+    DiscoveryListener *listeners;  ///< Registered listeners
+    struct DiscoveryChannel *next; ///< Next open channel
+} DiscoveryChannel;
+
+struct Runtime
+{
+    pthread_mutex_t lock;        ///< Protects load counters, channels and listeners
+    uint16_t nb_workers;         ///< Number of I/O threads
+    Worker *workers;             ///< I/O threads
+    DiscoveryChannel *channels;  ///< Open discovery sockets
+};
+
+static int nth_cpu(uint64_t mask, uint16_t index)
+{
+    int count = __builtin_popcountll (mask);
+    int skip = index % count;
+
+    while (skip-- > 0)
+    {
+        mask &= mask - 1;
+    }
+
+    return __builtin_ctzll (mask);
+}
+
+static void *worker_thread(void *param)
+{
+    Worker *worker = (Worker *) param;
+
+    event_loop_run (worker->loop);
+
+    return NULL;
+}
+
+Runtime *runtime_create(const RuntimeConfig *config)
+{
+    long onlineCpus = sysconf (_SC_NPROCESSORS_ONLN);
+    uint16_t nbWorkers = (config->nb_threads != 0) ? config->nb_threads : ((onlineCpus > 0) ? onlineCpus : 1);
+    uint32_t tickMs = (config->timer_tick_ms != 0) ? config->timer_tick_ms : DEFAULT_TIMER_TICK_MS;
+    Runtime *runtime = (Runtime *) malloc (sizeof(Runtime));
+
+    if (runtime == NULL)
+    {
+        return NULL;
+    }
+
+    bzero (runtime, sizeof(Runtime));
+    pthread_mutex_init (&runtime->lock, NULL);
+
+    runtime->workers = (Worker *) calloc (nbWorkers, sizeof(Worker));
+
+    if (runtime->workers == NULL)
+    {
+        runtime_destroy (runtime);
+        return NULL;
+    }
+
+    for (uint16_t i = 0; i < nbWorkers; ++i)
+    {
+        Worker *worker = &runtime->workers[i];
+        ThreadConfig threadConfig = config->threads;
+
+        if (threadConfig.cpu_mask != 0)
+        {
+            // One worker per CPU avoids migrations between cores
+            threadConfig.cpu_mask = 1ULL << nth_cpu (config->threads.cpu_mask, i);
+        }
+
+        worker->cpu = thread_pinned_cpu (&threadConfig);
+        worker->loop = event_loop_create (tickMs);
+
+        if (worker->loop != NULL)
+        {
+            event_loop_set_busy_poll (worker->loop, config->busy_poll_us);
+        }
+
+        if ((worker->loop == NULL) || thread_create (&worker->thread, &threadConfig, worker_thread, worker))
+        {
+            if (worker->loop != NULL)
+            {
+                event_loop_destroy (worker->loop);
+            }
+
+            runtime_destroy (runtime);
+            return NULL;
+        }
+
+        runtime->nb_workers++;
+    }
+
+    return runtime;
+}
+
+void runtime_destroy(Runtime *runtime)
+{
+    for (uint16_t i = 0; i < runtime->nb_workers; ++i)
+    {
+        event_loop_stop (runtime->workers[i].loop);
+        pthread_join (runtime->workers[i].thread, NULL);
+    }
+
+    // Channel release tasks posted last run on destroy
+    for (uint16_t i = 0; i < runtime->nb_workers; ++i)
+    {
+        event_loop_destroy (runtime->workers[i].loop);
+    }
+
+    pthread_mutex_destroy (&runtime->lock);
+
+    free (runtime->workers);
+    free (runtime);
+}
+
+EventLoop *runtime_attach(Runtime *runtime)
+{
+    Worker *selected = &runtime->workers[0];
+
+    pthread_mutex_lock (&runtime->lock);
+
+    for (uint16_t i = 1; i < runtime->nb_workers; ++i)
+    {
+        if (runtime->workers[i].attached < selected->attached)
+        {
+            selected = &runtime->workers[i];
+        }
+    }
+
+    selected->attached++;
+
+    pthread_mutex_unlock (&runtime->lock);
+
+    return selected->loop;
+}
+
+void runtime_detach(Runtime *runtime, EventLoop *loop)
+{
+    pthread_mutex_lock (&runtime->lock);
+
+    for (uint16_t i = 0; i < runtime->nb_workers; ++i)
+    {
+        if (runtime->workers[i].loop == loop)
+        {
+            runtime->workers[i].attached--;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock (&runtime->lock);
+}
+
+int runtime_loop_cpu(Runtime *runtime, EventLoop *loop)
+{
+    for (uint16_t i = 0; i < runtime->nb_workers; ++i)
+    {
+        if (runtime->workers[i].loop == loop)
+        {
+            return runtime->workers[i].cpu;
+        }
+    }
+
+    return -1;
+}
+
+static void on_channel_event(void *ctx, uint32_t events)
+{
+    DiscoveryChannel *channel = (DiscoveryChannel *) ctx;
+    Runtime *runtime = channel->runtime;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char request[MAX_DISCOVERY_REQUEST];
+
+    ssize_t bytesRcvd = recvfrom (
+        channel->fd,
+        request,
+        sizeof(request),
+        MSG_DONTWAIT,
+        (struct sockaddr *) &addr,
+        &addrlen);
+
+    if (bytesRcvd < 0)
+    {
+        return;
+    }
+
+    // Listeners are only removed under the lock, never while answering
+    pthread_mutex_lock (&runtime->lock);
+
+    for (DiscoveryListener *listener = channel->listeners; listener != NULL; listener = listener->next)
+    {
+        listener->cb (listener->ctx, channel->fd, request, bytesRcvd, &addr);
+    }
+
+    pthread_mutex_unlock (&runtime->lock);
+}
+
+static void close_channel_task(void *param)
+{
+    DiscoveryChannel *channel = (DiscoveryChannel *) param;
+
+    event_loop_remove (channel->loop, channel->fd);
+    close (channel->fd);
+
+    runtime_detach (channel->runtime, channel->loop);
+    free (channel);
+}
+
+static DiscoveryChannel *open_channel(Runtime *runtime, in_addr_t ip, uint16_t port)
+{
+    DiscoveryChannel *channel = (DiscoveryChannel *) malloc (sizeof(DiscoveryChannel));
+    struct sockaddr_in addr = {0};
+    struct ip_mreq mreq;
+    int reuse = 1;
+    int all = 0;
+
+    if (channel == NULL)
+    {
+        return NULL;
+    }
+
+    bzero (channel, sizeof(DiscoveryChannel));
+    channel->runtime    = runtime;
+    channel->ip         = ip;
+    channel->port       = port;
+    channel->source.cb  = on_channel_event;
+    channel->source.ctx = channel;
+    channel->fd         = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+    if (channel->fd == -1)
+    {
+        free (channel);
+        return NULL;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_ANY);
+    addr.sin_port = htons (port);
+
+    mreq.imr_multiaddr.s_addr = ip;
+    mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+
+    // Other processes may listen on the same port; only receive our group
+    setsockopt (channel->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    setsockopt (channel->fd, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+
+    if ((bind (channel->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+        (setsockopt (channel->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0))
+    {
+        close (channel->fd);
+        free (channel);
+        return NULL;
+    }
+
+    return channel;
+}
+
+static DiscoveryChannel *find_channel(Runtime *runtime, in_addr_t ip, uint16_t port)
+{
+    DiscoveryChannel *channel = runtime->channels;
+
+    while ((channel != NULL) && ((channel->ip != ip) || (channel->port != port)))
+    {
+        channel = channel->next;
+    }
+
+    return channel;
+}
+
+static void release_channel(DiscoveryChannel *channel)
+{
+    // Closed on its own thread; waiting for it could deadlock two loops
+    if (event_loop_post (channel->loop, close_channel_task, channel) != 0)
+    {
+        event_loop_call (channel->loop, close_channel_task, channel);
+    }
+}
+
+static void add_listener(DiscoveryChannel *channel, DiscoveryListener *listener)
+{
+    listener->channel = channel;
+    listener->next = channel->listeners;
+    channel->listeners = listener;
+}
+
+int runtime_discovery_add(Runtime *runtime, const char *ip, uint16_t port, DiscoveryListener *listener)
+{
+    in_addr_t groupIp = inet_addr (ip);
+    DiscoveryChannel *channel;
+    DiscoveryChannel *opened;
+
+    pthread_mutex_lock (&runtime->lock);
+
+    channel = find_channel (runtime, groupIp, port);
+
+    if (channel != NULL)
+    {
+        add_listener (channel, listener);
+    }
+
+    pthread_mutex_unlock (&runtime->lock);
+
+    if (channel != NULL)
+    {
+        return 0;
+    }
+
+    // Socket setup happens unlocked, requests keep being answered meanwhile
+    opened = open_channel (runtime, groupIp, port);
+
+    if (opened == NULL)
+    {
+        return -1;
+    }
+
+    opened->loop = runtime_attach (runtime);
+
+    if (event_loop_add (opened->loop, opened->fd, EPOLLIN, &opened->source) != 0)
+    {
+        runtime_detach (runtime, opened->loop);
+        close (opened->fd);
+        free (opened);
+        return -1;
+    }
+
+    pthread_mutex_lock (&runtime->lock);
+
+    // Another instance may have opened the same channel meanwhile
+    channel = find_channel (runtime, groupIp, port);
+
+    if (channel == NULL)
+    {
+        channel = opened;
+        channel->next = runtime->channels;
+        runtime->channels = channel;
+        opened = NULL;
+    }
+
+    add_listener (channel, listener);
+
+    pthread_mutex_unlock (&runtime->lock);
+
+    if (opened != NULL)
+    {
+        release_channel (opened);
+    }
+
+    return 0;
+}
+
+void runtime_discovery_remove(Runtime *runtime, DiscoveryListener *listener)
+{
+    DiscoveryChannel *closed = NULL;
+
+    pthread_mutex_lock (&runtime->lock);
+
+    DiscoveryChannel *channel = listener->channel;
+
+    if (channel != NULL)
+    {
+        DiscoveryListener **link = &channel->listeners;
+
+        while (*link != listener)
+        {
+            link = &(*link)->next;
+        }
+
+        *link = listener->next;
+        listener->channel = NULL;
+        listener->next = NULL;
+
+        if (channel->listeners == NULL)
+        {
+            DiscoveryChannel **channelLink = &runtime->channels;
+
+            while (*channelLink != channel)
+            {
+                channelLink = &(*channelLink)->next;
+            }
+
+            *channelLink = channel->next;
+            closed = channel;
+        }
+    }
+
+    pthread_mutex_unlock (&runtime->lock);
+
+    if (closed != NULL)
+    {
+        release_channel (closed);
+    }
+}
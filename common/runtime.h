@@ -0,0 +1,124 @@
+#ifndef NETWORKING_RUNTIME_H_
+#define NETWORKING_RUNTIME_H_
+
+#include "event_loop.h"
+#include "thread_config.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Pool of I/O threads shared by server and client instances. Each
+     * thread runs one event loop; instances are assigned to the least
+     * loaded loop when initialized.
+     */
+    typedef struct Runtime Runtime;
+
+    /** Runtime configuration */
+    typedef struct
+    {
+        uint16_t nb_threads;    ///< I/O threads (0 selects one per online CPU)
+        uint32_t timer_tick_ms; ///< Timer resolution (0 selects default)
+        ThreadConfig threads;   ///< I/O thread attributes; each thread is pinned to one CPU of the mask, in turn
+        uint32_t busy_poll_us;  ///< Spin budget after activity, see event_loop_set_busy_poll (0 disables)
+    } RuntimeConfig;
+
+    /**
+     * Callback prototype for discovery requests received on a shared
+     * socket. Called on the I/O thread owning the socket.
+     *
+     * @param[in] ctx     Context registered with the listener
+     * @param[in] fd      Shared socket, to send the reply from
+     * @param[in] request Received datagram
+     * @param[in] size    Received datagram size
+     * @param[in] from    Requester address
+     */
+    typedef void (*runtime_discovery_cb)(
+        void *ctx,
+        int fd,
+        const void *request,
+        ssize_t size,
+        const struct sockaddr_in *from);
+
+    /** Discovery listener. Embedded by the server instance. */
+    typedef struct DiscoveryListener
+    {
+        runtime_discovery_cb cb;          ///< Handler to callback on request
+        void *ctx;                        ///< Callback context
+        struct DiscoveryChannel *channel; ///< Shared socket, NULL when not registered
+        struct DiscoveryListener *next;   ///< Next listener on the same socket
+    } DiscoveryListener;
+
+    /**
+     * Start I/O threads.
+     *
+     * @param[in] config Reference to runtime configuration
+     */
+    Runtime *runtime_create(const RuntimeConfig *config);
+
+    /**
+     * Stop I/O threads. All instances using the runtime must be
+     * deinitialized first.
+     *
+     * @param[in] runtime Reference to runtime
+     */
+    void runtime_destroy(Runtime *runtime);
+
+    /**
+     * Assign the least loaded loop to a new instance.
+     *
+     * @param[in] runtime Reference to runtime
+     */
+    EventLoop *runtime_attach(Runtime *runtime);
+
+    /**
+     * Release loop assigned by runtime_attach.
+     *
+     * @param[in] runtime Reference to runtime
+     * @param[in] loop    Loop returned by runtime_attach
+     */
+    void runtime_detach(Runtime *runtime, EventLoop *loop);
+
+    /**
+     * Get the CPU a loop's thread is pinned to.
+     *
+     * @param[in] runtime Reference to runtime
+     * @param[in] loop    Loop returned by runtime_attach
+     *
+     * @return CPU index, -1 if the thread is not pinned to a single CPU
+     */
+    int runtime_loop_cpu(Runtime *runtime, EventLoop *loop);
+
+    /**
+     * Listen for discovery requests on the socket shared by all listeners
+     * of the same multicast address and port, opening it if needed.
+     *
+     * @param[in] runtime  Reference to runtime
+     * @param[in] ip       Multicast address
+     * @param[in] port     Discovery port
+     * @param[in] listener Listener, must outlive the registration
+     *
+     * @return 0 on success, -1 on error
+     */
+    int runtime_discovery_add(Runtime *runtime, const char *ip, uint16_t port, DiscoveryListener *listener);
+
+    /**
+     * Stop listening. The callback is not called anymore once this
+     * returns. The socket is closed with its last listener.
+     *
+     * @param[in] runtime  Reference to runtime
+     * @param[in] listener Registered listener, ignored if not registered
+     */
+    void runtime_discovery_remove(Runtime *runtime, DiscoveryListener *listener);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_RUNTIME_H_*/
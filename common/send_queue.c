@@ -0,0 +1,211 @@
+#include "send_queue.h"
+#include "frame.h"
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/** Buffers handed to one sendmsg call */
+#define SEND_QUEUE_IOV 16
+
+static int is_full(void)
+{
+    return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+}
+
+/** Drop bytes sent from the front */
+static void consume(SendQueue *queue, size_t length)
+{
+    queue->length -= length;
+
+    while (length > 0)
+    {
+        MessageBuffer *head = queue->head;
+        size_t available = head->size - queue->offset;
+
+        if (length < available)
+        {
+            queue->offset += length;
+            return;
+        }
+
+        length -= available;
+        queue->head   = head->next;
+        queue->offset = 0;
+        buffer_release (head);
+    }
+
+    if (queue->head == NULL)
+    {
+        queue->tail = NULL;
+    }
+}
+
+static int push(SendQueue *queue, const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        MessageBuffer *tail = queue->tail;
+
+        if ((tail == NULL) || (tail->size == tail->capacity))
+        {
+            tail = buffer_pool_alloc (MAX_MESSAGE_LEN);
+
+            if (tail == NULL)
+            {
+                return -1;
+            }
+
+            tail->next = NULL;
+
+            if (queue->tail != NULL)
+            {
+                queue->tail->next = tail;
+            }
+            else
+            {
+                queue->head = tail;
+            }
+
+            queue->tail = tail;
+        }
+
+        size_t chunk = tail->capacity - tail->size;
+
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        memcpy (tail->data + tail->size, data, chunk);
+        tail->size    += chunk;
+        queue->length += chunk;
+        data          += chunk;
+        length        -= chunk;
+    }
+
+    return 0;
+}
+
+void send_queue_clear(SendQueue *queue)
+{
+    while (queue->head != NULL)
+    {
+        MessageBuffer *head = queue->head;
+
+        queue->head = head->next;
+        buffer_release (head);
+    }
+
+    queue->tail   = NULL;
+    queue->offset = 0;
+    queue->length = 0;
+}
+
+int send_queue_frame(
+    SendQueue *queue,
+    int fd,
+    const uint8_t *header,
+    const void *payload,
+    size_t length,
+    size_t limit)
+{
+    size_t total = FRAME_HEADER_LEN + length;
+    size_t sent = 0;
+
+    while ((queue->length == 0) && (sent < total))
+    {
+        struct iovec iov[2];
+        struct msghdr msg = {0};
+
+        // Whatever of header and payload is left
+        iov[0].iov_base = (uint8_t *) header + ((sent < FRAME_HEADER_LEN) ? sent : FRAME_HEADER_LEN);
+        iov[0].iov_len  = (sent < FRAME_HEADER_LEN) ? FRAME_HEADER_LEN - sent : 0;
+        iov[1].iov_base = (uint8_t *) payload + ((sent > FRAME_HEADER_LEN) ? sent - FRAME_HEADER_LEN : 0);
+        iov[1].iov_len  = (sent > FRAME_HEADER_LEN) ? total - sent : length;
+
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = 2;
+
+        ssize_t len = sendmsg (fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (is_full ())
+            {
+                break;
+            }
+
+            return -1;
+        }
+
+        sent += len;
+    }
+
+    if (sent == total)
+    {
+        return 0;
+    }
+
+    if (queue->length + (total - sent) > limit)
+    {
+        return -1;
+    }
+
+    if (sent < FRAME_HEADER_LEN)
+    {
+        if (push (queue, header + sent, FRAME_HEADER_LEN - sent) != 0)
+        {
+            return -1;
+        }
+
+        sent = FRAME_HEADER_LEN;
+    }
+
+    return push (queue, (const uint8_t *) payload + (sent - FRAME_HEADER_LEN), total - sent);
+}
+
+int send_queue_flush(SendQueue *queue, int fd)
+{
+    while (queue->length > 0)
+    {
+        struct iovec iov[SEND_QUEUE_IOV];
+        struct msghdr msg = {0};
+        MessageBuffer *buffer = queue->head;
+        uint32_t offset = queue->offset;
+        size_t count = 0;
+
+        for (; (buffer != NULL) && (count < SEND_QUEUE_IOV); buffer = buffer->next, ++count)
+        {
+            iov[count].iov_base = buffer->data + offset;
+            iov[count].iov_len  = buffer->size - offset;
+            offset = 0;
+        }
+
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = count;
+
+        ssize_t len = sendmsg (fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return is_full () ? 1 : -1;
+        }
+
+        consume (queue, len);
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef NETWORKING_SEND_QUEUE_H_
+#define NETWORKING_SEND_QUEUE_H_
+
+#include "buffer_pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Outgoing bytes a nonblocking socket did not take yet, kept in pooled
+     * buffers until the socket is writable again. Frames are queued whole
+     * or not at all, so the stream stays intact.
+     */
+    typedef struct
+    {
+        MessageBuffer *head; ///< Oldest buffer, sent from offset
+        MessageBuffer *tail; ///< Buffer being filled
+        uint32_t offset;     ///< Bytes of head already sent
+        size_t length;       ///< Queued bytes
+    } SendQueue;
+
+    /**
+     * Drop queued bytes and return their buffers to the pool.
+     *
+     * @param[in] queue Reference to queue
+     */
+    void send_queue_clear(SendQueue *queue);
+
+    /**
+     * Send a frame without blocking. The frame goes straight to the
+     * socket while nothing is queued; what the socket does not take is
+     * queued behind it.
+     *
+     * @param[in] queue   Reference to queue
+     * @param[in] fd      Connected socket
+     * @param[in] header  Encoded header, FRAME_HEADER_LEN bytes
+     * @param[in] payload Payload
+     * @param[in] length  Payload length, must match the header
+     * @param[in] limit   Most bytes the queue may hold
+     *
+     * @return 0 if sent or queued, -1 on socket error or if the frame does
+     *     not fit within limit; the stream must then be closed
+     */
+    int send_queue_frame(
+        SendQueue *queue,
+        int fd,
+        const uint8_t *header,
+        const void *payload,
+        size_t length,
+        size_t limit);
+
+    /**
+     * Send queued bytes until the socket is full.
+     *
+     * @param[in] queue Reference to queue
+     * @param[in] fd    Connected socket
+     *
+     * @return 0 once the queue is empty, 1 if bytes remain, -1 on socket error
+     */
+    int send_queue_flush(SendQueue *queue, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_SEND_QUEUE_H_*/
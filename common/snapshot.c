@@ -0,0 +1,233 @@
+#include "snapshot.h"
+
+#include <string.h>
+
+#define VARINT_MAX_LEN 5
+
+/** Equal runs shorter than this cost less inside a literal than as a token */
+#define MIN_EQUAL_RUN  3
+
+static uint8_t base_at(const uint8_t *baseline, uint32_t baselineSize, uint32_t index)
+{
+    return (index < baselineSize) ? baseline[index] : 0;
+}
+
+static size_t put_varint(uint8_t *out, uint32_t value)
+{
+    size_t length = 0;
+
+    while (value >= 0x80)
+    {
+        out[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    out[length++] = (uint8_t) value;
+
+    return length;
+}
+
+static int get_varint(const uint8_t *in, size_t length, size_t *used, uint32_t *value)
+{
+    uint32_t result = 0;
+
+    for (int shift = 0; (shift < 7 * VARINT_MAX_LEN) && (*used < length); shift += 7)
+    {
+        uint8_t byte = in[(*used)++];
+
+        result |= (uint32_t) (byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static uint32_t equal_run(
+    const uint8_t *state,
+    uint32_t size,
+    const uint8_t *baseline,
+    uint32_t baselineSize,
+    uint32_t index)
+{
+    uint32_t start = index;
+
+    // Word at a time over the unchanged bulk of the state
+    for (; index + sizeof(uint64_t) <= size; index += sizeof(uint64_t))
+    {
+        uint64_t word;
+        uint64_t base = 0;
+
+        if (index + sizeof(base) <= baselineSize)
+        {
+            memcpy (&base, baseline + index, sizeof(base));
+        }
+        else if (index < baselineSize)
+        {
+            // Straddles the end of the baseline
+            break;
+        }
+
+        memcpy (&word, state + index, sizeof(word));
+
+        if (word != base)
+        {
+            break;
+        }
+    }
+
+    while ((index < size) && (state[index] == base_at (baseline, baselineSize, index)))
+    {
+        ++index;
+    }
+
+    return index - start;
+}
+
+static uint32_t literal_run(
+    const uint8_t *state,
+    uint32_t size,
+    const uint8_t *baseline,
+    uint32_t baselineSize,
+    uint32_t index,
+    size_t max)
+{
+    uint32_t length = 0;
+
+    while ((length < max) && (index + length < size))
+    {
+        uint32_t equal;
+
+        if (state[index + length] != base_at (baseline, baselineSize, index + length))
+        {
+            ++length;
+            continue;
+        }
+
+        equal = equal_run (state, size, baseline, baselineSize, index + length);
+
+        if ((equal >= MIN_EQUAL_RUN) || (index + length + equal == size))
+        {
+            break;
+        }
+
+        length += equal;
+    }
+
+    return (length < max) ? length : (uint32_t) max;
+}
+
+/** out = in ^ baseline over [index, index + length), bytes past the baseline copied as is */
+static void xor_range(
+    uint8_t *out,
+    const uint8_t *in,
+    const uint8_t *baseline,
+    uint32_t baselineSize,
+    uint32_t index,
+    uint32_t length)
+{
+    uint32_t shared = (index >= baselineSize) ? 0 :
+        ((length < baselineSize - index) ? length : baselineSize - index);
+
+    for (uint32_t i = 0; i < shared; ++i)
+    {
+        out[i] = in[i] ^ baseline[index + i];
+    }
+
+    memcpy (out + shared, in + shared, length - shared);
+}
+
+size_t snapshot_encode(
+    uint8_t *out,
+    size_t capacity,
+    const uint8_t *state,
+    uint32_t size,
+    const uint8_t *baseline,
+    uint32_t baselineSize,
+    uint32_t *offset)
+{
+    uint32_t index = *offset;
+    size_t used = 0;
+
+    if (baseline == NULL)
+    {
+        baselineSize = 0;
+    }
+
+    while ((index < size) && (capacity - used > 2 * VARINT_MAX_LEN))
+    {
+        uint32_t equal = equal_run (state, size, baseline, baselineSize, index);
+        uint32_t literal = literal_run (state, size, baseline, baselineSize, index + equal,
+            capacity - used - 2 * VARINT_MAX_LEN);
+
+        used += put_varint (out + used, equal);
+        used += put_varint (out + used, literal);
+        index += equal;
+
+        xor_range (out + used, state + index, baseline, baselineSize, index, literal);
+        used += literal;
+        index += literal;
+    }
+
+    *offset = index;
+
+    return used;
+}
+
+int snapshot_decode(
+    uint8_t *state,
+    uint32_t size,
+    const uint8_t *baseline,
+    uint32_t baselineSize,
+    uint32_t *offset,
+    const uint8_t *delta,
+    size_t length)
+{
+    uint32_t index = *offset;
+    size_t used = 0;
+
+    if (baseline == NULL)
+    {
+        baselineSize = 0;
+    }
+
+    while (used < length)
+    {
+        uint32_t equal;
+        uint32_t literal;
+
+        if ((get_varint (delta, length, &used, &equal) != 0) ||
+            (get_varint (delta, length, &used, &literal) != 0) ||
+            (index > size) ||
+            (equal > size - index) ||
+            (literal > size - index - equal) ||
+            (literal > length - used))
+        {
+            return -1;
+        }
+
+        // Unchanged bytes, zero past the baseline
+        uint32_t shared = (index >= baselineSize) ? 0 :
+            ((equal < baselineSize - index) ? equal : baselineSize - index);
+
+        if (shared != 0)
+        {
+            memcpy (state + index, baseline + index, shared);
+        }
+
+        memset (state + index + shared, 0, equal - shared);
+        index += equal;
+
+        xor_range (state + index, delta + used, baseline, baselineSize, index, literal);
+        used += literal;
+        index += literal;
+    }
+
+    *offset = index;
+
+    return 0;
+}
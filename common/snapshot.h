@@ -0,0 +1,72 @@
+#ifndef NETWORKING_SNAPSHOT_H_
+#define NETWORKING_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Snapshots kept by both ends as delta baselines */
+#define SNAPSHOT_HISTORY 32
+
+    /*
+     * Delta format: a sequence of tokens, each a varint count of bytes
+     * equal to the baseline, a varint count of literal bytes, then the
+     * literals XORed with the baseline. Baseline bytes past its size, or
+     * all of them without a baseline, read as zero.
+     */
+
+    /**
+     * Encode a state range as a delta against a baseline. Encoding stops
+     * at the end of the state or when the destination is full; the rest
+     * is encoded in further calls.
+     *
+     * @param[out]    out          Destination
+     * @param[in]     capacity     Destination size, at least 16 bytes
+     * @param[in]     state        Current state
+     * @param[in]     size         State size
+     * @param[in]     baseline     Baseline state, NULL for all zeroes
+     * @param[in]     baselineSize Baseline size
+     * @param[in,out] offset       First state byte to encode, moved past the last encoded byte
+     *
+     * @return Encoded length
+     */
+    size_t snapshot_encode(
+        uint8_t *out,
+        size_t capacity,
+        const uint8_t *state,
+        uint32_t size,
+        const uint8_t *baseline,
+        uint32_t baselineSize,
+        uint32_t *offset);
+
+    /**
+     * Rebuild a state range from a delta produced by snapshot_encode.
+     *
+     * @param[out]    state        State being rebuilt, distinct from the baseline
+     * @param[in]     size         State size
+     * @param[in]     baseline     Baseline state, NULL for all zeroes
+     * @param[in]     baselineSize Baseline size
+     * @param[in,out] offset       First state byte the delta covers, moved past the last decoded byte
+     * @param[in]     delta        Encoded range
+     * @param[in]     length       Encoded length
+     *
+     * @return 0 on success, -1 on malformed delta
+     */
+    int snapshot_decode(
+        uint8_t *state,
+        uint32_t size,
+        const uint8_t *baseline,
+        uint32_t baselineSize,
+        uint32_t *offset,
+        const uint8_t *delta,
+        size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_SNAPSHOT_H_*/
@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+
+#include "thread_config.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+int thread_create(pthread_t *thread, const ThreadConfig *config, void *(*routine)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    int status;
+
+    if (config == NULL)
+    {
+        return pthread_create (thread, NULL, routine, arg);
+    }
+
+    pthread_attr_init (&attr);
+
+    if (config->stack_size != 0)
+    {
+        pthread_attr_setstacksize (&attr, config->stack_size);
+    }
+
+    if (config->cpu_mask != 0)
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO (&cpus);
+
+        for (int cpu = 0; cpu < 64; ++cpu)
+        {
+            if (config->cpu_mask & (1ULL << cpu))
+            {
+                CPU_SET (cpu, &cpus);
+            }
+        }
+
+        // Pinned from the first instruction, so early allocations land on the right node
+        pthread_attr_setaffinity_np (&attr, sizeof(cpus), &cpus);
+    }
+
+    if (config->sched_policy != SCHED_OTHER)
+    {
+        struct sched_param param = {0};
+
+        param.sched_priority = config->sched_priority;
+
+        pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy (&attr, config->sched_policy);
+        pthread_attr_setschedparam (&attr, &param);
+    }
+
+    status = pthread_create (thread, &attr, routine, arg);
+
+    pthread_attr_destroy (&attr);
+
+    return status;
+}
+
+int thread_pinned_cpu(const ThreadConfig *config)
+{
+    uint64_t mask = config->cpu_mask;
+
+    if ((mask == 0) || ((mask & (mask - 1)) != 0))
+    {
+        return -1;
+    }
+
+    return __builtin_ctzll (mask);
+}
+
+void *thread_alloc_pages(size_t size)
+{
+    long pageSize = sysconf (_SC_PAGESIZE);
+    void *memory = NULL;
+
+    // Round up so the tail page is not shared with other allocations
+    size = (size + pageSize - 1) & ~(pageSize - 1);
+
+    if (posix_memalign (&memory, pageSize, size) != 0)
+    {
+        return NULL;
+    }
+
+    return memory;
+}
+
+void thread_bind_memory(void *addr, size_t length)
+{
+    long pageSize = sysconf (_SC_PAGESIZE);
+    unsigned long nodeMask;
+    unsigned int cpu;
+    unsigned int node;
+    cpu_set_t allowed;
+
+    if ((sched_getaffinity (0, sizeof(allowed), &allowed) != 0) ||
+        (CPU_COUNT (&allowed) >= sysconf (_SC_NPROCESSORS_ONLN)) ||
+        (syscall (SYS_getcpu, &cpu, &node, NULL) != 0) ||
+        (node >= sizeof(nodeMask) * 8))
+    {
+        return;
+    }
+
+    length = (length + pageSize - 1) & ~(pageSize - 1);
+    nodeMask = 1UL << node;
+
+    // Best effort: single node systems and kernels without NUMA fail here
+    syscall (SYS_mbind, addr, length, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8, MPOL_MF_MOVE);
+}
@@ -0,0 +1,66 @@
+#ifndef NETWORKING_THREAD_CONFIG_H_
+#define NETWORKING_THREAD_CONFIG_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /** Network thread placement and attributes */
+    typedef struct
+    {
+        uint64_t cpu_mask;   ///< Allowed CPUs, bit N for CPU N (0 leaves placement to the scheduler)
+        size_t stack_size;   ///< Stack size in bytes (0 selects the system default)
+        int sched_policy;    ///< SCHED_OTHER, SCHED_FIFO or SCHED_RR (0 inherits)
+        int sched_priority;  ///< Priority for SCHED_FIFO and SCHED_RR
+    } ThreadConfig;
+
+    /**
+     * Start thread with the configured attributes. Real time policies
+     * usually require CAP_SYS_NICE.
+     *
+     * @param[out] thread  Thread handler
+     * @param[in]  config  Thread attributes, NULL for defaults
+     * @param[in]  routine Thread entry point
+     * @param[in]  arg     Entry point argument
+     *
+     * @return 0 on success, error number otherwise
+     */
+    int thread_create(pthread_t *thread, const ThreadConfig *config, void *(*routine)(void *), void *arg);
+
+    /**
+     * Get the CPU a configuration pins its thread to.
+     *
+     * @param[in] config Thread attributes
+     *
+     * @return CPU index, -1 unless exactly one CPU is allowed
+     */
+    int thread_pinned_cpu(const ThreadConfig *config);
+
+    /**
+     * Allocate page aligned memory, so it can be moved between NUMA nodes
+     * without dragging unrelated data along. Released with free.
+     *
+     * @param[in] size Size in bytes
+     */
+    void *thread_alloc_pages(size_t size);
+
+    /**
+     * Move memory to the NUMA node of the calling thread. Does nothing
+     * unless the thread affinity is restricted, as an unrestricted thread
+     * may migrate to another node anyway.
+     *
+     * @param[in] addr   Memory returned by thread_alloc_pages
+     * @param[in] length Size in bytes
+     */
+    void thread_bind_memory(void *addr, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_THREAD_CONFIG_H_*/
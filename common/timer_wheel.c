@@ -0,0 +1,208 @@
+#include "timer_wheel.h"
+
+#include <stddef.h>
+
+#define LEVEL_SHIFT(level) (TIMER_WHEEL_SLOT_BITS * (level))
+#define MAX_DELTA          ((1ULL << LEVEL_SHIFT(TIMER_WHEEL_LEVELS)) - 1)
+
+static void list_init(TimerEntry *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_append(TimerEntry *head, TimerEntry *timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_unlink(TimerEntry *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static void list_move(TimerEntry *from, TimerEntry *to)
+{
+    list_init (to);
+
+    if (from->next != from)
+    {
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        list_init (from);
+    }
+}
+
+static void wheel_insert(TimerWheel *wheel, TimerEntry *timer)
+{
+    uint64_t delta = timer->expires - wheel->tick;
+    int level = 0;
+
+    if (delta > MAX_DELTA)
+    {
+        delta = MAX_DELTA;
+        timer->expires = wheel->tick + delta;
+    }
+
+    while ((level < TIMER_WHEEL_LEVELS - 1) && (delta >= (1ULL << LEVEL_SHIFT(level + 1))))
+    {
+        ++level;
+    }
+
+    int slot = (timer->expires >> LEVEL_SHIFT(level)) & TIMER_WHEEL_SLOT_MASK;
+
+    list_append (&wheel->slots[level][slot], timer);
+}
+
+static void wheel_cascade(TimerWheel *wheel, int level)
+{
+    int slot = (wheel->tick >> LEVEL_SHIFT(level)) & TIMER_WHEEL_SLOT_MASK;
+    TimerEntry pending;
+
+    list_move (&wheel->slots[level][slot], &pending);
+
+    while (pending.next != &pending)
+    {
+        TimerEntry *timer = pending.next;
+
+        list_unlink (timer);
+        wheel_insert (wheel, timer);
+    }
+}
+
+static void wheel_expire(TimerWheel *wheel)
+{
+    TimerEntry expired;
+
+    list_move (&wheel->slots[0][wheel->tick & TIMER_WHEEL_SLOT_MASK], &expired);
+
+    // Callbacks may cancel entries still in the expired list or schedule new
+    // ones; new entries always land at least one tick ahead.
+    while (expired.next != &expired)
+    {
+        TimerEntry *timer = expired.next;
+
+        list_unlink (timer);
+        --wheel->count;
+
+        timer->cb (timer, timer->ctx);
+    }
+}
+
+void timer_wheel_init(TimerWheel *wheel, uint32_t tickMs, uint64_t nowMs)
+{
+    wheel->tick      = 0;
+    wheel->origin_ms = nowMs;
+    wheel->tick_ms   = (tickMs == 0) ? 1 : tickMs;
+    wheel->count     = 0;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot)
+        {
+            list_init (&wheel->slots[level][slot]);
+        }
+    }
+}
+
+void timer_init(TimerEntry *timer, timer_cb cb, void *ctx)
+{
+    timer->next    = NULL;
+    timer->prev    = NULL;
+    timer->expires = 0;
+    timer->cb      = cb;
+    timer->ctx     = ctx;
+}
+
+void timer_wheel_schedule(TimerWheel *wheel, TimerEntry *timer, uint32_t delayMs)
+{
+    uint64_t ticks = (delayMs + wheel->tick_ms - 1) / wheel->tick_ms;
+
+    timer_wheel_cancel (wheel, timer);
+
+    timer->expires = wheel->tick + ((ticks == 0) ? 1 : ticks);
+    wheel_insert (wheel, timer);
+
+    ++wheel->count;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, TimerEntry *timer)
+{
+    if (timer_is_pending (timer))
+    {
+        list_unlink (timer);
+        --wheel->count;
+    }
+}
+
+int timer_is_pending(const TimerEntry *timer)
+{
+    return timer->next != NULL;
+}
+
+void timer_wheel_advance(TimerWheel *wheel, uint64_t nowMs)
+{
+    if (nowMs < wheel->origin_ms)
+    {
+        return;
+    }
+
+    uint64_t target = (nowMs - wheel->origin_ms) / wheel->tick_ms;
+
+    while (wheel->tick < target)
+    {
+        if (wheel->count == 0)
+        {
+            // Nothing to run, catch up at once
+            wheel->tick = target;
+            break;
+        }
+
+        ++wheel->tick;
+
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level)
+        {
+            if ((wheel->tick & ((1ULL << LEVEL_SHIFT(level)) - 1)) != 0)
+            {
+                break;
+            }
+
+            wheel_cascade (wheel, level);
+        }
+
+        wheel_expire (wheel);
+    }
+}
+
+int timer_wheel_next_timeout(const TimerWheel *wheel, uint64_t nowMs)
+{
+    if (wheel->count == 0)
+    {
+        return -1;
+    }
+
+    uint64_t tick = wheel->tick + 1;
+
+    // Stop at the first non-empty level 0 slot or at the next cascade
+    for (; (tick & TIMER_WHEEL_SLOT_MASK) != 0; ++tick)
+    {
+        const TimerEntry *slot = &wheel->slots[0][tick & TIMER_WHEEL_SLOT_MASK];
+
+        if (slot->next != slot)
+        {
+            break;
+        }
+    }
+
+    uint64_t dueMs = wheel->origin_ms + tick * wheel->tick_ms;
+
+    return (dueMs > nowMs) ? (int) (dueMs - nowMs) : 0;
+}
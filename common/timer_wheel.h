@@ -0,0 +1,117 @@
+#ifndef NETWORKING_TIMER_WHEEL_H_
+#define NETWORKING_TIMER_WHEEL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define TIMER_WHEEL_LEVELS    4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS     (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+    typedef struct TimerEntry TimerEntry;
+
+    /**
+     * Callback prototype for timer expiry.
+     * The timer is no longer pending when the callback runs and may be
+     * rescheduled from within it.
+     *
+     * @param[in] timer Expired timer
+     * @param[in] ctx   Context provided on timer_init
+     */
+    typedef void (*timer_cb)(TimerEntry *timer, void *ctx);
+
+    /** Timer entry. Embedded by the owner, never allocated by the wheel. */
+    struct TimerEntry
+    {
+        TimerEntry *next; ///< Next entry in slot (NULL if not pending)
+        TimerEntry *prev; ///< Previous entry in slot
+        uint64_t expires; ///< Expiry tick
+        timer_cb cb;      ///< Handler to callback on expiry
+        void *ctx;        ///< Callback context
+    };
+
+    /**
+     * Hierarchical timer wheel.
+     * Insert and cancel are O(1); expiry cascades entries from the upper
+     * levels once every TIMER_WHEEL_SLOTS ticks of the level below.
+     * Not thread safe: all calls are expected from the owning thread.
+     */
+    typedef struct
+    {
+        uint64_t tick;      ///< Current tick
+        uint64_t origin_ms; ///< Time of tick 0
+        uint32_t tick_ms;   ///< Tick resolution
+        uint32_t count;     ///< Pending timers
+        TimerEntry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; ///< Slot list heads
+    } TimerWheel;
+
+    /**
+     * Initialize wheel.
+     *
+     * @param[in] wheel  Reference to wheel
+     * @param[in] tickMs Tick resolution in milliseconds
+     * @param[in] nowMs  Current monotonic time in milliseconds
+     */
+    void timer_wheel_init(TimerWheel *wheel, uint32_t tickMs, uint64_t nowMs);
+
+    /**
+     * Initialize a timer entry. Must be called once before scheduling.
+     *
+     * @param[in] timer Reference to timer
+     * @param[in] cb    Handler to callback on expiry
+     * @param[in] ctx   Callback context
+     */
+    void timer_init(TimerEntry *timer, timer_cb cb, void *ctx);
+
+    /**
+     * (Re)schedule timer. A pending timer is moved to the new expiry.
+     *
+     * @param[in] wheel   Reference to wheel
+     * @param[in] timer   Reference to timer
+     * @param[in] delayMs Delay in milliseconds, rounded up to one tick
+     */
+    void timer_wheel_schedule(TimerWheel *wheel, TimerEntry *timer, uint32_t delayMs);
+
+    /**
+     * Cancel timer. No-op if the timer is not pending.
+     *
+     * @param[in] wheel Reference to wheel
+     * @param[in] timer Reference to timer
+     */
+    void timer_wheel_cancel(TimerWheel *wheel, TimerEntry *timer);
+
+    /**
+     * Check if timer is pending.
+     *
+     * @param[in] timer Reference to timer
+     */
+    int timer_is_pending(const TimerEntry *timer);
+
+    /**
+     * Run all timers expired up to the provided time.
+     *
+     * @param[in] wheel Reference to wheel
+     * @param[in] nowMs Current monotonic time in milliseconds
+     */
+    void timer_wheel_advance(TimerWheel *wheel, uint64_t nowMs);
+
+    /**
+     * Milliseconds until the wheel needs to be advanced again.
+     *
+     * @param[in] wheel Reference to wheel
+     * @param[in] nowMs Current monotonic time in milliseconds
+     *
+     * @return -1 if no timer is pending.
+     */
+    int timer_wheel_next_timeout(const TimerWheel *wheel, uint64_t nowMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_TIMER_WHEEL_H_*/
@@ -0,0 +1,77 @@
+#include "token_bucket.h"
+
+#define SCALE 1000000ULL
+
+static uint64_t capacity(const TokenBucket *bucket)
+{
+    return (uint64_t) bucket->burst * SCALE;
+}
+
+static uint64_t required(const TokenBucket *bucket, uint32_t tokens)
+{
+    return (uint64_t) ((tokens > bucket->burst) ? bucket->burst : tokens) * SCALE;
+}
+
+static void refill(TokenBucket *bucket, uint64_t nowUs)
+{
+    uint64_t elapsedUs = nowUs - bucket->last_us;
+    uint64_t missing   = capacity (bucket) - bucket->level;
+
+    bucket->last_us = nowUs;
+
+    // Compare before multiplying to stay clear of overflow on long pauses
+    if (elapsedUs >= (missing + bucket->rate - 1) / bucket->rate)
+    {
+        bucket->level = capacity (bucket);
+    }
+    else
+    {
+        bucket->level += elapsedUs * bucket->rate;
+    }
+}
+
+void token_bucket_init(TokenBucket *bucket, uint32_t rate, uint32_t burst, uint64_t nowUs)
+{
+    bucket->rate    = rate;
+    bucket->burst   = (burst != 0) ? burst : rate;
+    bucket->level   = capacity (bucket);
+    bucket->last_us = nowUs;
+}
+
+int token_bucket_consume(TokenBucket *bucket, uint32_t tokens, uint64_t nowUs)
+{
+    if (bucket->rate == 0)
+    {
+        return 1;
+    }
+
+    refill (bucket, nowUs);
+
+    if (bucket->level < required (bucket, tokens))
+    {
+        return 0;
+    }
+
+    bucket->level -= required (bucket, tokens);
+
+    return 1;
+}
+
+uint32_t token_bucket_wait_ms(TokenBucket *bucket, uint32_t tokens, uint64_t nowUs)
+{
+    if (bucket->rate == 0)
+    {
+        return 0;
+    }
+
+    refill (bucket, nowUs);
+
+    if (bucket->level >= required (bucket, tokens))
+    {
+        return 0;
+    }
+
+    uint64_t waitUs = (required (bucket, tokens) - bucket->level + bucket->rate - 1) / bucket->rate;
+
+    return (uint32_t) ((waitUs + 999) / 1000);
+}
@@ -0,0 +1,55 @@
+#ifndef NETWORKING_TOKEN_BUCKET_H_
+#define NETWORKING_TOKEN_BUCKET_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /** Token bucket rate limiter. Not thread safe. */
+    typedef struct
+    {
+        uint32_t rate;     ///< Tokens added per second, 0 for unlimited
+        uint32_t burst;    ///< Bucket capacity in tokens
+        uint64_t level;    ///< Available tokens, in millionths of a token
+        uint64_t last_us;  ///< Time of last refill
+    } TokenBucket;
+
+    /**
+     * Initialize a full bucket.
+     *
+     * @param[in] bucket Reference to bucket
+     * @param[in] rate   Tokens per second, 0 disables limiting
+     * @param[in] burst  Bucket capacity, 0 selects one second worth of tokens
+     * @param[in] nowUs  Current monotonic time in microseconds
+     */
+    void token_bucket_init(TokenBucket *bucket, uint32_t rate, uint32_t burst, uint64_t nowUs);
+
+    /**
+     * Take tokens if available. Requests larger than the burst are granted
+     * on a full bucket, leaving it empty.
+     *
+     * @param[in] bucket Reference to bucket
+     * @param[in] tokens Tokens requested
+     * @param[in] nowUs  Current monotonic time in microseconds
+     *
+     * @return 1 if tokens were taken, 0 otherwise
+     */
+    int token_bucket_consume(TokenBucket *bucket, uint32_t tokens, uint64_t nowUs);
+
+    /**
+     * Milliseconds until the requested tokens become available.
+     *
+     * @param[in] bucket Reference to bucket
+     * @param[in] tokens Tokens requested
+     * @param[in] nowUs  Current monotonic time in microseconds
+     */
+    uint32_t token_bucket_wait_ms(TokenBucket *bucket, uint32_t tokens, uint64_t nowUs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_TOKEN_BUCKET_H_*/
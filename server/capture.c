@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+
+#include "capture.h"
+#include "event_loop.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_INITIAL_SIZE (1 << 20)
+
+struct Capture
+{
+    pthread_mutex_t lock; ///< Serializes appends from the network and sending threads
+    int fd;               ///< Capture file
+    uint8_t *data;        ///< Mapped file
+    size_t capacity;      ///< Mapped size
+    size_t length;        ///< Recorded size
+    uint64_t start_us;    ///< Capture start time
+    int is_failed;        ///< Growing the file failed, recording stopped
+};
+
+Capture *capture_open(const char *path)
+{
+    Capture *capture = (Capture *) malloc (sizeof(Capture));
+
+    if (capture == NULL)
+    {
+        return NULL;
+    }
+
+    bzero (capture, sizeof(Capture));
+    capture->capacity = CAPTURE_INITIAL_SIZE;
+    capture->fd = open (path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if ((capture->fd == -1) || (ftruncate (capture->fd, capture->capacity) != 0))
+    {
+        if (capture->fd != -1)
+        {
+            close (capture->fd);
+        }
+
+        free (capture);
+        return NULL;
+    }
+
+    capture->data = (uint8_t *) mmap (NULL, capture->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, 0);
+
+    if (capture->data == MAP_FAILED)
+    {
+        close (capture->fd);
+        free (capture);
+        return NULL;
+    }
+
+    pthread_mutex_init (&capture->lock, NULL);
+    memcpy (capture->data, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN);
+    capture->length = CAPTURE_MAGIC_LEN;
+    capture->start_us = event_loop_now_us ();
+
+    return capture;
+}
+
+static int reserve(Capture *capture, size_t size)
+{
+    size_t capacity = capture->capacity;
+    uint8_t *data;
+
+    if (capture->length + size <= capture->capacity)
+    {
+        return 0;
+    }
+
+    while (capture->length + size > capacity)
+    {
+        capacity *= 2;
+    }
+
+    if (ftruncate (capture->fd, capacity) != 0)
+    {
+        return -1;
+    }
+
+    data = (uint8_t *) mremap (capture->data, capture->capacity, capacity, MREMAP_MAYMOVE);
+
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    capture->data = data;
+    capture->capacity = capacity;
+
+    return 0;
+}
+
+void capture_record(Capture *capture, uint8_t type, uint32_t clientId, const void *payload, uint32_t length)
+{
+    CaptureRecord record;
+    size_t payloadSize = (type == CAPTURE_RECEIVE) ? length : 0;
+
+    record.client_id = clientId;
+    record.length    = length;
+    record.type      = type;
+
+    pthread_mutex_lock (&capture->lock);
+
+    // Timestamped under the lock so records stay in time order
+    record.timestamp_us = event_loop_now_us () - capture->start_us;
+
+    if (!capture->is_failed)
+    {
+        if (reserve (capture, sizeof(record) + payloadSize) != 0)
+        {
+            capture->is_failed = 1;
+        }
+        else
+        {
+            memcpy (capture->data + capture->length, &record, sizeof(record));
+
+            if (payloadSize != 0)
+            {
+                memcpy (capture->data + capture->length + sizeof(record), payload, payloadSize);
+            }
+
+            capture->length += sizeof(record) + payloadSize;
+        }
+    }
+
+    pthread_mutex_unlock (&capture->lock);
+}
+
+void capture_close(Capture *capture)
+{
+    munmap (capture->data, capture->capacity);
+
+    if (ftruncate (capture->fd, capture->length) != 0)
+    {
+        // Trailing zeroes read as end of capture
+    }
+
+    close (capture->fd);
+    pthread_mutex_destroy (&capture->lock);
+    free (capture);
+}
+
+int capture_reader_open(CaptureReader *reader, const char *path)
+{
+    struct stat info;
+    int fd = open (path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if ((fstat (fd, &info) != 0) || (info.st_size < CAPTURE_MAGIC_LEN))
+    {
+        close (fd);
+        return -1;
+    }
+
+    reader->size = info.st_size;
+    reader->data = (const uint8_t *) mmap (NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    reader->offset = CAPTURE_MAGIC_LEN;
+
+    close (fd);
+
+    if (reader->data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    if (memcmp (reader->data, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0)
+    {
+        capture_reader_close (reader);
+        return -1;
+    }
+
+    madvise ((void *) reader->data, reader->size, MADV_SEQUENTIAL);
+
+    return 0;
+}
+
+int capture_reader_next(CaptureReader *reader, CaptureRecord *record, const uint8_t **payload)
+{
+    size_t payloadSize;
+
+    if (reader->offset + sizeof(*record) > reader->size)
+    {
+        return (reader->offset == reader->size) ? 0 : -1;
+    }
+
+    memcpy (record, reader->data + reader->offset, sizeof(*record));
+
+    if (record->type == 0)
+    {
+        // Unused space left by a capture that was not closed
+        return 0;
+    }
+
+    payloadSize = (record->type == CAPTURE_RECEIVE) ? record->length : 0;
+
+    if (reader->offset + sizeof(*record) + payloadSize > reader->size)
+    {
+        return -1;
+    }
+
+    *payload = (payloadSize != 0) ? reader->data + reader->offset + sizeof(*record) : NULL;
+    reader->offset += sizeof(*record) + payloadSize;
+
+    return 1;
+}
+
+void capture_reader_rewind(CaptureReader *reader)
+{
+    reader->offset = CAPTURE_MAGIC_LEN;
+}
+
+void capture_reader_close(CaptureReader *reader)
+{
+    munmap ((void *) reader->data, reader->size);
+}
@@ -0,0 +1,108 @@
+#ifndef NETWORKING_CAPTURE_H_
+#define NETWORKING_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** File signature, followed by the records */
+#define CAPTURE_MAGIC     "NETCAP01"
+#define CAPTURE_MAGIC_LEN 8
+
+    /** Captured event types */
+    typedef enum
+    {
+        CAPTURE_ACCEPT = 1, ///< Client connected
+        CAPTURE_RECEIVE,    ///< Message received from client, payload follows
+        CAPTURE_SEND,       ///< Message sent to client, length only
+        CAPTURE_DISCONNECT  ///< Client connection closed
+    } CaptureType;
+
+    /** Record header, host byte order */
+    typedef struct __attribute__((packed))
+    {
+        uint64_t timestamp_us; ///< Time since capture start
+        uint32_t client_id;    ///< Client id
+        uint32_t length;       ///< Message length
+        uint8_t type;          ///< CaptureType
+    } CaptureRecord;
+
+    typedef struct Capture Capture;
+
+    /** Sequential reader over a capture file */
+    typedef struct
+    {
+        const uint8_t *data; ///< Mapped file
+        size_t size;         ///< File size
+        size_t offset;       ///< Offset of next record
+    } CaptureReader;
+
+    /**
+     * Create capture file, truncating any previous content.
+     *
+     * @param[in] path File path
+     */
+    Capture *capture_open(const char *path);
+
+    /**
+     * Append record. Safe to call from any thread.
+     *
+     * @param[in] capture  Reference to capture
+     * @param[in] type     Event type
+     * @param[in] clientId Client id
+     * @param[in] payload  Message, stored for CAPTURE_RECEIVE only
+     * @param[in] length   Message length
+     */
+    void capture_record(Capture *capture, uint8_t type, uint32_t clientId, const void *payload, uint32_t length);
+
+    /**
+     * Trim file to the recorded content and close it.
+     *
+     * @param[in] capture Reference to capture
+     */
+    void capture_close(Capture *capture);
+
+    /**
+     * Map capture file for reading.
+     *
+     * @param[out] reader Reference to reader
+     * @param[in]  path   File path
+     *
+     * @return 0 on success, -1 on error or unknown format
+     */
+    int capture_reader_open(CaptureReader *reader, const char *path);
+
+    /**
+     * Get next record.
+     *
+     * @param[in]  reader  Reference to reader
+     * @param[out] record  Record header
+     * @param[out] payload Record payload, NULL if none
+     *
+     * @return 1 if a record was read, 0 at end of file, -1 on truncated record
+     */
+    int capture_reader_next(CaptureReader *reader, CaptureRecord *record, const uint8_t **payload);
+
+    /**
+     * Restart from the first record.
+     *
+     * @param[in] reader Reference to reader
+     */
+    void capture_reader_rewind(CaptureReader *reader);
+
+    /**
+     * Unmap capture file.
+     *
+     * @param[in] reader Reference to reader
+     */
+    void capture_reader_close(CaptureReader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_CAPTURE_H_*/
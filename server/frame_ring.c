@@ -0,0 +1,92 @@
+#include "frame_ring.h"
+#include "frame.h"
+
+#include <string.h>
+
+#include <arpa/inet.h>
+
+static void copy_out(const FrameRing *ring, size_t offset, void *destination, size_t length)
+{
+    size_t position = (ring->start + offset) % ring->capacity;
+    size_t head = (length < ring->capacity - position) ? length : ring->capacity - position;
+
+    memcpy (destination, &ring->data[position], head);
+    memcpy ((uint8_t *) destination + head, ring->data, length - head);
+}
+
+static void copy_in(FrameRing *ring, const void *source, size_t length)
+{
+    size_t position = (ring->start + ring->length) % ring->capacity;
+    size_t head = (length < ring->capacity - position) ? length : ring->capacity - position;
+
+    memcpy (&ring->data[position], source, head);
+    memcpy (ring->data, (const uint8_t *) source + head, length - head);
+    ring->length += length;
+}
+
+static uint32_t frame_size(const FrameRing *ring, size_t offset)
+{
+    uint32_t networkLength;
+
+    copy_out (ring, offset, &networkLength, sizeof(networkLength));
+
+    return FRAME_HEADER_LEN + ntohl (networkLength);
+}
+
+void frame_ring_init(FrameRing *ring, uint8_t *data, size_t capacity)
+{
+    ring->data     = data;
+    ring->capacity = capacity;
+
+    frame_ring_clear (ring);
+}
+
+void frame_ring_clear(FrameRing *ring)
+{
+    ring->start  = 0;
+    ring->length = 0;
+    ring->first  = 1;
+    ring->last   = 0;
+}
+
+void frame_ring_append(FrameRing *ring, const uint8_t *header, const void *payload, size_t length)
+{
+    size_t size = FRAME_HEADER_LEN + length;
+
+    ring->last++;
+
+    if (size > ring->capacity)
+    {
+        // Nothing up to this frame is available anymore
+        ring->start  = 0;
+        ring->length = 0;
+        ring->first  = ring->last + 1;
+        return;
+    }
+
+    while (ring->length + size > ring->capacity)
+    {
+        uint32_t oldest = frame_size (ring, 0);
+
+        ring->start = (ring->start + oldest) % ring->capacity;
+        ring->length -= oldest;
+        ring->first++;
+    }
+
+    copy_in (ring, header, FRAME_HEADER_LEN);
+    copy_in (ring, payload, length);
+}
+
+uint32_t frame_ring_read(const FrameRing *ring, size_t *offset, uint8_t *frame)
+{
+    uint32_t size = frame_size (ring, *offset);
+
+    if (frame != NULL)
+    {
+        copy_out (ring, *offset, frame, size);
+    }
+
+    *offset += size;
+
+    return size;
+}
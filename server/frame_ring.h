@@ -0,0 +1,69 @@
+#ifndef NETWORKING_FRAME_RING_H_
+#define NETWORKING_FRAME_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Ring of the most recent encoded frames, numbered by sequence. The
+     * oldest frames are evicted to make room. Not thread safe.
+     */
+    typedef struct
+    {
+        uint8_t *data;     ///< Storage, NULL when unused
+        size_t capacity;   ///< Storage size
+        size_t start;      ///< Offset of the oldest frame
+        size_t length;     ///< Buffered bytes
+        uint64_t first;    ///< Sequence of the oldest frame
+        uint64_t last;     ///< Sequence of the newest frame, 0 before the first
+    } FrameRing;
+
+    /**
+     * Initialize an empty ring.
+     *
+     * @param[in] ring     Reference to ring
+     * @param[in] data     Storage
+     * @param[in] capacity Storage size
+     */
+    void frame_ring_init(FrameRing *ring, uint8_t *data, size_t capacity);
+
+    /**
+     * Drop all frames and restart numbering at 1.
+     *
+     * @param[in] ring Reference to ring
+     */
+    void frame_ring_clear(FrameRing *ring);
+
+    /**
+     * Append a frame as the next sequence. A frame larger than the ring
+     * empties it; it still takes a sequence number.
+     *
+     * @param[in] ring    Reference to ring
+     * @param[in] header  Encoded header, FRAME_HEADER_LEN bytes
+     * @param[in] payload Payload
+     * @param[in] length  Payload length, must match the header
+     */
+    void frame_ring_append(FrameRing *ring, const uint8_t *header, const void *payload, size_t length);
+
+    /**
+     * Copy a buffered frame, header included, and step to the next one.
+     * Frames are visited in sequence order starting from offset 0.
+     *
+     * @param[in]     ring   Reference to ring
+     * @param[in,out] offset Offset of the frame from the oldest one
+     * @param[out]    frame  Destination, FRAME_HEADER_LEN + MAX_MESSAGE_LEN bytes, NULL to skip the frame
+     *
+     * @return Frame size, header included
+     */
+    uint32_t frame_ring_read(const FrameRing *ring, size_t *offset, uint8_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETWORKING_FRAME_RING_H_*/
@@ -36,7 +36,7 @@ void error_cb(ServerHandler handler)
 
 int main(void)
 {
-    ServerConfig srvConfig;
+    ServerConfig srvConfig = {0};
 
     memcpy (srvConfig.ip, "224.0.0.26", sizeof(srvConfig.ip));
     memcpy (srvConfig.name, "SuperServer", sizeof(srvConfig.name));
@@ -48,6 +48,8 @@ int main(void)
     srvConfig.receive_cb = recive_data_cb;
     srvConfig.error_cb = error_cb;
     srvConfig.max_nb_clients = 10;
+    srvConfig.heartbeat_interval_ms = 1000;
+    srvConfig.idle_timeout_ms = 5000;
 
     printf("Initializing server\n");
     ServerHandler handler = server_init (&srvConfig);
@@ -0,0 +1,495 @@
+/*
+ * Replays the client side of a server capture against a running server.
+ *
+ * Usage: server-replay [-S] <capture file> <server ip> <game port> [speed]
+ *
+ *   -S  Open a session on connect, for servers with resume_grace_ms
+ *
+ * Speed scales the captured timing: 1 (default) replays in real time,
+ * 2 twice as fast, 0 as fast as possible. Sockets never block: a record
+ * for a connection still connecting, or with output the server has not
+ * taken yet, holds the replay back until it has.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "capture.h"
+#include "event_loop.h"
+#include "frame.h"
+#include "send_queue.h"
+
+#define REPLAY_TICK_MS   1
+#define REPLAY_BATCH     256
+#define REPLAY_DRAIN_MS  1000
+#define REPLAY_QUEUE     (1024 * 1024)
+
+struct Replay;
+
+/** Replayed client connection */
+typedef struct Connection
+{
+    int fd;                      ///< Connection to the server
+    EventSource source;          ///< Loop registration
+    FrameReader reader;          ///< Incoming stream
+    SendQueue queue;             ///< Output the server did not take yet
+    uint32_t events;             ///< Registered events
+    int is_open;                 ///< Connect completed
+    int is_broken;               ///< Closed by the server, records for it are skipped
+    struct Replay *replay;       ///< Owning replay
+    struct Connection **link;    ///< Reference to this connection in the draining list
+    struct Connection *next;     ///< Next draining connection
+} Connection;
+
+/** Replay state */
+typedef struct Replay
+{
+    EventLoop *loop;                ///< Loop driving the replay
+    CaptureReader capture;          ///< Capture being replayed
+    struct sockaddr_in server;      ///< Server under test
+    double speed;                   ///< Timing scale, 0 for no delays
+    int is_session;                 ///< Open a session on connect
+    uint64_t start_us;              ///< Replay start time
+    uint64_t end_us;                ///< Time the last record was replayed
+    Connection **connections;       ///< Open connections per captured client id
+    uint32_t nb_connections;        ///< Size of connections
+    Connection *draining;           ///< Closed connections still reading responses
+    Connection *blocked;            ///< Connection the replay waits for, NULL if none
+    TimerEntry timer;               ///< Wakes the replay for the next record
+    CaptureRecord next;             ///< Next record to replay
+    const uint8_t *next_payload;    ///< Next record payload
+    int has_next;                   ///< Next record is valid
+    uint64_t records;               ///< Replayed records
+    uint64_t connects;              ///< Opened connections
+    uint64_t failed_connects;       ///< Connections refused by the server
+    uint64_t stalls;                ///< Times the replay waited for a connection
+    uint64_t messages_sent;         ///< Messages sent to the server
+    uint64_t bytes_sent;            ///< Payload bytes sent to the server
+    uint64_t messages_expected;     ///< Messages the server sent during capture
+    uint64_t messages_received;     ///< Messages the server sent during replay
+} Replay;
+
+static void release_connection(Replay *replay, Connection *connection)
+{
+    if (connection->link != NULL)
+    {
+        *connection->link = connection->next;
+
+        if (connection->next != NULL)
+        {
+            connection->next->link = connection->link;
+        }
+    }
+
+    event_loop_remove (replay->loop, connection->fd);
+    close (connection->fd);
+    send_queue_clear (&connection->queue);
+    free (connection);
+}
+
+static void replay_step(void *ctx);
+
+static int is_ready(const Connection *connection)
+{
+    return connection->is_broken || (connection->is_open && (connection->queue.length == 0));
+}
+
+/** Continue the replay if it waits for connection and connection can take more */
+static void unblock(Replay *replay, Connection *connection)
+{
+    if ((replay->blocked == connection) && is_ready (connection))
+    {
+        replay->blocked = NULL;
+        event_loop_post (replay->loop, replay_step, replay);
+    }
+}
+
+static void update_events(Replay *replay, Connection *connection)
+{
+    uint32_t events = !connection->is_open ? EPOLLOUT :
+        (connection->queue.length != 0) ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+
+    if (events != connection->events)
+    {
+        event_loop_modify (replay->loop, connection->fd, events, &connection->source);
+        connection->events = events;
+    }
+}
+
+static void connection_lost(Replay *replay, Connection *connection)
+{
+    if (connection->link != NULL)
+    {
+        release_connection (replay, connection);
+        return;
+    }
+
+    // Later records for this client are skipped
+    event_loop_remove (replay->loop, connection->fd);
+    shutdown (connection->fd, SHUT_RDWR);
+    send_queue_clear (&connection->queue);
+    connection->is_broken = 1;
+    unblock (replay, connection);
+}
+
+static int send_frame(Replay *replay, Connection *connection, uint8_t type, const void *payload, uint32_t length)
+{
+    uint8_t header[FRAME_HEADER_LEN];
+
+    frame_encode_header (header, type, length);
+
+    if (send_queue_frame (&connection->queue, connection->fd, header, payload, length, REPLAY_QUEUE) != 0)
+    {
+        connection_lost (replay, connection);
+        return -1;
+    }
+
+    update_events (replay, connection);
+    return 0;
+}
+
+static void close_connection(Replay *replay, uint32_t clientId)
+{
+    Connection *connection = replay->connections[clientId];
+
+    if (connection != NULL)
+    {
+        // Half close: the server still answers what it received before
+        shutdown (connection->fd, SHUT_WR);
+
+        connection->next = replay->draining;
+        connection->link = &replay->draining;
+
+        if (replay->draining != NULL)
+        {
+            replay->draining->link = &connection->next;
+        }
+
+        replay->draining = connection;
+        replay->connections[clientId] = NULL;
+    }
+}
+
+static void on_connected(Replay *replay, Connection *connection)
+{
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+
+    getsockopt (connection->fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+
+    if (error != 0)
+    {
+        replay->failed_connects++;
+        connection_lost (replay, connection);
+        return;
+    }
+
+    connection->is_open = 1;
+    replay->connects++;
+
+    if (replay->is_session)
+    {
+        if (send_frame (replay, connection, FRAME_HELLO, NULL, 0) != 0)
+        {
+            return;
+        }
+    }
+    else
+    {
+        update_events (replay, connection);
+    }
+
+    unblock (replay, connection);
+}
+
+static void on_connection_event(void *ctx, uint32_t events)
+{
+    Connection *connection = (Connection *) ctx;
+    Replay *replay = connection->replay;
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+
+    if (!connection->is_open)
+    {
+        on_connected (replay, connection);
+        return;
+    }
+
+    if (events & EPOLLOUT)
+    {
+        if (send_queue_flush (&connection->queue, connection->fd) < 0)
+        {
+            connection_lost (replay, connection);
+            return;
+        }
+
+        update_events (replay, connection);
+        unblock (replay, connection);
+    }
+
+    ssize_t bytesRcvd = frame_reader_recv (&connection->reader, connection->fd, MSG_DONTWAIT);
+
+    if ((bytesRcvd < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+    {
+        return;
+    }
+
+    if (bytesRcvd <= 0)
+    {
+        connection_lost (replay, connection);
+        return;
+    }
+
+    while (!connection->is_broken && (frame_reader_next (&connection->reader, &type, &payload, &length) == 1))
+    {
+        if (type == FRAME_DATA)
+        {
+            replay->messages_received++;
+        }
+        else if ((type == FRAME_PING) && (connection->link == NULL))
+        {
+            // Draining connections are half closed and cannot answer
+            send_frame (replay, connection, FRAME_PONG, payload, length);
+        }
+    }
+}
+
+static void open_connection(Replay *replay, uint32_t clientId)
+{
+    Connection *connection = (Connection *) malloc (sizeof(Connection));
+
+    close_connection (replay, clientId);
+
+    if (connection == NULL)
+    {
+        return;
+    }
+
+    memset (connection, 0, sizeof(Connection));
+    connection->fd = socket (PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    connection->replay = replay;
+    connection->events = EPOLLOUT;
+    connection->source.cb = on_connection_event;
+    connection->source.ctx = connection;
+    frame_reader_reset (&connection->reader);
+
+    if ((connection->fd == -1) ||
+        ((connect (connection->fd, (struct sockaddr *) &replay->server, sizeof(replay->server)) != 0) &&
+            (errno != EINPROGRESS)) ||
+        (event_loop_add (replay->loop, connection->fd, EPOLLOUT, &connection->source) != 0))
+    {
+        if (connection->fd != -1)
+        {
+            close (connection->fd);
+        }
+
+        free (connection);
+        replay->failed_connects++;
+        return;
+    }
+
+    replay->connections[clientId] = connection;
+}
+
+static void apply_record(Replay *replay, const CaptureRecord *record, const uint8_t *payload)
+{
+    Connection *connection = replay->connections[record->client_id];
+
+    switch (record->type)
+    {
+        case CAPTURE_ACCEPT:
+            open_connection (replay, record->client_id);
+            break;
+
+        case CAPTURE_RECEIVE:
+            if ((connection != NULL) && !connection->is_broken &&
+                (send_frame (replay, connection, FRAME_DATA, payload, record->length) == 0))
+            {
+                replay->messages_sent++;
+                replay->bytes_sent += record->length;
+            }
+            break;
+
+        case CAPTURE_SEND:
+            replay->messages_expected++;
+            break;
+
+        case CAPTURE_DISCONNECT:
+            close_connection (replay, record->client_id);
+            break;
+    }
+
+    replay->records++;
+}
+
+static void read_next(Replay *replay)
+{
+    replay->has_next = capture_reader_next (&replay->capture, &replay->next, &replay->next_payload) == 1;
+}
+
+static void on_drained(TimerEntry *timer, void *ctx)
+{
+    event_loop_stop (((Replay *) ctx)->loop);
+}
+
+static void replay_step(void *ctx)
+{
+    Replay *replay = (Replay *) ctx;
+    uint64_t elapsedUs = event_loop_now_us () - replay->start_us;
+
+    for (int batch = 0; replay->has_next && (batch < REPLAY_BATCH); ++batch)
+    {
+        uint64_t dueUs = (replay->speed == 0) ? 0 : (uint64_t) (replay->next.timestamp_us / replay->speed);
+
+        if (dueUs > elapsedUs)
+        {
+            timer_wheel_schedule (event_loop_timers (replay->loop), &replay->timer, (dueUs - elapsedUs) / 1000);
+            return;
+        }
+
+        Connection *connection = replay->connections[replay->next.client_id];
+
+        if ((connection != NULL) && !is_ready (connection))
+        {
+            // Back off until the server takes what was sent
+            replay->blocked = connection;
+            replay->stalls++;
+            return;
+        }
+
+        apply_record (replay, &replay->next, replay->next_payload);
+        read_next (replay);
+    }
+
+    if (replay->has_next)
+    {
+        // Yield so responses are read between batches
+        event_loop_post (replay->loop, replay_step, replay);
+        return;
+    }
+
+    replay->end_us = event_loop_now_us ();
+
+    // Give the server time to answer the last messages
+    timer_init (&replay->timer, on_drained, replay);
+    timer_wheel_schedule (event_loop_timers (replay->loop), &replay->timer, REPLAY_DRAIN_MS);
+}
+
+static void on_replay_timer(TimerEntry *timer, void *ctx)
+{
+    replay_step (ctx);
+}
+
+static void usage(const char *name)
+{
+    fprintf (stderr, "Usage: %s [-S] <capture file> <server ip> <game port> [speed]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    Replay replay = {0};
+    CaptureRecord record;
+    const uint8_t *payload;
+    int status;
+    int option;
+
+    while ((option = getopt (argc, argv, "S")) != -1)
+    {
+        switch (option)
+        {
+            case 'S': replay.is_session = 1; break;
+            default:
+                usage (argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 3)
+    {
+        usage (argv[0]);
+        return 1;
+    }
+
+    if (capture_reader_open (&replay.capture, argv[optind]) != 0)
+    {
+        fprintf (stderr, "Cannot read capture %s\n", argv[optind]);
+        return 1;
+    }
+
+    replay.server.sin_family = AF_INET;
+    replay.server.sin_addr.s_addr = inet_addr (argv[optind + 1]);
+    replay.server.sin_port = htons (atoi (argv[optind + 2]));
+    replay.speed = (argc - optind > 3) ? atof (argv[optind + 3]) : 1.0;
+
+    // Size the connection table from the highest captured client id
+    while ((status = capture_reader_next (&replay.capture, &record, &payload)) == 1)
+    {
+        if (record.client_id >= replay.nb_connections)
+        {
+            replay.nb_connections = record.client_id + 1;
+        }
+    }
+
+    if (status < 0)
+    {
+        fprintf (stderr, "Capture truncated, replaying complete records only\n");
+    }
+
+    capture_reader_rewind (&replay.capture);
+
+    replay.connections = (Connection **) calloc (replay.nb_connections + 1, sizeof(Connection *));
+    replay.loop = event_loop_create (REPLAY_TICK_MS);
+
+    if ((replay.connections == NULL) || (replay.loop == NULL))
+    {
+        fprintf (stderr, "Out of memory\n");
+        return 1;
+    }
+
+    timer_init (&replay.timer, on_replay_timer, &replay);
+    read_next (&replay);
+
+    replay.start_us = event_loop_now_us ();
+    event_loop_post (replay.loop, replay_step, &replay);
+    event_loop_run (replay.loop);
+
+    uint64_t durationUs = replay.end_us - replay.start_us;
+
+    for (uint32_t clientId = 0; clientId < replay.nb_connections; ++clientId)
+    {
+        if (replay.connections[clientId] != NULL)
+        {
+            release_connection (&replay, replay.connections[clientId]);
+        }
+    }
+
+    while (replay.draining != NULL)
+    {
+        release_connection (&replay, replay.draining);
+    }
+
+    printf ("Replayed %llu records in %.3f s\n", (unsigned long long) replay.records, durationUs / 1e6);
+    printf ("Connections: %llu opened, %llu refused\n",
+        (unsigned long long) replay.connects, (unsigned long long) replay.failed_connects);
+    printf ("Sent: %llu messages, %llu bytes (%.0f messages/s), %llu waits for the server\n",
+        (unsigned long long) replay.messages_sent, (unsigned long long) replay.bytes_sent,
+        (durationUs != 0) ? replay.messages_sent * 1e6 / durationUs : 0.0,
+        (unsigned long long) replay.stalls);
+    printf ("Received: %llu messages, %llu during capture\n",
+        (unsigned long long) replay.messages_received, (unsigned long long) replay.messages_expected);
+
+    event_loop_destroy (replay.loop);
+    capture_reader_close (&replay.capture);
+    free (replay.connections);
+
+    return 0;
+}
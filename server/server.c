@@ -1,11 +1,24 @@
 #include "server.h"
+#include "event_loop.h"
+#include "frame.h"
+#include "token_bucket.h"
+#include "thread_config.h"
+#include "capture.h"
+#include "frame_ring.h"
+#include "snapshot.h"
+#include "send_queue.h"
 
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
 
+#include <sys/random.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -16,344 +29,2362 @@
 #define DEBUG(...)
 #endif
 
+#define DEFAULT_TIMER_TICK_MS 10
+#define DISCOVERY_LIMIT_SLOTS 256
+#define GROUP_NOT_MEMBER      0xFFFF
+#define DEFAULT_RESUME_BUFFER (64 * 1024)
+#define LOAD_WINDOW_US        1000000
+#define DEFAULT_BROADCAST_HISTORY (256 * 1024)
+#define BROADCAST_SYNC_MS     50
+#define SNAPSHOT_ENCODINGS    4
+#define DEFAULT_RECEIVE_BATCH 256
+#define DEFAULT_SEND_QUEUE    (256 * 1024)
+
 /** Client details */
 typedef struct
 {
     ClientId id;                 ///< Client ID
     struct ServerInfo * handler; ///< Server handler
     int socket_fd;               ///< Client assigned socket
+    pthread_mutex_t send_lock;   ///< Serializes frames and socket release
+    EventSource source;          ///< Network thread registration
+    FrameReader reader;          ///< Incoming stream
+    SendQueue queue;             ///< Outgoing bytes the socket did not take, drained on EPOLLOUT
+    uint32_t events;             ///< Registered events
+    TimerEntry idle_timer;       ///< Idle timeout
+    TimerEntry heartbeat_timer;  ///< Ping period
+    TimerEntry resume_timer;     ///< Resumes reads paused by rate limiting
+    TimerEntry grace_timer;      ///< Ends the session of a dropped client
+    TokenBucket msg_bucket;      ///< Message rate limit
+    TokenBucket byte_bucket;     ///< Byte rate limit
+    int is_paused;               ///< Reads paused by rate limiting
+    uint64_t last_activity_ms;   ///< Time of last received frame
+    uint32_t rtt_us;             ///< Last measured round trip time
+    int is_pending;              ///< Connected, waiting for the session handshake
+    int is_detached;             ///< Connection dropped, session kept for resumption
+    int is_removed;              ///< Removed by the application, not resumable
+    int is_multicast;            ///< Receives server_send_message from the broadcast group
+    uint32_t snapshot_acked;     ///< Last snapshot the client rebuilt, 0 if none
+    uint64_t session_token;      ///< Secret proving session ownership
+    FrameRing replay;            ///< Data frames sent in the session, storage NULL if resumption is disabled
 } ClientData;
 
+/** Discovery reply limit for one source address */
+typedef struct
+{
+    in_addr_t ip;       ///< Source address
+    TokenBucket bucket; ///< Reply rate limit
+} DiscoveryLimit;
+
+/** Client group */
+typedef struct
+{
+    int is_used;          ///< Group allocated
+    uint16_t count;       ///< Number of members
+    uint16_t *members;    ///< Dense member list, iterated on send
+    uint16_t *positions;  ///< Index in members per client, GROUP_NOT_MEMBER if absent
+} ClientGroup;
+
+/** Message scheduled for later delivery */
+typedef struct ScheduledSend
+{
+    ScheduleId id;                ///< Schedule id
+    ClientId client_id;           ///< Destination
+    uint32_t delay_ms;            ///< Delay before first send
+    uint32_t period_ms;           ///< Period, 0 for one shot
+    struct ServerInfo * handler;  ///< Server handler
+    TimerEntry timer;             ///< Send timer
+    EventTask task;               ///< Hands the schedule to the network thread
+    struct ScheduledSend * next;  ///< Next scheduled message
+    MessageBuffer * buffer;       ///< Message, one reference held
+    MessageBuffer * block;        ///< Pool buffer holding this schedule
+} ScheduledSend;
+
+/** Frames carrying the last snapshot as a delta against one baseline */
+typedef struct
+{
+    uint32_t sequence;  ///< Encoded snapshot, 0 if unused
+    uint32_t baseline;  ///< Baseline sequence, 0 for none
+    uint8_t *frames;    ///< Encoded frames, back to back
+    size_t length;      ///< Bytes of frames
+    size_t capacity;    ///< Allocated bytes
+} SnapshotEncoding;
+
 /** Server details */
 typedef struct ServerInfo
 {
     ServerConfig config;        ///< Server configuration
-    pthread_t advertise_thread; ///< Advertise thread handler
-    pthread_t game_thread;      ///< Game handler
+    pthread_t network_thread;   ///< Network thread handler
+    EventLoop *loop;            ///< Network event loop
+    EventSource advertise_source; ///< Advertise socket registration
+    DiscoveryListener discovery_listener; ///< Shared advertise socket registration
+    EventSource game_source;    ///< Conn socket registration
     int advertise_fd;           ///< Server advertise socket
     int game_fd;                ///< Server conn socket
     int is_advertising;         ///< Advertising state
     int is_initialized;         ///< Initialized state
+    int release_on_exit;        ///< Deinitialized from the network thread
     ClientData *client_data;    ///< Client data
+    ScheduledSend *scheduled;   ///< Pending scheduled messages
+    ScheduleId last_schedule_id;  ///< Last assigned schedule id
+    DiscoveryLimit discovery_limits[DISCOVERY_LIMIT_SLOTS]; ///< Per source reply limits
+    pthread_rwlock_t groups_lock; ///< Protects group membership
+    ClientGroup *groups;        ///< Client groups
+    Capture *capture;           ///< Traffic capture, NULL if disabled
+    uint8_t *replay_buffers;    ///< Replay rings of all clients, NULL if resumption is disabled
+    uint16_t nb_clients;        ///< Announced clients, including detached sessions
+    uint8_t load;               ///< Advertised load
+    uint64_t load_sample_us;    ///< Start of the load measurement window
+    uint64_t load_waited_us;    ///< Loop waiting time at the start of the window
+    int broadcast_fd;           ///< Broadcast group socket, 0 if disabled
+    struct sockaddr_in broadcast_group; ///< Broadcast destination
+    pthread_mutex_t broadcast_lock; ///< Orders broadcasts against joins and repairs
+    FrameRing broadcast_history; ///< Recent broadcasts, for repairs
+    TimerEntry broadcast_timer; ///< Sync datagram period
+    pthread_mutex_t snapshot_lock; ///< Serializes server_send_snapshot
+    uint8_t *snapshots;         ///< Snapshot history, SNAPSHOT_HISTORY states of snapshot_size bytes
+    uint32_t snapshot_sequences[SNAPSHOT_HISTORY]; ///< Sequence held by each state, 0 if none
+    uint32_t snapshot_sizes[SNAPSHOT_HISTORY];     ///< Size of each state
+    uint32_t snapshot_sequence; ///< Last submitted snapshot
+    SnapshotEncoding snapshot_encodings[SNAPSHOT_ENCODINGS]; ///< Last snapshot encoded against recent baselines
+    EventFlush batch_flush;     ///< Delivers the batch after each dispatch round
+    ServerMessage *batch;       ///< Messages gathered for receive_batch_cb, NULL if disabled
+    uint32_t batch_count;       ///< Gathered messages
+    char advertise_message[sizeof(ADVERTISING_RESPONSE) + sizeof(AdvertisingInfo)]; ///< Discovery response
 } ServerInfo;
 
-typedef ServerInfo * ServerHandler_t;
+typedef ServerInfo * ServerHandler_t;
+
+static void server_release(ServerHandler_t instance)
+{
+    Runtime *runtime = instance->config.runtime;
+
+    if (runtime != NULL)
+    {
+        runtime_discovery_remove (runtime, &instance->discovery_listener);
+        runtime_detach (runtime, instance->loop);
+    }
+    else if (instance->loop != NULL)
+    {
+        event_loop_destroy (instance->loop);
+    }
+
+    if (instance->advertise_fd != 0)
+    {
+        close (instance->advertise_fd);
+    }
+
+    if (instance->game_fd != 0)
+    {
+        close (instance->game_fd);
+    }
+
+    if (instance->broadcast_fd != 0)
+    {
+        close (instance->broadcast_fd);
+    }
+
+    for (ClientId clientId = 0; clientId < instance->config.max_nb_clients; ++clientId)
+    {
+        pthread_mutex_destroy (&instance->client_data[clientId].send_lock);
+    }
+
+    for (GroupId groupId = 0; (instance->groups != NULL) && (groupId < instance->config.max_nb_groups); ++groupId)
+    {
+        free (instance->groups[groupId].members);
+    }
+
+    pthread_rwlock_destroy (&instance->groups_lock);
+    pthread_mutex_destroy (&instance->broadcast_lock);
+    pthread_mutex_destroy (&instance->snapshot_lock);
+
+    if (instance->capture != NULL)
+    {
+        capture_close (instance->capture);
+    }
+
+    free (instance->replay_buffers);
+    free (instance->broadcast_history.data);
+    free (instance->snapshots);
+
+    for (int encoding = 0; encoding < SNAPSHOT_ENCODINGS; ++encoding)
+    {
+        free (instance->snapshot_encodings[encoding].frames);
+    }
+    free (instance->batch);
+    free (instance->groups);
+    free (instance->client_data);
+    free (instance);
+}
+
+static void server_fatal_error(ServerHandler_t instance)
+{
+    if (instance->config.error_cb != NULL)
+    {
+        instance->config.error_cb (instance);
+    }
+
+    server_deinit (instance);
+}
+
+static void server_init_error(ServerHandler_t instance)
+{
+    if (instance->config.error_cb != NULL)
+    {
+        instance->config.error_cb (instance);
+    }
+
+    server_release (instance);
+}
+
+static void group_remove_member(ClientGroup *group, uint16_t clientId)
+{
+    uint16_t position = group->positions[clientId];
+
+    if (position != GROUP_NOT_MEMBER)
+    {
+        // Swap with last to keep members dense
+        uint16_t last = group->members[--group->count];
+
+        group->members[position] = last;
+        group->positions[last] = position;
+        group->positions[clientId] = GROUP_NOT_MEMBER;
+    }
+}
+
+/** Hand the gathered messages to the application */
+static void deliver_batch(void *param)
+{
+    ServerHandler_t instance = (ServerHandler_t) param;
+    uint32_t count = instance->batch_count;
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Deliveries from within the callback find the batch empty
+    instance->batch_count = 0;
+    instance->config.receive_batch_cb (instance, instance->batch, count);
+
+    for (uint32_t index = 0; index < count; ++index)
+    {
+        buffer_release (instance->batch[index].message);
+    }
+}
+
+static void batch_message(ClientData *clientData, const uint8_t *payload, uint32_t length)
+{
+    ServerHandler_t instance = clientData->handler;
+    MessageBuffer *message = buffer_pool_alloc (length);
+    ServerMessage *entry;
+
+    if (message == NULL)
+    {
+        DEBUG ("Server: State update[Client %d message dropped]\n", clientData->id);
+        return;
+    }
+
+    // The reader reuses its buffer on the next read
+    memcpy (message->data, payload, length);
+    message->size = length;
+
+    entry = &instance->batch[instance->batch_count++];
+    entry->client_id = clientData->id;
+    entry->buffer    = message->data;
+    entry->size      = length;
+    entry->message   = message;
+
+    if (instance->batch_count == instance->config.receive_batch_size)
+    {
+        deliver_batch (instance);
+    }
+}
+
+/** Register the events the client waits for. Called with send_lock held. */
+static void update_events(ClientData *clientData)
+{
+    uint32_t events = (clientData->is_paused ? 0 : EPOLLIN) | ((clientData->queue.length != 0) ? EPOLLOUT : 0);
+
+    if (events != clientData->events)
+    {
+        clientData->events = events;
+        event_loop_modify (clientData->handler->loop, clientData->socket_fd, events, &clientData->source);
+    }
+}
+
+/**
+ * Send a frame without blocking; what the socket does not take is queued
+ * and sent once it is writable. A client whose queue overflows cannot
+ * keep up and is dropped. Called with send_lock held.
+ *
+ * @return 0 if sent or queued, -1 if the client is dropped
+ */
+static int send_frame_encoded(ClientData *clientData, const uint8_t *header, const void *payload, size_t length)
+{
+    if (send_queue_frame (&clientData->queue, clientData->socket_fd, header, payload, length,
+            clientData->handler->config.client_send_queue_size) != 0)
+    {
+        DEBUG ("Server: State update[Client %d cannot keep up, dropped]\n", clientData->id);
+
+        // The network thread releases the connection on end of stream
+        shutdown (clientData->socket_fd, SHUT_RDWR);
+        return -1;
+    }
+
+    update_events (clientData);
+
+    return 0;
+}
+
+static int send_frame(ClientData *clientData, uint8_t type, const void *payload, size_t length)
+{
+    uint8_t header[FRAME_HEADER_LEN];
+
+    frame_encode_header (header, type, length);
+
+    return send_frame_encoded (clientData, header, payload, length);
+}
+
+/** Close the connection of a client, send_lock held */
+static void drop_socket(ClientData *clientData, int isDetached)
+{
+    ServerHandler_t instance = clientData->handler;
+    TimerWheel *timers = event_loop_timers (instance->loop);
+
+    event_loop_remove (instance->loop, clientData->socket_fd);
+    timer_wheel_cancel (timers, &clientData->idle_timer);
+    timer_wheel_cancel (timers, &clientData->heartbeat_timer);
+    timer_wheel_cancel (timers, &clientData->resume_timer);
+
+    close (clientData->socket_fd);
+    clientData->socket_fd = 0;
+    clientData->is_detached = isDetached;
+    clientData->is_paused = 0;
+    clientData->events = 0;
+    send_queue_clear (&clientData->queue);
+}
+
+static void release_socket(ClientData *clientData, int isDetached)
+{
+    // Senders see either the connection or the detached session
+    pthread_mutex_lock (&clientData->send_lock);
+    drop_socket (clientData, isDetached);
+    pthread_mutex_unlock (&clientData->send_lock);
+}
+
+static void close_client(ClientData *clientData, int notify)
+{
+    ServerHandler_t instance = clientData->handler;
+    int isAnnounced = !clientData->is_pending;
+
+    if (clientData->socket_fd != 0)
+    {
+        release_socket (clientData, 0);
+    }
+
+    timer_wheel_cancel (event_loop_timers (instance->loop), &clientData->grace_timer);
+
+    pthread_mutex_lock (&clientData->send_lock);
+    clientData->is_pending  = 0;
+    clientData->is_detached = 0;
+    pthread_mutex_unlock (&clientData->send_lock);
+
+    if (!isAnnounced)
+    {
+        // Closed before the session handshake, the application never saw it
+        return;
+    }
+
+    instance->nb_clients--;
+
+    pthread_rwlock_wrlock (&instance->groups_lock);
+
+    for (GroupId groupId = 0; groupId < instance->config.max_nb_groups; ++groupId)
+    {
+        if (instance->groups[groupId].is_used)
+        {
+            group_remove_member (&instance->groups[groupId], clientData->id);
+        }
+    }
+
+    pthread_rwlock_unlock (&instance->groups_lock);
+
+    if (instance->capture != NULL)
+    {
+        capture_record (instance->capture, CAPTURE_DISCONNECT, clientData->id, NULL, 0);
+    }
+
+    if (notify && (instance->config.client_disconnected_cb != NULL))
+    {
+        // Messages of the client come first
+        deliver_batch (instance);
+        instance->config.client_disconnected_cb (instance, clientData->id);
+    }
+}
+
+static void connection_lost(ClientData *clientData)
+{
+    ServerHandler_t instance = clientData->handler;
+
+    if ((clientData->replay.data == NULL) || clientData->is_pending || clientData->is_removed)
+    {
+        close_client (clientData, 1);
+        return;
+    }
+
+    DEBUG ("Server: State update[Client %d session kept for resumption]\n", clientData->id);
+
+    release_socket (clientData, 1);
+    timer_wheel_schedule (event_loop_timers (instance->loop), &clientData->grace_timer, instance->config.resume_grace_ms);
+}
+
+static void on_grace_timer(TimerEntry *timer, void *ctx)
+{
+    ClientData * clientData = (ClientData *) ctx;
+
+    DEBUG ("Server: State update[Client %d session expired]\n", clientData->id);
+
+    close_client (clientData, 1);
+}
+
+static void on_idle_timer(TimerEntry *timer, void *ctx)
+{
+    ClientData * clientData = (ClientData *) ctx;
+    ServerHandler_t instance = clientData->handler;
+    uint64_t idleMs = event_loop_now_ms () - clientData->last_activity_ms;
+
+    if (idleMs >= instance->config.idle_timeout_ms)
+    {
+        DEBUG ("Server: State update[Client %d idle timeout]\n", clientData->id);
+
+        connection_lost (clientData);
+    }
+    else
+    {
+        timer_wheel_schedule (
+            event_loop_timers (instance->loop),
+            timer,
+            instance->config.idle_timeout_ms - idleMs);
+    }
+}
+
+static void on_heartbeat_timer(TimerEntry *timer, void *ctx)
+{
+    ClientData * clientData = (ClientData *) ctx;
+    ServerHandler_t instance = clientData->handler;
+    uint64_t timestamp = event_loop_now_us ();
+
+    // Skip this ping rather than wait for an application send in
+    // progress; the session reply must come first
+    if (!clientData->is_pending && (pthread_mutex_trylock (&clientData->send_lock) == 0))
+    {
+        send_frame (clientData, FRAME_PING, &timestamp, sizeof(timestamp));
+        pthread_mutex_unlock (&clientData->send_lock);
+    }
+
+    timer_wheel_schedule (event_loop_timers (instance->loop), timer, instance->config.heartbeat_interval_ms);
+}
+
+/** Resend frames the client missed. Called with send_lock held. */
+static void replay_resend(ClientData *clientData, uint64_t received)
+{
+    uint8_t frame[FRAME_HEADER_LEN + MAX_MESSAGE_LEN];
+    size_t offset = 0;
+
+    for (uint64_t sequence = clientData->replay.first; sequence <= clientData->replay.last; ++sequence)
+    {
+        uint32_t frameSize = frame_ring_read (&clientData->replay, &offset, (sequence > received) ? frame : NULL);
+
+        if (sequence > received)
+        {
+            if (send_frame_encoded (clientData, frame, &frame[FRAME_HEADER_LEN], frameSize - FRAME_HEADER_LEN) < 0)
+            {
+                // Lost again, the client resumes from what it got
+                return;
+            }
+        }
+    }
+}
+
+static void send_session(ClientData *clientData, int isResumed)
+{
+    SessionFrame reply = {0};
+
+    reply.client_id  = htonl (clientData->id);
+    reply.token      = htobe64 (clientData->session_token);
+    reply.is_resumed = isResumed;
+
+    send_frame (clientData, FRAME_SESSION, &reply, sizeof(reply));
+}
+
+static void schedule_client_timers(ClientData *clientData)
+{
+    ServerHandler_t instance = clientData->handler;
+    TimerWheel *timers = event_loop_timers (instance->loop);
+
+    if (instance->config.idle_timeout_ms != 0)
+    {
+        timer_wheel_schedule (timers, &clientData->idle_timer, instance->config.idle_timeout_ms);
+    }
+
+    if (instance->config.heartbeat_interval_ms != 0)
+    {
+        timer_wheel_schedule (timers, &clientData->heartbeat_timer, instance->config.heartbeat_interval_ms);
+    }
+}
+
+static int find_free_client(ServerHandler_t instance)
+{
+    int clientId;
+
+    for (clientId = 0; clientId < instance->config.max_nb_clients; ++clientId)
+    {
+        if ((instance->client_data[clientId].socket_fd == 0) && !instance->client_data[clientId].is_detached)
+        {
+            break;
+        }
+    }
+
+    return clientId;
+}
+
+static void announce_client(ClientData *clientData)
+{
+    ServerHandler_t instance = clientData->handler;
+
+    instance->nb_clients++;
+
+    if (instance->capture != NULL)
+    {
+        capture_record (instance->capture, CAPTURE_ACCEPT, clientData->id, NULL, 0);
+    }
+
+    if (instance->config.client_connected_cb != NULL)
+    {
+        // Messages of a previous client with the same id come first
+        deliver_batch (instance);
+        instance->config.client_connected_cb (instance, clientData->id);
+    }
+
+    if (find_free_client (instance) == instance->config.max_nb_clients)
+    {
+        // Server is full, stop advertising
+        server_stop_advertising (instance);
+    }
+}
+
+static void start_session(ClientData *clientData)
+{
+    uint64_t token = 0;
+
+    if (getrandom (&token, sizeof(token), 0) != sizeof(token))
+    {
+        DEBUG ("Server: State update[Client %d weak session token]\n", clientData->id);
+
+        token = event_loop_now_us () * 0x9E3779B97F4A7C15ULL;
+    }
+
+    pthread_mutex_lock (&clientData->send_lock);
+    clientData->session_token = token;
+    clientData->is_pending    = 0;
+    frame_ring_clear (&clientData->replay);
+    send_session (clientData, 0);
+    pthread_mutex_unlock (&clientData->send_lock);
+
+    announce_client (clientData);
+}
+
+/**
+ * Move a new connection into the session it proves to own. A session
+ * still attached to an older connection is taken over: the client saw
+ * that connection fail before the server did.
+ *
+ * @param[in] clientData Pending client the request arrived on
+ * @param[in] request    Resume request
+ *
+ * @return Resumed client, NULL if the session cannot be resumed
+ */
+static ClientData *resume_session(ClientData *clientData, const SessionFrame *request)
+{
+    ServerHandler_t instance = clientData->handler;
+    TimerWheel *timers = event_loop_timers (instance->loop);
+    ClientId clientId = ntohl (request->client_id);
+    uint64_t received = be64toh (request->received);
+    int socketFd = clientData->socket_fd;
+    ClientData * session;
+
+    if (clientId >= instance->config.max_nb_clients)
+    {
+        return NULL;
+    }
+
+    session = &instance->client_data[clientId];
+
+    pthread_mutex_lock (&session->send_lock);
+
+    if (!(session->is_detached || (session->socket_fd != 0)) ||
+        session->is_pending ||
+        session->is_removed ||
+        (session->session_token != be64toh (request->token)) ||
+        (received + 1 < session->replay.first) ||
+        (received > session->replay.last))
+    {
+        pthread_mutex_unlock (&session->send_lock);
+        return NULL;
+    }
+
+    if (session->socket_fd != 0)
+    {
+        // Unsent output of the old connection is in the replay buffer too
+        DEBUG ("Server: State update[Client %d connection taken over]\n", session->id);
+        drop_socket (session, 1);
+    }
+
+    // Messages sent while detached were buffered; they follow the reply.
+    // The connection is still registered for the pending client, the
+    // first update moves it to the session
+    session->socket_fd   = socketFd;
+    session->is_detached = 0;
+    session->events      = 0;
+    send_session (session, 1);
+    replay_resend (session, received);
+    update_events (session);
+    pthread_mutex_unlock (&session->send_lock);
+
+    timer_wheel_cancel (timers, &clientData->idle_timer);
+    timer_wheel_cancel (timers, &clientData->heartbeat_timer);
+    timer_wheel_cancel (timers, &session->grace_timer);
+
+    pthread_mutex_lock (&clientData->send_lock);
+    clientData->socket_fd  = 0;
+    clientData->is_pending = 0;
+    pthread_mutex_unlock (&clientData->send_lock);
+
+    // Frames the client sent right after the request
+    memcpy (&session->reader, &clientData->reader, sizeof(FrameReader));
+    session->last_activity_ms = event_loop_now_ms ();
+    schedule_client_timers (session);
+
+    return session;
+}
+
+/**
+ * Handle the first frame of a connection.
+ *
+ * @return Client owning the connection afterwards, NULL on protocol error
+ */
+static ClientData *open_session(ClientData *clientData, uint8_t type, const uint8_t *payload, uint32_t length)
+{
+    SessionFrame request;
+
+    if ((type == FRAME_RESUME) && (length == sizeof(request)))
+    {
+        memcpy (&request, payload, sizeof(request));
+
+        ClientData * session = resume_session (clientData, &request);
+
+        if (session != NULL)
+        {
+            DEBUG ("Server: State update[Client %d resumed]\n", session->id);
+            return session;
+        }
+
+        DEBUG ("Server: State update[Client %d resume refused, new session]\n", clientData->id);
+    }
+    else if (type != FRAME_HELLO)
+    {
+        return NULL;
+    }
+
+    start_session (clientData);
+
+    return clientData;
+}
+
+static void send_datagram(ServerHandler_t instance, uint8_t type, const void *buffer, size_t size)
+{
+    BroadcastHeader header;
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+
+    header.sequence = htobe64 (instance->broadcast_history.last);
+    header.type     = type;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len  = sizeof(header);
+    iov[1].iov_base = (void *) buffer;
+    iov[1].iov_len  = size;
+
+    msg.msg_name    = &instance->broadcast_group;
+    msg.msg_namelen = sizeof(instance->broadcast_group);
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = 2;
+
+    // A datagram dropped here is repaired like one lost on the way
+    sendmsg (instance->broadcast_fd, &msg, MSG_DONTWAIT);
+}
+
+static void on_broadcast_timer(TimerEntry *timer, void *ctx)
+{
+    ServerHandler_t instance = (ServerHandler_t) ctx;
+
+    pthread_mutex_lock (&instance->broadcast_lock);
+
+    if (instance->broadcast_history.last != 0)
+    {
+        // Lets clients notice the last broadcasts were lost, even once
+        // the server stopped broadcasting
+        send_datagram (instance, BROADCAST_SYNC, NULL, 0);
+    }
+
+    pthread_mutex_unlock (&instance->broadcast_lock);
+
+    timer_wheel_schedule (event_loop_timers (instance->loop), timer, BROADCAST_SYNC_MS);
+}
+
+/** Send broadcasts from first to last over the connection. Called with broadcast_lock and send_lock held. */
+static void send_repairs(ClientData *clientData, uint64_t first, uint64_t last)
+{
+    FrameRing * history = &clientData->handler->broadcast_history;
+    uint8_t frame[FRAME_HEADER_LEN + sizeof(BroadcastHeader) + MAX_MESSAGE_LEN];
+    BroadcastHeader * repair = (BroadcastHeader *) &frame[FRAME_HEADER_LEN];
+    size_t offset = 0;
+
+    if (first < history->first)
+    {
+        repair->sequence = htobe64 ((last < history->first) ? last : history->first - 1);
+        repair->type     = BROADCAST_LOST;
+
+        send_frame (clientData, FRAME_REPAIR, repair, sizeof(*repair));
+    }
+
+    for (uint64_t sequence = history->first; (sequence <= history->last) && (sequence <= last); ++sequence)
+    {
+        // The stored header is overwritten by the repair header, the
+        // message lands right after it
+        uint32_t frameSize = frame_ring_read (history, &offset, (sequence >= first) ? &frame[sizeof(BroadcastHeader)] : NULL);
+        uint32_t length = sizeof(BroadcastHeader) + frameSize - FRAME_HEADER_LEN;
+
+        if (sequence < first)
+        {
+            continue;
+        }
+
+        repair->sequence = htobe64 (sequence);
+        repair->type     = BROADCAST_DATA;
+        frame_encode_header (frame, FRAME_REPAIR, length);
+
+        if (send_frame_encoded (clientData, frame, repair, length) < 0)
+        {
+            return;
+        }
+    }
+}
+
+static void join_broadcast(ClientData *clientData)
+{
+    ServerHandler_t instance = clientData->handler;
+    BroadcastJoin reply;
+
+    if (instance->broadcast_fd == 0)
+    {
+        // Not offered, broadcasts keep coming over the connection
+        return;
+    }
+
+    reply.group = instance->broadcast_group.sin_addr.s_addr;
+    reply.port  = instance->broadcast_group.sin_port;
+
+    pthread_mutex_lock (&instance->broadcast_lock);
+    pthread_mutex_lock (&clientData->send_lock);
+
+    // Broadcasts so far came over the connection
+    reply.sequence = htobe64 (instance->broadcast_history.last + 1);
+    clientData->is_multicast = 1;
+    send_frame (clientData, FRAME_JOIN, &reply, sizeof(reply));
+
+    pthread_mutex_unlock (&clientData->send_lock);
+    pthread_mutex_unlock (&instance->broadcast_lock);
+}
+
+static void leave_broadcast(ClientData *clientData, uint64_t next)
+{
+    ServerHandler_t instance = clientData->handler;
+
+    if (instance->broadcast_fd == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock (&instance->broadcast_lock);
+    pthread_mutex_lock (&clientData->send_lock);
+
+    // Catch up before broadcasts switch back to the connection
+    clientData->is_multicast = 0;
+    send_repairs (clientData, next, instance->broadcast_history.last);
+
+    pthread_mutex_unlock (&clientData->send_lock);
+    pthread_mutex_unlock (&instance->broadcast_lock);
+}
+
+static void repair_broadcast(ClientData *clientData, uint64_t first, uint64_t last)
+{
+    ServerHandler_t instance = clientData->handler;
+
+    if (instance->broadcast_fd == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock (&instance->broadcast_lock);
+    pthread_mutex_lock (&clientData->send_lock);
+    send_repairs (clientData, first, last);
+    pthread_mutex_unlock (&clientData->send_lock);
+    pthread_mutex_unlock (&instance->broadcast_lock);
+}
+
+static int admit_message(ClientData *clientData, uint32_t length)
+{
+    uint64_t nowUs = event_loop_now_us ();
+
+    // Both limits must pass before taking from either
+    if ((token_bucket_wait_ms (&clientData->msg_bucket, 1, nowUs) != 0) ||
+        (token_bucket_wait_ms (&clientData->byte_bucket, length, nowUs) != 0))
+    {
+        return 0;
+    }
+
+    token_bucket_consume (&clientData->msg_bucket, 1, nowUs);
+    token_bucket_consume (&clientData->byte_bucket, length, nowUs);
+
+    return 1;
+}
+
+static void pause_client(ClientData *clientData, uint32_t length)
+{
+    ServerHandler_t instance = clientData->handler;
+    uint64_t nowUs = event_loop_now_us ();
+    uint32_t msgWaitMs  = token_bucket_wait_ms (&clientData->msg_bucket, 1, nowUs);
+    uint32_t byteWaitMs = token_bucket_wait_ms (&clientData->byte_bucket, length, nowUs);
+
+    DEBUG ("Server: State update[Client %d rate limited]\n", clientData->id);
+
+    // Unread data stays in the socket; TCP flow control pushes back on the client
+    pthread_mutex_lock (&clientData->send_lock);
+    clientData->is_paused = 1;
+    update_events (clientData);
+    pthread_mutex_unlock (&clientData->send_lock);
+
+    timer_wheel_schedule (
+        event_loop_timers (instance->loop),
+        &clientData->resume_timer,
+        (msgWaitMs > byteWaitMs) ? msgWaitMs : byteWaitMs);
+}
+
+static void process_frames(ClientData *clientData)
+{
+    ServerHandler_t instance = clientData->handler;
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+    int status;
+
+    while ((status = frame_reader_peek (&clientData->reader, &type, &payload, &length)) == 1)
+    {
+        if ((type == FRAME_DATA) && !admit_message (clientData, length))
+        {
+            pause_client (clientData, length);
+            return;
+        }
+
+        frame_reader_consume (&clientData->reader, length);
+
+        if (clientData->is_pending)
+        {
+            ClientData * session = open_session (clientData, type, payload, length);
+
+            if (session == NULL)
+            {
+                status = -1;
+                break;
+            }
+
+            if (session != clientData)
+            {
+                // The connection moved to the resumed client
+                process_frames (session);
+                return;
+            }
+        }
+        else if (type == FRAME_DATA)
+        {
+            if (instance->capture != NULL)
+            {
+                capture_record (instance->capture, CAPTURE_RECEIVE, clientData->id, payload, length);
+            }
+
+            if (instance->batch != NULL)
+            {
+                batch_message (clientData, payload, length);
+            }
+            else if (instance->config.receive_cb != NULL)
+            {
+                instance->config.receive_cb (instance, clientData->id, payload, length);
+            }
+        }
+        else if ((type == FRAME_PONG) && (length == sizeof(uint64_t)))
+        {
+            uint64_t timestamp;
+
+            memcpy (&timestamp, payload, sizeof(timestamp));
+            clientData->rtt_us = (uint32_t) (event_loop_now_us () - timestamp);
+        }
+        else if (type == FRAME_JOIN)
+        {
+            join_broadcast (clientData);
+        }
+        else if ((type == FRAME_LEAVE) && (length == sizeof(uint64_t)))
+        {
+            uint64_t next;
+
+            memcpy (&next, payload, sizeof(next));
+            leave_broadcast (clientData, be64toh (next));
+        }
+        else if ((type == FRAME_NACK) && (length == sizeof(BroadcastRange)))
+        {
+            BroadcastRange range;
+
+            memcpy (&range, payload, sizeof(range));
+            repair_broadcast (clientData, be64toh (range.first), be64toh (range.last));
+        }
+        else if ((type == FRAME_SNAPSHOT_ACK) && (length == sizeof(uint32_t)))
+        {
+            uint32_t sequence;
+
+            memcpy (&sequence, payload, sizeof(sequence));
+            __atomic_store_n (&clientData->snapshot_acked, ntohl (sequence), __ATOMIC_RELAXED);
+        }
+
+        if (clientData->socket_fd == 0)
+        {
+            // Removed from within callback
+            return;
+        }
+    }
+
+    if (status < 0)
+    {
+        DEBUG ("Server: State update[Client %d protocol error]\n", clientData->id);
+
+        close_client (clientData, 1);
+    }
+}
+
+static void on_resume_timer(TimerEntry *timer, void *ctx)
+{
+    ClientData * clientData = (ClientData *) ctx;
+
+    pthread_mutex_lock (&clientData->send_lock);
+    clientData->is_paused = 0;
+    update_events (clientData);
+    pthread_mutex_unlock (&clientData->send_lock);
+
+    clientData->last_activity_ms = event_loop_now_ms ();
+
+    // Deliver what was already buffered before reading more
+    process_frames (clientData);
+}
+
+/** Send queued bytes once the socket is writable */
+static int flush_client(ClientData *clientData)
+{
+    int status;
+
+    pthread_mutex_lock (&clientData->send_lock);
+
+    status = send_queue_flush (&clientData->queue, clientData->socket_fd);
+
+    if (status >= 0)
+    {
+        update_events (clientData);
+    }
+
+    pthread_mutex_unlock (&clientData->send_lock);
+
+    return status;
+}
+
+static void on_client_event(void *ctx, uint32_t events)
+{
+    ClientData * clientData = (ClientData *) ctx;
+
+    if (clientData->socket_fd == 0)
+    {
+        // Closed earlier in the same dispatch round
+        return;
+    }
+
+    if ((events & EPOLLOUT) && (flush_client (clientData) < 0))
+    {
+        connection_lost (clientData);
+        return;
+    }
+
+    if (clientData->is_paused)
+    {
+        // Only writes, hang up and errors are reported while paused
+        if (events & (EPOLLHUP | EPOLLERR))
+        {
+            connection_lost (clientData);
+        }
+
+        return;
+    }
+
+    ssize_t bytesRcvd = frame_reader_recv (&clientData->reader, clientData->socket_fd, MSG_DONTWAIT);
+
+    if ((bytesRcvd < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+    {
+        return;
+    }
+
+    if (bytesRcvd <= 0)
+    {
+        // Some error on client or disconnected
+        connection_lost (clientData);
+        return;
+    }
+
+    clientData->last_activity_ms = event_loop_now_ms ();
+
+    process_frames (clientData);
+}
+
+static int admit_discovery(ServerHandler_t instance, in_addr_t ip)
+{
+    if (instance->config.discovery_reply_rate == 0)
+    {
+        return 1;
+    }
+
+    // Direct mapped; a colliding address starts over with a full bucket
+    uint32_t slot = (ntohl (ip) * 2654435761U) >> 24;
+    DiscoveryLimit * limit = &instance->discovery_limits[slot % DISCOVERY_LIMIT_SLOTS];
+    uint64_t nowUs = event_loop_now_us ();
+
+    if (limit->ip != ip)
+    {
+        limit->ip = ip;
+        token_bucket_init (
+            &limit->bucket,
+            instance->config.discovery_reply_rate,
+            instance->config.discovery_reply_burst,
+            nowUs);
+    }
+
+    return token_bucket_consume (&limit->bucket, 1, nowUs);
+}
+
+static uint64_t loop_waited_us(ServerHandler_t instance)
+{
+    EventLoopStats stats;
+
+    event_loop_get_stats (instance->loop, &stats);
+
+    return stats.sleep_us + stats.spin_us;
+}
+
+static void update_advertisement(ServerHandler_t instance)
+{
+    AdvertisingInfo * info = (AdvertisingInfo *) &instance->advertise_message[sizeof(ADVERTISING_RESPONSE)];
+    uint64_t nowUs = event_loop_now_us ();
+    uint64_t elapsedUs = nowUs - instance->load_sample_us;
+
+    if (elapsedUs >= LOAD_WINDOW_US)
+    {
+        // Busy is whatever the loop did not spend waiting for events
+        uint64_t waitedUs = loop_waited_us (instance);
+        uint64_t idleUs = waitedUs - instance->load_waited_us;
+
+        instance->load = (idleUs >= elapsedUs) ? 0 : (uint8_t) (100 - (idleUs * 100) / elapsedUs);
+        instance->load_sample_us = nowUs;
+        instance->load_waited_us = waitedUs;
+    }
+
+    info->nb_clients = htons (instance->nb_clients);
+    info->load       = instance->load;
+}
+
+static void answer_discovery(
+    void *ctx,
+    int fd,
+    const void *request,
+    ssize_t size,
+    const struct sockaddr_in *from)
+{
+    ServerHandler_t instance = (ServerHandler_t) ctx;
+
+    if ((size == sizeof(ADVERTISING_REQUEST)) &&
+        (memcmp (request, ADVERTISING_REQUEST, sizeof(ADVERTISING_REQUEST)) == 0) &&
+        admit_discovery (instance, from->sin_addr.s_addr))
+    {
+        update_advertisement (instance);
+
+        sendto (
+            fd,
+            instance->advertise_message,
+            sizeof(instance->advertise_message),
+            0,
+            (const struct sockaddr *) from,
+            sizeof(*from));
+    }
+}
+
+static void on_advertise_event(void *ctx, uint32_t events)
+{
+    ServerHandler_t instance = (ServerHandler_t) ctx;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char incoming[sizeof(instance->advertise_message)];
+
+    if (instance->advertise_fd == 0)
+    {
+        // Closed earlier in the same dispatch round
+        return;
+    }
+
+    int bytesTransfered = recvfrom (
+        instance->advertise_fd,
+        incoming,
+        sizeof(incoming),
+        MSG_DONTWAIT,
+        (struct sockaddr *) &addr,
+        &addrlen);
+
+    if (bytesTransfered < 0)
+    {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+        {
+            server_fatal_error (instance);
+        }
+    }
+    else
+    {
+        answer_discovery (instance, instance->advertise_fd, incoming, bytesTransfered, &addr);
+    }
+}
+
+static void on_game_event(void *ctx, uint32_t events)
+{
+    ServerHandler_t instance = (ServerHandler_t) ctx;
+    struct sockaddr_in isa;
+    socklen_t addr_size = sizeof(isa);
+
+    if (instance->game_fd == 0)
+    {
+        // Closed earlier in the same dispatch round
+        return;
+    }
+
+    int clientId = find_free_client (instance);
+
+    if (clientId == instance->config.max_nb_clients)
+    {
+        // Server is full, stop advertising
+        server_stop_advertising (instance);
+        return;
+    }
+
+    int clientFd = accept (
+        instance->game_fd,
+        (struct sockaddr*) &isa,
+        &addr_size);
+
+    // Sends never block the network thread, see send_frame_encoded
+    if ((clientFd != -1) && (fcntl (clientFd, F_SETFL, O_NONBLOCK) != 0))
+    {
+        close (clientFd);
+        return;
+    }
+
+    if (clientFd == -1)
+    {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+        {
+            // Stop accepting client
+            server_stop_advertising (instance);
+        }
+
+        return;
+    }
+
+    DEBUG ("Server: State update[Client connected]\n");
+
+    ClientData * clientData = &instance->client_data[clientId];
+
+    clientData->id               = clientId;
+    clientData->handler          = instance;
+    clientData->last_activity_ms = event_loop_now_ms ();
+    clientData->rtt_us           = 0;
+    frame_reader_reset (&clientData->reader);
+    token_bucket_init (
+        &clientData->msg_bucket,
+        instance->config.client_msg_rate,
+        instance->config.client_msg_burst,
+        event_loop_now_us ());
+    token_bucket_init (
+        &clientData->byte_bucket,
+        instance->config.client_byte_rate,
+        instance->config.client_byte_burst,
+        event_loop_now_us ());
+
+    if (instance->config.busy_poll_us != 0)
+    {
+        int busyPollUs = instance->config.busy_poll_us;
+
+        // Spin in the driver instead of waiting for the interrupt; raising
+        // it above net.core.busy_read needs CAP_NET_ADMIN
+        setsockopt (clientFd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs));
+    }
+
+    pthread_mutex_lock (&clientData->send_lock);
+    clientData->socket_fd  = clientFd;
+    clientData->is_removed   = 0;
+    clientData->is_multicast = 0;
+    clientData->snapshot_acked = 0;
+    clientData->is_pending   = clientData->replay.data != NULL;
+    clientData->events       = EPOLLIN;
+    pthread_mutex_unlock (&clientData->send_lock);
+
+    if (event_loop_add (instance->loop, clientFd, EPOLLIN, &clientData->source) != 0)
+    {
+        close_client (clientData, 0);
+        return;
+    }
+
+    schedule_client_timers (clientData);
+
+    // Pending connections are announced once they open a new session; a
+    // resumed one frees its slot again
+    if (!clientData->is_pending)
+    {
+        announce_client (clientData);
+    }
+}
+
+static void bind_memory_task(void *param)
+{
+    ServerHandler_t instance = (ServerHandler_t) param;
+
+    thread_bind_memory (instance->client_data, sizeof(ClientData) * instance->config.max_nb_clients);
+
+    if (instance->replay_buffers != NULL)
+    {
+        thread_bind_memory (
+            instance->replay_buffers,
+            (size_t) instance->config.resume_buffer_size * instance->config.max_nb_clients);
+    }
+}
+
+static void *network_thread(void *param)
+{
+    ServerHandler_t instance = (ServerHandler_t) param;
+
+    bind_memory_task (instance);
+
+    DEBUG ("Server: State update[Start listening for clients]\n");
+
+    event_loop_run (instance->loop);
+
+    DEBUG ("Server: State update[Network thread stopped]\n");
+
+    if (instance->release_on_exit)
+    {
+        // Deinitialized from a callback, nobody joins
+        pthread_detach (pthread_self ());
+        server_release (instance);
+    }
+
+    return NULL;
+}
+
+static int setup_game_socket(ServerHandler_t instance)
+{
+    struct sockaddr_in sa = {0};
+    int reuse = 1;
+
+    instance->game_fd = socket (PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    if (instance->game_fd == -1)
+    {
+        instance->game_fd = 0;
+        return -1;
+    }
+
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = INADDR_ANY;
+    sa.sin_port = htons (instance->config.game_port);
+
+    setsockopt (instance->game_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (instance->config.steer_incoming_cpu)
+    {
+        int cpu = (instance->config.runtime != NULL) ?
+            runtime_loop_cpu (instance->config.runtime, instance->loop) :
+            thread_pinned_cpu (&instance->config.network_thread);
+
+        if (cpu >= 0)
+        {
+            setsockopt (instance->game_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+            setsockopt (instance->game_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+        }
+    }
+
+    if ((bind (instance->game_fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) ||
+        (listen (instance->game_fd, instance->config.max_nb_clients) == -1))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int setup_advertise_socket(ServerHandler_t instance)
+{
+    AdvertisingInfo * info = (AdvertisingInfo *) &instance->advertise_message[sizeof(ADVERTISING_RESPONSE)];
+    struct sockaddr_in addr = {0};
+    struct ip_mreq mreq;
+
+    // Prepare server advertise message, load fields are filled per reply
+    memcpy (&instance->advertise_message[0], ADVERTISING_RESPONSE, sizeof(ADVERTISING_RESPONSE));
+    memcpy (info->name, instance->config.name, strnlen (instance->config.name, MAX_NAME_LEN));
+    info->port           = htons (instance->config.game_port);
+    info->version        = ADVERTISING_VERSION;
+    info->max_nb_clients = htons (instance->config.max_nb_clients);
+    info->capabilities   = htonl (
+        ((uint32_t) instance->config.advertise_flags << 16) |
+        ((instance->config.resume_grace_ms != 0) ? ADVERTISING_CAP_RESUME : 0) |
+        ((instance->config.heartbeat_interval_ms != 0) ? ADVERTISING_CAP_HEARTBEAT : 0) |
+        ((instance->config.broadcast_ip[0] != 0) ? ADVERTISING_CAP_BROADCAST : 0));
+    instance->load_sample_us = event_loop_now_us ();
+    instance->load_waited_us = loop_waited_us (instance);
+
+    if (instance->config.runtime != NULL)
+    {
+        // One socket per address and port answers for all instances
+        instance->discovery_listener.cb  = answer_discovery;
+        instance->discovery_listener.ctx = instance;
+
+        return runtime_discovery_add (
+            instance->config.runtime,
+            (const char *) instance->config.ip,
+            instance->config.advertise_port,
+            &instance->discovery_listener);
+    }
+
+    instance->advertise_fd = socket (AF_INET, SOCK_DGRAM, 0);
+    if (instance->advertise_fd == -1)
+    {
+        instance->advertise_fd = 0;
+        return -1;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_ANY);
+    addr.sin_port = htons (instance->config.advertise_port);
+
+    if (bind (instance->advertise_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        return -1;
+    }
+
+    mreq.imr_multiaddr.s_addr = inet_addr ((const char *) instance->config.ip);
+    mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+
+    return setsockopt (instance->advertise_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+}
+
+static int setup_broadcast_socket(ServerHandler_t instance)
+{
+    unsigned char loop = 1;
+
+    if (instance->config.broadcast_ip[0] == 0)
+    {
+        return 0;
+    }
+
+    instance->broadcast_fd = socket (AF_INET, SOCK_DGRAM, 0);
+
+    if (instance->broadcast_fd == -1)
+    {
+        instance->broadcast_fd = 0;
+        return -1;
+    }
+
+    instance->broadcast_group.sin_family = AF_INET;
+    instance->broadcast_group.sin_addr.s_addr = inet_addr (instance->config.broadcast_ip);
+    instance->broadcast_group.sin_port = htons (instance->config.broadcast_port);
+
+    // Clients on the server host receive the group too
+    setsockopt (instance->broadcast_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+    return 0;
+}
+
+static void start_batch_task(void *param)
+{
+    ServerHandler_t instance = (ServerHandler_t) param;
+
+    event_loop_add_flush (instance->loop, &instance->batch_flush);
+}
+
+static void start_broadcast_task(void *param)
+{
+    ServerHandler_t instance = (ServerHandler_t) param;
+
+    timer_wheel_schedule (event_loop_timers (instance->loop), &instance->broadcast_timer, BROADCAST_SYNC_MS);
+}
+
+ServerHandler server_init(ServerConfig *config)
+{
+    ssize_t sizeofClientData = sizeof(ClientData) * config->max_nb_clients;
+    ServerHandler_t handler = (ServerHandler_t) malloc (sizeof(ServerInfo));
+
+    if (handler == NULL)
+    {
+        return NULL;
+    }
+
+    bzero (handler, sizeof(ServerInfo));
+    handler->client_data = (ClientData*) thread_alloc_pages (sizeofClientData);
+
+    if (handler->client_data == NULL)
+    {
+        free (handler);
+        return NULL;
+    }
+
+    bzero (handler->client_data, sizeofClientData);
+
+    handler->config = *config;
+    handler->is_advertising = 1;
+
+    if (handler->config.client_send_queue_size == 0)
+    {
+        handler->config.client_send_queue_size = DEFAULT_SEND_QUEUE;
+    }
+
+    if (config->resume_grace_ms != 0)
+    {
+        if (handler->config.resume_buffer_size == 0)
+        {
+            handler->config.resume_buffer_size = DEFAULT_RESUME_BUFFER;
+        }
+
+        handler->replay_buffers = (uint8_t *) thread_alloc_pages (
+            (size_t) handler->config.resume_buffer_size * config->max_nb_clients);
+    }
+
+    pthread_rwlock_init (&handler->groups_lock, NULL);
+    pthread_mutex_init (&handler->broadcast_lock, NULL);
+    pthread_mutex_init (&handler->snapshot_lock, NULL);
+    timer_init (&handler->broadcast_timer, on_broadcast_timer, handler);
+
+    if (config->broadcast_ip[0] != 0)
+    {
+        size_t historySize = (config->broadcast_history_size != 0) ?
+            config->broadcast_history_size : DEFAULT_BROADCAST_HISTORY;
+
+        frame_ring_init (&handler->broadcast_history, (uint8_t *) malloc (historySize), historySize);
+    }
+
+    if (config->snapshot_size != 0)
+    {
+        handler->snapshots = (uint8_t *) malloc ((size_t) SNAPSHOT_HISTORY * config->snapshot_size);
+    }
+    if (config->receive_batch_cb != NULL)
+    {
+        if (handler->config.receive_batch_size == 0)
+        {
+            handler->config.receive_batch_size = DEFAULT_RECEIVE_BATCH;
+        }
+
+        handler->batch = (ServerMessage *) malloc (sizeof(ServerMessage) * handler->config.receive_batch_size);
+        handler->batch_flush.cb  = deliver_batch;
+        handler->batch_flush.ctx = handler;
+    }
+
+    handler->groups = (ClientGroup *) calloc (config->max_nb_groups, sizeof(ClientGroup));
+
+    for (ClientId clientId = 0; clientId < config->max_nb_clients; ++clientId)
+    {
+        ClientData * clientData = &handler->client_data[clientId];
+
+        pthread_mutex_init (&clientData->send_lock, NULL);
+        clientData->source.cb  = on_client_event;
+        clientData->source.ctx = clientData;
+        timer_init (&clientData->idle_timer, on_idle_timer, clientData);
+        timer_init (&clientData->heartbeat_timer, on_heartbeat_timer, clientData);
+        timer_init (&clientData->resume_timer, on_resume_timer, clientData);
+        timer_init (&clientData->grace_timer, on_grace_timer, clientData);
+
+        if (handler->replay_buffers != NULL)
+        {
+            frame_ring_init (
+                &clientData->replay,
+                &handler->replay_buffers[(size_t) clientId * handler->config.resume_buffer_size],
+                handler->config.resume_buffer_size);
+        }
+    }
+
+    if (config->runtime != NULL)
+    {
+        handler->loop = runtime_attach (config->runtime);
+    }
+    else
+    {
+        handler->loop = event_loop_create (
+            (config->timer_tick_ms != 0) ? config->timer_tick_ms : DEFAULT_TIMER_TICK_MS);
+
+        if (handler->loop != NULL)
+        {
+            event_loop_set_busy_poll (handler->loop, config->busy_poll_us);
+        }
+    }
+
+    handler->advertise_source.cb  = on_advertise_event;
+    handler->advertise_source.ctx = handler;
+    handler->game_source.cb       = on_game_event;
+    handler->game_source.ctx      = handler;
+
+    if (config->capture_path != NULL)
+    {
+        handler->capture = capture_open (config->capture_path);
+    }
+
+    if ((handler->loop == NULL) ||
+        ((handler->groups == NULL) && (config->max_nb_groups != 0)) ||
+        ((handler->capture == NULL) && (config->capture_path != NULL)) ||
+        ((handler->replay_buffers == NULL) && (config->resume_grace_ms != 0)) ||
+        ((handler->broadcast_history.data == NULL) && (config->broadcast_ip[0] != 0)) ||
+        ((handler->snapshots == NULL) && (config->snapshot_size != 0)) ||
+        ((handler->batch == NULL) && (config->receive_batch_cb != NULL)) ||
+        (setup_broadcast_socket (handler) != 0) ||
+        (setup_advertise_socket (handler) != 0) ||
+        (setup_game_socket (handler) != 0) ||
+        ((handler->advertise_fd != 0) &&
+            (event_loop_add (handler->loop, handler->advertise_fd, EPOLLIN, &handler->advertise_source) != 0)) ||
+        (event_loop_add (handler->loop, handler->game_fd, EPOLLIN, &handler->game_source) != 0))
+    {
+        server_init_error (handler);
+        return NULL;
+    }
+
+    handler->is_initialized = 1;
+
+    if ((config->runtime == NULL) &&
+        thread_create (&handler->network_thread, &config->network_thread, network_thread, handler))
+    {
+        server_init_error (handler);
+        return NULL;
+    }
+
+    if (config->runtime != NULL)
+    {
+        event_loop_call (handler->loop, bind_memory_task, handler);
+    }
+
+    if (handler->broadcast_fd != 0)
+    {
+        event_loop_call (handler->loop, start_broadcast_task, handler);
+    }
+
+    if (handler->batch != NULL)
+    {
+        event_loop_call (handler->loop, start_batch_task, handler);
+    }
+
+    DEBUG ("Server: State update[Initialized]\n");
+
+    return handler;
+}
+
+static void free_scheduled(ScheduledSend *scheduled)
+{
+    buffer_release (scheduled->buffer);
+    buffer_release (scheduled->block);
+}
+
+static void release_task(void *param)
+{
+    ServerHandler_t instance = (ServerHandler_t) param;
+
+    server_stop_advertising (instance);
+
+    // Close all client sockets, no notification on deinit
+    for (ClientId clientId = 0; clientId < instance->config.max_nb_clients; ++clientId)
+    {
+        if ((instance->client_data[clientId].socket_fd != 0) || instance->client_data[clientId].is_detached)
+        {
+            close_client (&instance->client_data[clientId], 0);
+        }
+    }
+
+    timer_wheel_cancel (event_loop_timers (instance->loop), &instance->broadcast_timer);
+    event_loop_remove_flush (instance->loop, &instance->batch_flush);
+
+    // Undelivered messages are dropped, like the connections
+    while (instance->batch_count != 0)
+    {
+        buffer_release (instance->batch[--instance->batch_count].message);
+    }
+
+    while (instance->scheduled != NULL)
+    {
+        ScheduledSend *scheduled = instance->scheduled;
+
+        instance->scheduled = scheduled->next;
+        timer_wheel_cancel (event_loop_timers (instance->loop), &scheduled->timer);
+        free_scheduled (scheduled);
+    }
+}
+
+void * server_get_user_data(ServerHandler handler)
+{
+    return ((ServerHandler_t) handler)->config.user_data;
+}
+
+static void release_instance_task(void *param)
+{
+    server_release ((ServerHandler_t) param);
+}
+
+void server_deinit(ServerHandler handler)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    int isNetworkThread = event_loop_is_current (instance->loop);
+
+    instance->is_initialized = 0;
+
+    event_loop_call (instance->loop, release_task, instance);
+
+    if (instance->config.runtime != NULL)
+    {
+        // The shared loop keeps running; when deinitialized from a callback
+        // the instance is released after the current dispatch round
+        if (!isNetworkThread)
+        {
+            server_release (instance);
+        }
+        else if (event_loop_post (instance->loop, release_instance_task, instance) != 0)
+        {
+            DEBUG ("Server: State update[Instance leaked on deinit]\n");
+        }
+
+        return;
+    }
+
+    event_loop_stop (instance->loop);
+
+    if (isNetworkThread)
+    {
+        // Released once the loop unwinds
+        instance->release_on_exit = 1;
+    }
+    else
+    {
+        pthread_join (instance->network_thread, NULL);
+        server_release (instance);
+    }
+}
+
+static void stop_advertising_task(void *param)
+{
+    ServerHandler_t instance = (ServerHandler_t) param;
+
+    instance->is_advertising = 0;
+
+    if (instance->config.runtime != NULL)
+    {
+        runtime_discovery_remove (instance->config.runtime, &instance->discovery_listener);
+    }
+
+    if (instance->advertise_fd != 0)
+    {
+        DEBUG("Server: State update[Stop advertising]\n");
+
+        event_loop_remove (instance->loop, instance->advertise_fd);
+        close (instance->advertise_fd);
+        instance->advertise_fd = 0;
+    }
+
+    if (instance->game_fd != 0)
+    {
+        DEBUG("Server: State update[Stop listening]\n");
+
+        event_loop_remove (instance->loop, instance->game_fd);
+        close (instance->game_fd);
+        instance->game_fd = 0;
+    }
+}
+
+Status server_stop_advertising(ServerHandler handler)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+
+    event_loop_call (instance->loop, stop_advertising_task, instance);
+
+    return E_OK;
+}
+
+static void remove_detached_task(void *param)
+{
+    ClientData * clientData = (ClientData *) param;
+
+    if (clientData->is_detached)
+    {
+        close_client (clientData, 1);
+    }
+}
+
+Status server_remove_client(ServerHandler handler, ClientId clientId)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    Status status = E_NOT_INITIALIZED;
+
+    if (instance->is_initialized != 0)
+    {
+        const int isValidClientId = clientId < instance->config.max_nb_clients;
+        status = E_NOT_MANAGED;
+
+        if (isValidClientId)
+        {
+            ClientData * clientData = &instance->client_data[clientId];
+
+            pthread_mutex_lock (&clientData->send_lock);
+
+            if (clientData->socket_fd != 0)
+            {
+                DEBUG("Server: State update[Removing client %d]\n", clientId);
+
+                // The network thread releases the slot on end of stream
+                clientData->is_removed = 1;
+                shutdown (clientData->socket_fd, SHUT_RDWR);
+                status = E_OK;
+            }
+            else if (clientData->is_detached &&
+                (event_loop_post (instance->loop, remove_detached_task, clientData) == 0))
+            {
+                DEBUG("Server: State update[Removing detached client %d]\n", clientId);
+
+                // Also refuses a resume arriving before the task runs
+                clientData->is_removed = 1;
+                status = E_OK;
+            }
+
+            pthread_mutex_unlock (&clientData->send_lock);
+        }
+    }
+
+    return status;
+}
+
+static Status send_encoded_to_client(
+    ClientData *clientData,
+    const uint8_t *header,
+    void * buffer,
+    ssize_t bufferSize,
+    int isBroadcast)
+{
+    Status status = E_NOT_MANAGED;
+
+    pthread_mutex_lock (&clientData->send_lock);
+
+    if (isBroadcast && clientData->is_multicast)
+    {
+        // Sent once to the broadcast group, repaired on request
+        status = E_OK;
+    }
+    else if ((clientData->socket_fd != 0) && !clientData->is_pending)
+    {
+        status = (send_frame_encoded (clientData, header, buffer, bufferSize) < 0) ?
+            E_ERR_ON_SEND : E_OK;
+    }
+
+    if ((clientData->replay.data != NULL) &&
+        !(isBroadcast && clientData->is_multicast) &&
+        ((clientData->socket_fd != 0) ? !clientData->is_pending : clientData->is_detached))
+    {
+        // Also covers a connection that just dropped; replayed on resumption
+        frame_ring_append (&clientData->replay, header, buffer, bufferSize);
+        status = E_OK;
+    }
+
+    if ((status == E_OK) && (clientData->handler->capture != NULL))
+    {
+        capture_record (clientData->handler->capture, CAPTURE_SEND, clientData->id, buffer, bufferSize);
+    }
+
+    pthread_mutex_unlock (&clientData->send_lock);
+
+    return status;
+}
+
+Status server_send_message(ServerHandler handler, void * buffer, ssize_t bufferSize)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    Status status = E_NOT_INITIALIZED;
+    uint8_t header[FRAME_HEADER_LEN];
+
+    if (instance->is_initialized != 0)
+    {
+        // Repairs carry a BroadcastHeader ahead of the message, within one frame
+        ssize_t maxSize = (instance->broadcast_fd != 0) ?
+            (ssize_t) (MAX_MESSAGE_LEN - sizeof(BroadcastHeader)) : MAX_MESSAGE_LEN;
+
+        if ((bufferSize < 0) || (bufferSize > maxSize))
+        {
+            return E_ERR_ON_SEND;
+        }
+
+        DEBUG("Server: State update[Sending broadcast message]\n");
+
+        frame_encode_header (header, FRAME_DATA, bufferSize);
+
+        if (instance->broadcast_fd != 0)
+        {
+            // Held across the connections so each client gets every
+            // message from the group or its connection, never both
+            pthread_mutex_lock (&instance->broadcast_lock);
+            frame_ring_append (&instance->broadcast_history, header, buffer, bufferSize);
+            send_datagram (instance, BROADCAST_DATA, buffer, bufferSize);
+        }
+
+        for (ClientId clientId = 0; clientId < instance->config.max_nb_clients; ++clientId)
+        {
+            send_encoded_to_client (&instance->client_data[clientId], header, buffer, bufferSize, 1);
+        }
+
+        if (instance->broadcast_fd != 0)
+        {
+            pthread_mutex_unlock (&instance->broadcast_lock);
+        }
+
+        status = E_OK;
+    }
+
+    return status;
+}
+
+Status server_send_message_to_client(
+    ServerHandler handler,
+    ClientId clientId,
+    void * buffer,
+    ssize_t bufferSize)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    Status status = E_NOT_INITIALIZED;
+    uint8_t header[FRAME_HEADER_LEN];
+
+    if (instance->is_initialized != 0)
+    {
+        const int isValidClientId = clientId < instance->config.max_nb_clients;
+        status = E_NOT_MANAGED;
+
+        if ((bufferSize < 0) || (bufferSize > MAX_MESSAGE_LEN))
+        {
+            status = E_ERR_ON_SEND;
+        }
+        else if (isValidClientId)
+        {
+            DEBUG("Server: State update[Sending message to client %d]\n", clientId);
+
+            frame_encode_header (header, FRAME_DATA, bufferSize);
+            status = send_encoded_to_client (&instance->client_data[clientId], header, buffer, bufferSize, 0);
+        }
+    }
+
+    return status;
+}
+
+static uint8_t *snapshot_state(ServerHandler_t instance, uint32_t sequence)
+{
+    return instance->snapshots + (size_t) (sequence % SNAPSHOT_HISTORY) * instance->config.snapshot_size;
+}
 
-static void server_fatal_error(ServerHandler_t instance)
+/** Get the baseline to encode the last snapshot against, 0 if the acknowledged one is gone */
+static uint32_t snapshot_baseline(ServerHandler_t instance, uint32_t acked)
 {
-    if (instance->config.error_cb != NULL)
+    if ((acked != 0) &&
+        (acked < instance->snapshot_sequence) &&
+        (instance->snapshot_sequence - acked < SNAPSHOT_HISTORY) &&
+        (instance->snapshot_sequences[acked % SNAPSHOT_HISTORY] == acked))
     {
-        instance->config.error_cb (instance);
+        return acked;
     }
 
-    server_deinit (instance);
+    return 0;
 }
 
-void *advertise_thread(void *param)
+static int encode_snapshot(ServerHandler_t instance, SnapshotEncoding *encoding, uint32_t baseline)
 {
-    ServerHandler_t instance = (ServerHandler_t) param;
-    uint16_t port = htons (instance->config.game_port);
-    const int offset = sizeof(ADVERTISING_RESPONSE);
-    char message[MAX_NAME_LEN + sizeof(port) + sizeof(ADVERTISING_RESPONSE)] = {0};
-    struct sockaddr_in addr;
-    socklen_t addrlen = sizeof(addr);
+    uint32_t sequence = instance->snapshot_sequence;
+    uint32_t size = instance->snapshot_sizes[sequence % SNAPSHOT_HISTORY];
+    uint32_t baselineSize = (baseline != 0) ? instance->snapshot_sizes[baseline % SNAPSHOT_HISTORY] : 0;
+    const uint8_t *base = (baseline != 0) ? snapshot_state (instance, baseline) : NULL;
+    uint32_t offset = 0;
 
-    // Prepare server advertise message
-    memcpy (&message[0], ADVERTISING_RESPONSE, offset);
-    memcpy (&message[offset],     &port,       2);
-    memcpy (&message[offset + 2], instance->config.name, strlen(instance->config.name));
+    encoding->sequence = 0;
+    encoding->length   = 0;
 
-    while (1)
+    // At least one frame, even for an empty state
+    do
     {
-        char incoming[sizeof(message)];
-        int bytesTransfered = recvfrom (
-            instance->advertise_fd,
-            incoming,
-            sizeof(incoming),
-            0,
-            (struct sockaddr *) &addr,
-            &addrlen);
+        SnapshotHeader header;
+        uint8_t *frame;
+        size_t length;
 
-        if (bytesTransfered < 0)
+        if (encoding->capacity - encoding->length < FRAME_HEADER_LEN + MAX_MESSAGE_LEN)
         {
-            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-            {
-                // Timeout
-                continue;
-            }
-            else if (instance->is_advertising)
-            {
-                server_fatal_error (instance);
-                return NULL;
-            }
-            else
+            size_t capacity = encoding->capacity + FRAME_HEADER_LEN + MAX_MESSAGE_LEN;
+            uint8_t *frames = (uint8_t *) realloc (encoding->frames, capacity);
+
+            if (frames == NULL)
             {
-                // Normal exit on stop advertising
-                break;
+                return -1;
             }
+
+            encoding->frames   = frames;
+            encoding->capacity = capacity;
         }
-        else if ((bytesTransfered == sizeof(ADVERTISING_REQUEST)) &&
-            (strcmp(incoming, ADVERTISING_REQUEST) == 0))
-        {
-            sendto (
-                instance->advertise_fd,
-                message,
-                sizeof(message),
-                0,
-                (struct sockaddr *) &addr,
-                addrlen);
-        }
+
+        frame = encoding->frames + encoding->length;
+
+        header.sequence = htonl (sequence);
+        header.baseline = htonl (baseline);
+        header.size     = htonl (size);
+        header.offset   = htonl (offset);
+        memcpy (frame + FRAME_HEADER_LEN, &header, sizeof(header));
+
+        length = sizeof(header) + snapshot_encode (
+            frame + FRAME_HEADER_LEN + sizeof(header),
+            MAX_MESSAGE_LEN - sizeof(header),
+            snapshot_state (instance, sequence),
+            size,
+            base,
+            baselineSize,
+            &offset);
+
+        frame_encode_header (frame, FRAME_SNAPSHOT, length);
+        encoding->length += FRAME_HEADER_LEN + length;
     }
+    while (offset < size);
 
-    return NULL;
+    encoding->sequence = sequence;
+    encoding->baseline = baseline;
+
+    return 0;
 }
 
-void *client_thread(void *param)
+/** Get the last snapshot encoded against a baseline, encoding it once per snapshot */
+static SnapshotEncoding *find_encoding(ServerHandler_t instance, uint32_t baseline)
 {
-    ClientData * clientData = (ClientData *) param;
-    char message[1024];
+    SnapshotEncoding *encodings = instance->snapshot_encodings;
+    SnapshotEncoding *unused = &encodings[baseline % SNAPSHOT_ENCODINGS];
 
-    pthread_detach(pthread_self());
-
-    while (1)
+    for (int encoding = 0; encoding < SNAPSHOT_ENCODINGS; ++encoding)
     {
-        int bytesRcvd = recv (clientData->socket_fd, message, sizeof(message), 0);
-
-        if (bytesRcvd <= 0)
+        if (encodings[encoding].sequence != instance->snapshot_sequence)
         {
-            close (clientData->socket_fd);
-            clientData->socket_fd = 0;
+            unused = &encodings[encoding];
+        }
+        else if (encodings[encoding].baseline == baseline)
+        {
+            return &encodings[encoding];
+        }
+    }
 
-            // Some error on client or disconnected. Exit
-            if (clientData->handler->config.client_disconnected_cb != NULL)
-            {
-                clientData->handler->config.client_disconnected_cb (clientData->handler, clientData->id);
-            }
+    return (encode_snapshot (instance, unused, baseline) == 0) ? unused : NULL;
+}
 
-            break;
-        }
+/** Send back to back frames. Called with send_lock held. */
+static int send_frames(ClientData *clientData, const uint8_t *frames, size_t length)
+{
+    size_t offset = 0;
+
+    while (offset < length)
+    {
+        uint32_t payloadLength;
 
-        if (clientData->handler->config.receive_cb != NULL)
+        memcpy (&payloadLength, frames + offset, sizeof(payloadLength));
+        payloadLength = ntohl (payloadLength);
+
+        if (send_frame_encoded (clientData, frames + offset, frames + offset + FRAME_HEADER_LEN, payloadLength) < 0)
         {
-            clientData->handler->config.receive_cb (
-                clientData->handler,
-                clientData->id,
-                message,
-                bytesRcvd);
+            return -1;
         }
+
+        offset += FRAME_HEADER_LEN + payloadLength;
     }
 
-    pthread_exit(NULL);
+    return 0;
 }
 
-void *game_thread(void *param)
+Status server_send_snapshot(ServerHandler handler, const void *state, uint32_t size)
 {
-    ServerHandler_t instance = (ServerHandler_t) param;
-    struct sockaddr_in sa = {0};
-
-    instance->game_fd = socket (PF_INET, SOCK_STREAM, 0);
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    Status status = E_OK;
 
-    if (instance->game_fd == -1)
+    if ((instance->is_initialized == 0) || (instance->snapshots == NULL))
     {
-        instance->game_fd = 0;
-        server_fatal_error (instance);
-        return NULL;
+        return E_NOT_INITIALIZED;
     }
 
-    sa.sin_family = AF_INET;
-    sa.sin_addr.s_addr = INADDR_ANY;
-    sa.sin_port = instance->config.game_port;
-
-    if (bind (instance->game_fd, (struct sockaddr *) &sa, sizeof(sa)) == -1)
+    if (size > instance->config.snapshot_size)
     {
-        server_fatal_error (instance);
-        return NULL;
+        return E_NOT_MANAGED;
     }
 
-    listen (instance->game_fd, instance->config.max_nb_clients);
+    pthread_mutex_lock (&instance->snapshot_lock);
 
-    DEBUG ("Server: State update[Start listening for clients]\n");
+    uint32_t sequence = ++instance->snapshot_sequence;
 
-    while (1)
+    memcpy (snapshot_state (instance, sequence), state, size);
+    instance->snapshot_sequences[sequence % SNAPSHOT_HISTORY] = sequence;
+    instance->snapshot_sizes[sequence % SNAPSHOT_HISTORY] = size;
+
+    for (ClientId clientId = 0; clientId < instance->config.max_nb_clients; ++clientId)
     {
-        struct sockaddr_in isa;
-        pthread_t          threadId;
-        socklen_t          addr_size = sizeof(isa);
-        int                clientId  = 0;
+        ClientData *clientData = &instance->client_data[clientId];
+        uint32_t acked = __atomic_load_n (&clientData->snapshot_acked, __ATOMIC_RELAXED);
 
-        // Check for free client slot
-        for (clientId = 0; clientId < instance->config.max_nb_clients; ++clientId)
+        pthread_mutex_lock (&clientData->send_lock);
+
+        if ((clientData->socket_fd != 0) && !clientData->is_pending && (clientData->queue.length == 0))
         {
-            if (instance->client_data[clientId].socket_fd == 0)
+            // Clients acknowledging the same snapshot share one encoding; a
+            // client still sending an earlier one skips to the next
+            SnapshotEncoding *encoding = find_encoding (instance, snapshot_baseline (instance, acked));
+
+            if ((encoding == NULL) ||
+                (send_frames (clientData, encoding->frames, encoding->length) != 0))
             {
-                break;
+                status = E_ERR_ON_SEND;
             }
         }
 
-        if (clientId == instance->config.max_nb_clients)
-        {
-            // Server is full, stop advertising
-            server_stop_advertising(instance);
-            break;
-        }
+        pthread_mutex_unlock (&clientData->send_lock);
+    }
 
-        int clientFd = accept (
-            instance->game_fd,
-            (struct sockaddr*) &isa,
-            &addr_size);
+    pthread_mutex_unlock (&instance->snapshot_lock);
 
-        if (clientFd == -1)
-        {
-            // Stop accepting client
-            server_stop_advertising(instance);
-            break;
-        }
+    return status;
+}
+
+MessageBuffer *server_alloc_buffer(ServerHandler handler, uint32_t capacity)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+
+    return (instance->is_initialized != 0) ? buffer_pool_alloc (capacity) : NULL;
+}
+
+Status server_send_buffer(ServerHandler handler, ClientId clientId, MessageBuffer *buffer)
+{
+    Status status;
+
+    if (clientId == SERVER_ALL_CLIENTS)
+    {
+        status = server_send_message (handler, buffer->data, buffer->size);
+    }
+    else
+    {
+        status = server_send_message_to_client (handler, clientId, buffer->data, buffer->size);
+    }
+
+    buffer_release (buffer);
+
+    return status;
+}
 
-        DEBUG ("Server: State update[Client connected]\n");
+Status server_get_client_rtt(ServerHandler handler, ClientId clientId, uint32_t *rttUs)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    Status status = E_NOT_INITIALIZED;
 
-        instance->client_data[clientId].id        = clientId;
-        instance->client_data[clientId].handler   = instance;
-        instance->client_data[clientId].socket_fd = clientFd;
+    if (instance->is_initialized != 0)
+    {
+        const int isValidClientId = clientId < instance->config.max_nb_clients;
+        const int isAvailableClient = isValidClientId &&
+            (instance->client_data[clientId].socket_fd != 0);
 
-        if (pthread_create (&threadId, NULL, client_thread, &instance->client_data[clientId]))
+        if (isAvailableClient)
         {
-            server_fatal_error (instance);
-            return NULL;
+            *rttUs = instance->client_data[clientId].rtt_us;
+            status = E_OK;
         }
-
-        if (instance->config.client_connected_cb != NULL)
+        else
         {
-            instance->config.client_connected_cb (instance, clientId);
+            status = E_NOT_MANAGED;
         }
     }
 
-    DEBUG ("Server: State update[Stop listening for clients]\n");
-
-    return NULL;
+    return status;
 }
 
-ServerHandler server_init(ServerConfig *config)
+Status server_get_poll_stats(ServerHandler handler, EventLoopStats *stats)
 {
-    ssize_t sizeofClientData = sizeof(ClientData) * config->max_nb_clients;
-    ServerHandler_t handler = (ServerHandler_t) malloc (sizeof(ServerInfo));
+    ServerHandler_t instance = (ServerHandler_t) handler;
 
-    if (handler == NULL)
+    if (instance->is_initialized == 0)
     {
-        return NULL;
+        return E_NOT_INITIALIZED;
     }
 
-    bzero (handler, sizeof(ServerInfo));
-    handler->client_data = (ClientData*) malloc (sizeofClientData);
+    event_loop_get_stats (instance->loop, stats);
 
-    if (handler->client_data == NULL)
+    return E_OK;
+}
+
+static void on_scheduled_timer(TimerEntry *timer, void *ctx)
+{
+    ScheduledSend * scheduled = (ScheduledSend *) ctx;
+    ServerHandler_t instance = scheduled->handler;
+
+    if (scheduled->client_id == SERVER_ALL_CLIENTS)
     {
-        free (handler);
-        return NULL;
+        server_send_message (instance, scheduled->buffer->data, scheduled->buffer->size);
+    }
+    else
+    {
+        server_send_message_to_client (instance, scheduled->client_id, scheduled->buffer->data,
+            scheduled->buffer->size);
     }
 
-    bzero (handler->client_data, sizeofClientData);
+    if (scheduled->period_ms != 0)
+    {
+        timer_wheel_schedule (event_loop_timers (instance->loop), timer, scheduled->period_ms);
+    }
+    else
+    {
+        server_cancel_scheduled (instance, scheduled->id);
+    }
+}
 
-    handler->advertise_fd = socket (AF_INET, SOCK_DGRAM, 0);
-    if (handler->advertise_fd == -1)
+static void schedule_task(void *param)
+{
+    ScheduledSend * scheduled = (ScheduledSend *) param;
+    ServerHandler_t instance = scheduled->handler;
+
+    if (instance->is_initialized == 0)
     {
-        handler->advertise_fd = 0;
-        server_fatal_error (handler);
-        return NULL;
+        free_scheduled (scheduled);
+        return;
     }
 
-    handler->config = *config;
-    handler->is_advertising = 1;
+    scheduled->next = instance->scheduled;
+    instance->scheduled = scheduled;
 
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl (INADDR_ANY);
-    addr.sin_port = htons (config->advertise_port);
+    timer_wheel_schedule (event_loop_timers (instance->loop), &scheduled->timer, scheduled->delay_ms);
+}
+
+ScheduleId server_schedule_buffer(
+    ServerHandler handler,
+    ClientId clientId,
+    MessageBuffer * buffer,
+    uint32_t delayMs,
+    uint32_t periodMs)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    MessageBuffer * block = NULL;
+    ScheduledSend * scheduled;
+    ScheduleId id;
 
-    if (bind (handler->advertise_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    if (instance->is_initialized != 0)
     {
-        server_fatal_error (handler);
-        return NULL;
+        // Pooled like the message, so scheduling does not allocate
+        block = buffer_pool_alloc (sizeof(ScheduledSend));
     }
 
-    struct ip_mreq mreq;
-    mreq.imr_multiaddr.s_addr = inet_addr ((const char *) config->ip);
-    mreq.imr_interface.s_addr = htonl (INADDR_ANY);
-
-    if ((setsockopt (handler->advertise_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) ||
-        (pthread_create (&handler->game_thread, NULL, game_thread, handler)) ||
-        (pthread_create (&handler->advertise_thread, NULL, advertise_thread, handler)))
+    if (block == NULL)
     {
-        server_fatal_error (handler);
-        return NULL;
+        buffer_release (buffer);
+        return 0;
     }
 
-    DEBUG ("Server: State update[Initialized]\n");
+    scheduled = (ScheduledSend *) block->data;
+    scheduled->block     = block;
+    scheduled->id        = __atomic_add_fetch (&instance->last_schedule_id, 1, __ATOMIC_RELAXED);
+    scheduled->client_id = clientId;
+    scheduled->delay_ms  = delayMs;
+    scheduled->period_ms = periodMs;
+    scheduled->handler   = instance;
+    scheduled->buffer    = buffer;
+    timer_init (&scheduled->timer, on_scheduled_timer, scheduled);
 
-    handler->is_initialized = 1;
+    scheduled->task.cb  = schedule_task;
+    scheduled->task.ctx = scheduled;
 
-    return handler;
+    // The network thread owns the schedule once posted
+    id = scheduled->id;
+    event_loop_post_task (instance->loop, &scheduled->task);
+
+    return id;
 }
 
-void server_deinit(ServerHandler handler)
+ScheduleId server_schedule_message(
+    ServerHandler handler,
+    ClientId clientId,
+    void * buffer,
+    ssize_t bufferSize,
+    uint32_t delayMs,
+    uint32_t periodMs)
 {
     ServerHandler_t instance = (ServerHandler_t) handler;
+    MessageBuffer * message;
 
-    instance->is_initialized = 0;
+    if ((instance->is_initialized == 0) || (bufferSize < 0) || (bufferSize > MAX_MESSAGE_LEN))
+    {
+        return 0;
+    }
 
-    server_stop_advertising (instance);
+    message = buffer_pool_alloc (bufferSize);
 
-    // Stop all client threads
-    for (ClientId clientId = 0; clientId < instance->config.max_nb_clients; ++clientId)
+    if (message == NULL)
+    {
+        return 0;
+    }
+
+    memcpy (message->data, buffer, bufferSize);
+    message->size = bufferSize;
+
+    return server_schedule_buffer (handler, clientId, message, delayMs, periodMs);
+}
+
+/** Cancel request executed on the network thread */
+typedef struct
+{
+    ServerHandler_t instance; ///< Server handler
+    ScheduleId id;            ///< Schedule to cancel
+    Status status;            ///< Result
+} CancelRequest;
+
+static void cancel_task(void *param)
+{
+    CancelRequest * request = (CancelRequest *) param;
+    ScheduledSend ** link = &request->instance->scheduled;
+
+    request->status = E_NOT_MANAGED;
+
+    while (*link != NULL)
     {
-        if (instance->client_data[clientId].socket_fd != 0)
+        ScheduledSend * scheduled = *link;
+
+        if (scheduled->id == request->id)
         {
-            close (instance->client_data[clientId].socket_fd);
-            instance->client_data[clientId].socket_fd = 0;
+            *link = scheduled->next;
+            timer_wheel_cancel (event_loop_timers (request->instance->loop), &scheduled->timer);
+            free_scheduled (scheduled);
 
-            // Client threads are detached. => No join
+            request->status = E_OK;
+            break;
         }
+
+        link = &scheduled->next;
     }
+}
 
-    free (instance);
+Status server_cancel_scheduled(ServerHandler handler, ScheduleId scheduleId)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    CancelRequest request = { instance, scheduleId, E_NOT_INITIALIZED };
+
+    if (instance->is_initialized != 0)
+    {
+        event_loop_call (instance->loop, cancel_task, &request);
+    }
+
+    return request.status;
 }
 
-Status server_stop_advertising(ServerHandler handler)
+static ClientGroup *get_group(ServerHandler_t instance, GroupId groupId)
+{
+    const int isValidGroupId = groupId < instance->config.max_nb_groups;
+
+    return (isValidGroupId && instance->groups[groupId].is_used) ? &instance->groups[groupId] : NULL;
+}
+
+GroupId server_group_create(ServerHandler handler)
 {
     ServerHandler_t instance = (ServerHandler_t) handler;
+    GroupId groupId = SERVER_INVALID_GROUP;
 
-    int advertisingFd = instance->advertise_fd;
-    int gameFd        = instance->game_fd;
+    if (instance->is_initialized == 0)
+    {
+        return groupId;
+    }
 
-    instance->is_advertising = 0;
+    pthread_rwlock_wrlock (&instance->groups_lock);
 
-    if (advertisingFd != 0)
+    for (GroupId id = 0; id < instance->config.max_nb_groups; ++id)
     {
-        DEBUG("Server: State update[Stop advertising]\n");
+        ClientGroup * group = &instance->groups[id];
 
-        instance->advertise_fd = 0;
-        shutdown (advertisingFd, SHUT_RDWR);
+        if (!group->is_used)
+        {
+            uint16_t maxClients = instance->config.max_nb_clients;
 
-        pthread_join (instance->advertise_thread, NULL);
+            // Members and positions share one allocation
+            group->members = (uint16_t *) malloc (2 * maxClients * sizeof(uint16_t));
 
-        DEBUG("Server: State update[Advertising stopped]\n");
+            if (group->members != NULL)
+            {
+                group->positions = &group->members[maxClients];
+                memset (group->positions, 0xFF, maxClients * sizeof(uint16_t));
+                group->count = 0;
+                group->is_used = 1;
+
+                groupId = id;
+            }
+
+            break;
+        }
     }
 
-    if (gameFd != 0)
+    pthread_rwlock_unlock (&instance->groups_lock);
+
+    return groupId;
+}
+
+Status server_group_destroy(ServerHandler handler, GroupId groupId)
+{
+    ServerHandler_t instance = (ServerHandler_t) handler;
+    Status status = E_NOT_INITIALIZED;
+
+    if (instance->is_initialized != 0)
     {
-        DEBUG("Server: State update[Stop listening]\n");
+        pthread_rwlock_wrlock (&instance->groups_lock);
 
-        instance->game_fd = 0;
-        shutdown (gameFd, SHUT_RDWR);
+        ClientGroup * group = get_group (instance, groupId);
+        status = E_NOT_MANAGED;
 
-        pthread_join (instance->game_thread, NULL);
+        if (group != NULL)
+        {
+            free (group->members);
+            group->members = NULL;
+            group->positions = NULL;
+            group->is_used = 0;
+
+            status = E_OK;
+        }
 
-        DEBUG("Server: State update[Listening stopped]\n");
+        pthread_rwlock_unlock (&instance->groups_lock);
     }
 
-    return E_OK;
+    return status;
 }
 
-Status server_remove_client(ServerHandler handler, ClientId clientId)
+Status server_group_add(ServerHandler handler, GroupId groupId, ClientId clientId)
 {
     ServerHandler_t instance = (ServerHandler_t) handler;
     Status status = E_NOT_INITIALIZED;
@@ -361,74 +2392,100 @@ Status server_remove_client(ServerHandler handler, ClientId clientId)
     if (instance->is_initialized != 0)
     {
         const int isValidClientId = clientId < instance->config.max_nb_clients;
-        const int isAvailableClient = isValidClientId &&
-            (instance->client_data[clientId].socket_fd != 0);
+        int isAnnounced = 0;
 
-        if (isAvailableClient)
-        {
-            DEBUG("Server: State update[Removing client %d]\n", clientId);
+        pthread_rwlock_wrlock (&instance->groups_lock);
 
-            close (instance->client_data[clientId].socket_fd);
-            instance->client_data[clientId].socket_fd = 0;
+        ClientGroup * group = get_group (instance, groupId);
+        status = E_NOT_MANAGED;
+
+        if (isValidClientId)
+        {
+            ClientData * clientData = &instance->client_data[clientId];
 
-            // Client threads are detached. => No join
+            // Pending clients have no session yet and leave no group when closed
+            pthread_mutex_lock (&clientData->send_lock);
+            isAnnounced = ((clientData->socket_fd != 0) || clientData->is_detached) && !clientData->is_pending;
+            pthread_mutex_unlock (&clientData->send_lock);
         }
-        else
+
+        if ((group != NULL) && isAnnounced)
         {
-            status = E_NOT_MANAGED;
+            if (group->positions[clientId] == GROUP_NOT_MEMBER)
+            {
+                group->positions[clientId] = group->count;
+                group->members[group->count++] = clientId;
+            }
+
+            status = E_OK;
         }
+
+        pthread_rwlock_unlock (&instance->groups_lock);
     }
 
     return status;
 }
 
-Status server_send_message(ServerHandler handler, void * buffer, ssize_t bufferSize)
+Status server_group_remove(ServerHandler handler, GroupId groupId, ClientId clientId)
 {
     ServerHandler_t instance = (ServerHandler_t) handler;
     Status status = E_NOT_INITIALIZED;
 
     if (instance->is_initialized != 0)
     {
-        DEBUG("Server: State update[Sending broadcast message]\n");
+        const int isValidClientId = clientId < instance->config.max_nb_clients;
 
-        for (ClientId clientId = 0; clientId < instance->config.max_nb_clients; ++clientId)
+        pthread_rwlock_wrlock (&instance->groups_lock);
+
+        ClientGroup * group = get_group (instance, groupId);
+        status = E_NOT_MANAGED;
+
+        if ((group != NULL) && isValidClientId && (group->positions[clientId] != GROUP_NOT_MEMBER))
         {
-            server_send_message_to_client (instance, clientId, buffer, bufferSize);
+            group_remove_member (group, clientId);
+            status = E_OK;
         }
 
-        status = E_OK;
+        pthread_rwlock_unlock (&instance->groups_lock);
     }
 
     return status;
 }
 
-Status server_send_message_to_client(
-    ServerHandler handler,
-    ClientId clientId,
-    void * buffer,
-    ssize_t bufferSize)
+Status server_group_send(ServerHandler handler, GroupId groupId, void * buffer, ssize_t bufferSize)
 {
     ServerHandler_t instance = (ServerHandler_t) handler;
     Status status = E_NOT_INITIALIZED;
+    uint8_t header[FRAME_HEADER_LEN];
 
     if (instance->is_initialized != 0)
     {
-        const int isValidClientId = clientId < instance->config.max_nb_clients;
-        const int isAvailableClient = isValidClientId &&
-            (instance->client_data[clientId].socket_fd != 0);
-
-        if (isAvailableClient)
+        if ((bufferSize < 0) || (bufferSize > MAX_MESSAGE_LEN))
         {
-            DEBUG("Server: State update[Sending message to client %d]\n", clientId);
+            return E_ERR_ON_SEND;
+        }
 
-            ssize_t len = send (instance->client_data[clientId].socket_fd, buffer, bufferSize, 0);
+        DEBUG("Server: State update[Sending message to group %d]\n", groupId);
 
-            status = (len < 0) ? E_ERR_ON_SEND : E_OK;
-        }
-        else
+        // One header shared by all members
+        frame_encode_header (header, FRAME_DATA, bufferSize);
+
+        pthread_rwlock_rdlock (&instance->groups_lock);
+
+        ClientGroup * group = get_group (instance, groupId);
+        status = E_NOT_MANAGED;
+
+        if (group != NULL)
         {
-            status = E_NOT_MANAGED;
+            for (uint16_t member = 0; member < group->count; ++member)
+            {
+                send_encoded_to_client (&instance->client_data[group->members[member]], header, buffer, bufferSize, 0);
+            }
+
+            status = E_OK;
         }
+
+        pthread_rwlock_unlock (&instance->groups_lock);
     }
 
     return status;
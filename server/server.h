@@ -1,7 +1,9 @@
 #ifndef NETWORKING_SERVER_H_
 #define NETWORKING_SERVER_H_
 
+#include "buffer_pool.h"
 #include "client_server_cfg.h"
+#include "runtime.h"
 
 #include <stdint.h>
 #include <sys/types.h>
@@ -14,9 +16,18 @@ extern "C"
 
     typedef void * ServerHandler;
     typedef uint32_t ClientId;
+    typedef uint32_t ScheduleId;
+    typedef uint16_t GroupId;
+
+    /** Client id addressing all connected clients */
+#define SERVER_ALL_CLIENTS ((ClientId) 0xFFFFFFFF)
+
+    /** Group id returned when no group could be created */
+#define SERVER_INVALID_GROUP ((GroupId) 0xFFFF)
 
     /**
      * Callback prototype for receiving data.
+     * Called once per message, on the server network thread.
      *
      * @param[in] handler    Reference to sever instance.
      * @param[in] clientId   Id of client from which data was received
@@ -29,6 +40,30 @@ extern "C"
         void *buffer,
         ssize_t size);
 
+    /** Message delivered in a batch */
+    typedef struct
+    {
+        ClientId client_id;     ///< Id of client from which data was received
+        void *buffer;           ///< Received data, valid during the callback
+        ssize_t size;           ///< Size of data received
+        MessageBuffer *message; ///< Pooled storage of buffer; buffer_ref keeps it past the callback
+    } ServerMessage;
+
+    /**
+     * Callback prototype for receiving data in batches.
+     * Called once per network thread wakeup with the messages received
+     * from all clients since, in arrival order per client, and before any
+     * connect or disconnect notification that follows them.
+     *
+     * @param[in] handler  Reference to sever instance.
+     * @param[in] messages Received messages
+     * @param[in] count    Number of messages
+     */
+    typedef void (*notify_cb_receive_batch)(
+        ServerHandler handler,
+        const ServerMessage *messages,
+        uint32_t count);
+
     /**
      * Callback prototype for client state update(connected/disconnected)
      *
@@ -58,15 +93,75 @@ extern "C"
             notify_cb_client client_disconnected_cb; ///< Handler to callback on client disconnect
             notify_cb_recive receive_cb;             ///< Handler to callback on data received
             notify_cb_error error_cb;                ///< Handler to callback on error
+            uint32_t idle_timeout_ms;       ///< Drop clients silent for longer (0 disables)
+            uint32_t heartbeat_interval_ms; ///< Client ping period (0 disables)
+            uint32_t timer_tick_ms;         ///< Timer resolution (0 selects default)
+            uint32_t client_msg_rate;       ///< Messages per second read from each client (0 disables)
+            uint32_t client_msg_burst;      ///< Message burst per client (0 selects one second worth)
+            uint32_t client_byte_rate;      ///< Bytes per second read from each client (0 disables)
+            uint32_t client_byte_burst;     ///< Byte burst per client (0 selects one second worth)
+            uint32_t discovery_reply_rate;  ///< Discovery replies per second per source address (0 disables)
+            uint32_t discovery_reply_burst; ///< Discovery reply burst (0 selects one second worth)
+            uint16_t max_nb_groups;         ///< Max client groups (0 disables groups)
+            void * user_data;               ///< Application context, see server_get_user_data
+            Runtime * runtime;              ///< Shared I/O threads (NULL starts a dedicated network thread)
+            ThreadConfig network_thread;    ///< Dedicated network thread attributes (ignored with a runtime)
+            int steer_incoming_cpu;         ///< Tag the listening socket with the network thread CPU (SO_INCOMING_CPU)
+            uint32_t busy_poll_us;          ///< Spin this long after activity before sleeping; also SO_BUSY_POLL on client sockets (0 disables)
+            const char * capture_path;      ///< Record connections and messages to this file, see capture.h (NULL disables)
+            uint32_t resume_grace_ms;       ///< Keep the session of a dropped client this long for client_resume (0 disables)
+            uint32_t resume_buffer_size;    ///< Bytes of recent messages kept per client for resumption (0 selects 64 KiB)
+            uint16_t advertise_flags;       ///< Application capabilities, advertised in the upper 16 bits of AdvertisingInfo.capabilities
+            char broadcast_ip[16];          ///< Multicast group carrying server_send_message to clients that join it (empty disables)
+            uint16_t broadcast_port;        ///< Broadcast group port
+            uint32_t broadcast_history_size; ///< Bytes of recent broadcasts kept to repair losses (0 selects 256 KiB)
+            uint32_t snapshot_size;         ///< Largest state server_send_snapshot accepts (0 disables snapshots)
+            notify_cb_receive_batch receive_batch_cb; ///< Handler to callback on data received, replaces receive_cb (NULL disables)
+            uint32_t client_send_queue_size; ///< Bytes queued per client while its socket is full; a client exceeding it is dropped (0 selects 256 KiB)
+            uint32_t receive_batch_size;    ///< Most messages per batch, a full batch is delivered early (0 selects 256)
     } ServerConfig;
 
     /**
      * Starts a new advertising server based on the provided configuration.
+     * With a runtime, the server runs on one of its I/O threads, uses its
+     * timer resolution and shares one discovery socket with the other
+     * servers advertising on the same address and port.
+     * Client state is moved to the NUMA node of the network thread when
+     * the thread is pinned.
+     *
+     * With steer_incoming_cpu and a network thread pinned to one CPU, the
+     * listening socket also sets SO_REUSEPORT: among instances sharing a
+     * game port, the kernel hands each connection to the listener whose
+     * CPU services the NIC queue the connection arrived on.
+     *
+     * With resume_grace_ms, clients must enable session_resume. A client
+     * whose connection drops keeps its id, groups and pending messages
+     * for the grace period; messages sent meanwhile are buffered and
+     * delivered on resumption. client_disconnected_cb is called once the
+     * grace period ends. Messages older than resume_buffer_size bytes
+     * cannot be replayed; the client then starts a new session.
+     *
+     * With broadcast_ip, server_send_message sends each message once to
+     * the multicast group, whatever the number of clients. Clients that
+     * enable broadcast_channel join it; the others still receive the
+     * message over their connection. Losses are detected by sequence
+     * number and repaired over the connection from a history of
+     * broadcast_history_size bytes. Joined clients whose connection
+     * drops recover missed broadcasts the same way once resumed.
+     * Broadcast messages are then limited to MAX_MESSAGE_LEN less the
+     * BroadcastHeader a repair carries ahead of them (see frame.h).
      *
      * @param[in] config Reference to server configuration
      */
     ServerHandler server_init(ServerConfig * config);
 
+    /**
+     * Get application context provided in the configuration.
+     *
+     * @param[in] handler Reference to sever instance.
+     */
+    void * server_get_user_data(ServerHandler handler);
+
     /**
      * Stops server and closes all client sockets
      *
@@ -98,6 +193,20 @@ extern "C"
      */
     Status server_send_message(ServerHandler handler, void * buffer, ssize_t bufferSize);
 
+    /**
+     * Send the application state to every connected client, typically
+     * once per tick. Each client receives a delta against the last
+     * snapshot it acknowledged among the previous SNAPSHOT_HISTORY, or
+     * the full state when it has none; clients acknowledging the same
+     * snapshot share one encoding. Clients rebuild the state and get it
+     * through snapshot_cb. Requires snapshot_size.
+     *
+     * @param[in] handler Reference to sever instance
+     * @param[in] state   State, copied
+     * @param[in] size    State size, at most snapshot_size
+     */
+    Status server_send_snapshot(ServerHandler handler, const void *state, uint32_t size);
+
     /**
      * Send message to specific client
      *
@@ -112,6 +221,139 @@ extern "C"
         void * buffer,
         ssize_t bufferSize);
 
+    /**
+     * Get a pooled buffer to build a message in. Hand it over with
+     * server_send_buffer or server_schedule_buffer, or drop it with
+     * buffer_release.
+     *
+     * @param[in] handler  Reference to sever instance
+     * @param[in] capacity Bytes needed, at most MAX_MESSAGE_LEN
+     *
+     * @return Buffer with size 0, NULL on error
+     */
+    MessageBuffer *server_alloc_buffer(ServerHandler handler, uint32_t capacity);
+
+    /**
+     * Send a pooled message. Takes over the caller's reference, also on
+     * error; add one with buffer_ref to send the same buffer again.
+     *
+     * @param[in] handler  Reference to sever instance
+     * @param[in] clientId Id of the destination client or SERVER_ALL_CLIENTS
+     * @param[in] buffer   Message of buffer->size bytes
+     */
+    Status server_send_buffer(ServerHandler handler, ClientId clientId, MessageBuffer *buffer);
+
+    /**
+     * Get last measured round trip time to client. Requires heartbeat.
+     *
+     * @param[in]  handler  Reference to sever instance
+     * @param[in]  clientId Id of the client
+     * @param[out] rttUs    Round trip time in microseconds, 0 if not measured yet
+     */
+    Status server_get_client_rtt(ServerHandler handler, ClientId clientId, uint32_t *rttUs);
+
+    /**
+     * Get time the network thread spent spinning versus sleeping. With a
+     * runtime, covers every instance sharing the same I/O thread.
+     *
+     * @param[in]  handler Reference to sever instance
+     * @param[out] stats   Waiting statistics
+     */
+    Status server_get_poll_stats(ServerHandler handler, EventLoopStats *stats);
+
+    /**
+     * Schedule a delayed, optionally periodic, message.
+     * The data is copied; the message is sent from the server network thread.
+     *
+     * @param[in] handler    Reference to sever instance
+     * @param[in] clientId   Id of the destination client or SERVER_ALL_CLIENTS
+     * @param[in] buffer     Reference to data to be sent
+     * @param[in] bufferSize Size of data to be sent
+     * @param[in] delayMs    Delay before the first send
+     * @param[in] periodMs   Period of subsequent sends (0 sends once)
+     *
+     * @return Id to be used for cancelling, 0 on error
+     */
+    ScheduleId server_schedule_message(
+        ServerHandler handler,
+        ClientId clientId,
+        void * buffer,
+        ssize_t bufferSize,
+        uint32_t delayMs,
+        uint32_t periodMs);
+
+    /**
+     * Schedule a pooled message without copying it. Takes over the caller's
+     * reference, also on error; it is dropped when the schedule ends.
+     *
+     * @param[in] handler  Reference to sever instance
+     * @param[in] clientId Id of the destination client or SERVER_ALL_CLIENTS
+     * @param[in] buffer   Message of buffer->size bytes
+     * @param[in] delayMs  Delay before the first send
+     * @param[in] periodMs Period of subsequent sends (0 sends once)
+     *
+     * @return Id to be used for cancelling, 0 on error
+     */
+    ScheduleId server_schedule_buffer(
+        ServerHandler handler,
+        ClientId clientId,
+        MessageBuffer * buffer,
+        uint32_t delayMs,
+        uint32_t periodMs);
+
+    /**
+     * Cancel a scheduled message.
+     *
+     * @param[in] handler    Reference to sever instance
+     * @param[in] scheduleId Id returned by server_schedule_message
+     */
+    Status server_cancel_scheduled(ServerHandler handler, ScheduleId scheduleId);
+
+    /**
+     * Create an empty client group.
+     *
+     * @param[in] handler Reference to sever instance
+     *
+     * @return Group id, SERVER_INVALID_GROUP if max_nb_groups is reached
+     */
+    GroupId server_group_create(ServerHandler handler);
+
+    /**
+     * Destroy group. Members stay connected.
+     *
+     * @param[in] handler Reference to sever instance
+     * @param[in] groupId Id of the group
+     */
+    Status server_group_destroy(ServerHandler handler, GroupId groupId);
+
+    /**
+     * Add client to group. Clients leave all groups on disconnect.
+     *
+     * @param[in] handler  Reference to sever instance
+     * @param[in] groupId  Id of the group
+     * @param[in] clientId Id of the client
+     */
+    Status server_group_add(ServerHandler handler, GroupId groupId, ClientId clientId);
+
+    /**
+     * Remove client from group.
+     *
+     * @param[in] handler  Reference to sever instance
+     * @param[in] groupId  Id of the group
+     * @param[in] clientId Id of the client
+     */
+    Status server_group_remove(ServerHandler handler, GroupId groupId, ClientId clientId);
+
+    /**
+     * Send message to all members of a group.
+     *
+     * @param[in] handler    Reference to sever instance
+     * @param[in] groupId    Id of the group
+     * @param[in] buffer     Reference to data to be sent
+     * @param[in] bufferSize Size of data to be sent
+     */
+    Status server_group_send(ServerHandler handler, GroupId groupId, void * buffer, ssize_t bufferSize);
+
 #ifdef __cplusplus
 }
 #endif
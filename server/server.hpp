@@ -0,0 +1,264 @@
+#ifndef NETWORKING_SERVER_HPP_
+#define NETWORKING_SERVER_HPP_
+
+/*
+ * Header-only C++20 layer over server.h.
+ *
+ * The handler type is a template parameter: the library calls one static
+ * trampoline per event which calls the handler member directly, so the
+ * member can be inlined and carries its own state instead of globals.
+ * Events the handler does not implement are not registered at all.
+ *
+ *     struct Game
+ *     {
+ *         void on_connect(net::ServerRef server, ClientId id);
+ *         void on_receive(net::ServerRef server, ClientId id, std::span<const std::byte> data);
+ *     };
+ *
+ *     net::Server<Game> server (config, Game {});
+ *
+ * A plain lambda taking (ServerRef, ClientId, std::span<const std::byte>)
+ * is accepted as a receive-only handler. A handler implementing
+ *
+ *         void on_receive_batch(net::ServerRef server, std::span<const ServerMessage> messages);
+ *
+ * receives once per network thread wakeup instead, see receive_batch_cb.
+ */
+
+#include "server.h"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <utility>
+
+namespace net
+{
+    /**
+     * Non-owning reference to a server instance, valid inside callbacks.
+     * Only the owning Server learns that the instance failed: copies kept
+     * elsewhere, like the C handle, must not be used after on_error.
+     */
+    class ServerRef
+    {
+        public:
+            explicit ServerRef(ServerHandler handle) : handle_ (handle) {}
+
+            ServerHandler handle() const { return handle_; }
+
+            Status send(std::span<const std::byte> data) const
+            {
+                return server_send_message (handle_, const_cast<std::byte *> (data.data ()), data.size ());
+            }
+
+            Status send_to(ClientId clientId, std::span<const std::byte> data) const
+            {
+                return server_send_message_to_client (
+                    handle_, clientId, const_cast<std::byte *> (data.data ()), data.size ());
+            }
+
+            Status send_to_group(GroupId groupId, std::span<const std::byte> data) const
+            {
+                return server_group_send (handle_, groupId, const_cast<std::byte *> (data.data ()), data.size ());
+            }
+
+            Status send_snapshot(std::span<const std::byte> state) const
+            {
+                return server_send_snapshot (handle_, state.data (), state.size ());
+            }
+
+            Status remove_client(ClientId clientId) const
+            {
+                return server_remove_client (handle_, clientId);
+            }
+
+            Status stop_advertising() const
+            {
+                return server_stop_advertising (handle_);
+            }
+
+            GroupId create_group() const { return server_group_create (handle_); }
+            Status destroy_group(GroupId groupId) const { return server_group_destroy (handle_, groupId); }
+            Status add_to_group(GroupId groupId, ClientId clientId) const { return server_group_add (handle_, groupId, clientId); }
+            Status remove_from_group(GroupId groupId, ClientId clientId) const { return server_group_remove (handle_, groupId, clientId); }
+
+        protected:
+            ServerHandler handle_;
+    };
+
+    namespace detail
+    {
+        template <typename Handler>
+        concept HasServerReceive = requires (Handler &h, ServerHandler s, ClientId id, std::span<const std::byte> d)
+        {
+            h.on_receive (ServerRef (s), id, d);
+        };
+
+        template <typename Handler>
+        concept IsServerReceive = requires (Handler &h, ServerHandler s, ClientId id, std::span<const std::byte> d)
+        {
+            h (ServerRef (s), id, d);
+        };
+    }
+
+    /**
+     * Owning, move-only server instance.
+     *
+     * @tparam Handler Type implementing any of on_receive, on_receive_batch,
+     *     on_connect, on_disconnect and on_error
+     */
+    template <typename Handler>
+    class Server : public ServerRef
+    {
+        public:
+            Server(ServerConfig config, Handler handler)
+                : ServerRef (nullptr), state_ (std::make_unique<State> (std::move (handler)))
+            {
+                config.user_data = state_.get ();
+                config.receive_cb = nullptr;
+                config.receive_batch_cb = nullptr;
+                config.client_connected_cb = nullptr;
+                config.client_disconnected_cb = nullptr;
+                config.error_cb = on_error;
+
+                if constexpr (detail::HasServerReceive<Handler> || detail::IsServerReceive<Handler>)
+                {
+                    config.receive_cb = on_receive;
+                }
+
+                if constexpr (requires (Handler &h, ServerRef s, std::span<const ServerMessage> m) { h.on_receive_batch (s, m); })
+                {
+                    config.receive_batch_cb = on_receive_batch;
+                }
+
+                if constexpr (requires (Handler &h, ServerRef s, ClientId id) { h.on_connect (s, id); })
+                {
+                    config.client_connected_cb = on_connect;
+                }
+
+                if constexpr (requires (Handler &h, ServerRef s, ClientId id) { h.on_disconnect (s, id); })
+                {
+                    config.client_disconnected_cb = on_disconnect;
+                }
+
+                state_->owner = this;
+                handle_ = server_init (&config);
+                state_->handle = handle_;
+            }
+
+            ~Server()
+            {
+                reset ();
+            }
+
+            Server(Server &&other) noexcept
+                : ServerRef (std::exchange (other.handle_, nullptr)), state_ (std::move (other.state_))
+            {
+                if (state_ != nullptr)
+                {
+                    state_->owner = this;
+                }
+            }
+
+            Server &operator=(Server &&other) noexcept
+            {
+                if (this != &other)
+                {
+                    reset ();
+                    handle_ = std::exchange (other.handle_, nullptr);
+                    state_ = std::move (other.state_);
+
+                    if (state_ != nullptr)
+                    {
+                        state_->owner = this;
+                    }
+                }
+
+                return *this;
+            }
+
+            Server(const Server &) = delete;
+            Server &operator=(const Server &) = delete;
+
+            /** Check if the server is running */
+            explicit operator bool() const { return (state_ != nullptr) && (state_->handle != nullptr); }
+
+            Handler &handler() { return state_->handler; }
+
+            /** Stop server, closing all client sockets */
+            void reset()
+            {
+                if (*this)
+                {
+                    server_deinit (state_->handle);
+                }
+
+                handle_ = nullptr;
+                state_.reset ();
+            }
+
+        private:
+            /** Heap allocated so the context address survives moves */
+            struct State
+            {
+                explicit State(Handler &&h) : handler (std::move (h)) {}
+
+                Handler handler;
+                ServerHandler handle = nullptr;
+                Server *owner = nullptr; ///< Cleared with handle on error
+            };
+
+            static State &state(ServerHandler handle)
+            {
+                return *static_cast<State *> (server_get_user_data (handle));
+            }
+
+            static void on_receive(ServerHandler handle, ClientId clientId, void *buffer, ssize_t size)
+            {
+                std::span<const std::byte> data (static_cast<const std::byte *> (buffer), size);
+
+                if constexpr (detail::HasServerReceive<Handler>)
+                {
+                    state (handle).handler.on_receive (ServerRef (handle), clientId, data);
+                }
+                else
+                {
+                    state (handle).handler (ServerRef (handle), clientId, data);
+                }
+            }
+
+            static void on_receive_batch(ServerHandler handle, const ServerMessage *messages, uint32_t count)
+            {
+                state (handle).handler.on_receive_batch (
+                    ServerRef (handle), std::span<const ServerMessage> (messages, count));
+            }
+
+            static void on_connect(ServerHandler handle, ClientId clientId)
+            {
+                state (handle).handler.on_connect (ServerRef (handle), clientId);
+            }
+
+            static void on_disconnect(ServerHandler handle, ClientId clientId)
+            {
+                state (handle).handler.on_disconnect (ServerRef (handle), clientId);
+            }
+
+            static void on_error(ServerHandler handle)
+            {
+                State &s = state (handle);
+
+                if constexpr (requires (Handler &h, ServerRef r) { h.on_error (r); })
+                {
+                    s.handler.on_error (ServerRef (handle));
+                }
+
+                // The library releases the instance once the callback returns
+                s.handle = nullptr;
+                s.owner->handle_ = nullptr;
+            }
+
+            std::unique_ptr<State> state_;
+    };
+}
+
+#endif /* NETWORKING_SERVER_HPP_*/
@@ -0,0 +1,287 @@
+#ifndef NETWORKING_SERVER_CORO_HPP_
+#define NETWORKING_SERVER_CORO_HPP_
+
+/*
+ * C++20 coroutine interface over server.h.
+ *
+ *     net::co::Task session(net::co::Connection &conn)
+ *     {
+ *         while (auto data = co_await conn.recv ())
+ *         {
+ *             co_await conn.send (*data);
+ *         }
+ *     }
+ *
+ *     net::co::Task listen(net::co::Server &server)
+ *     {
+ *         while (net::co::Connection *conn = co_await server.accept ())
+ *         {
+ *             session (*conn);
+ *         }
+ *     }
+ *
+ * Coroutines are resumed on the server network thread from the callback
+ * completing the awaited operation. Sends complete synchronously, like
+ * server_send_message_to_client, and never block that thread: what the
+ * socket does not take is queued, and a client whose queue overflows
+ * client_send_queue_size is disconnected. Keep other work in a coroutine
+ * short and nonblocking too, every connection waits on it.
+ */
+
+#include "server.hpp"
+#include "../common/coro.hpp"
+
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+
+namespace net::co
+{
+    class Server;
+
+    /**
+     * Client connection, reused by the next client taking the same id.
+     * Stop using it once recv completed empty; a recv still pending when
+     * the id is reused completes empty as well.
+     */
+    class Connection
+    {
+        public:
+            ClientId id() const { return id_; }
+
+            /**
+             * Wait for the next message.
+             *
+             * @return Message, valid until the coroutine suspends again;
+             *     empty once the client disconnected
+             */
+            Mailbox::Awaiter recv() { return mailbox_.receive (); }
+
+            /** Send message, completes without suspending */
+            Ready<Status> send(std::span<const std::byte> data)
+            {
+                if (handle_ == nullptr)
+                {
+                    return { E_NOT_INITIALIZED };
+                }
+
+                return { ServerRef (handle_).send_to (id_, data) };
+            }
+
+            /** Disconnect client, pending recv completes empty */
+            Status close()
+            {
+                if (handle_ == nullptr)
+                {
+                    return E_NOT_INITIALIZED;
+                }
+
+                return ServerRef (handle_).remove_client (id_);
+            }
+
+        private:
+            friend class Server;
+
+            ServerHandler handle_ = nullptr;
+            ClientId id_ = 0;
+            Mailbox mailbox_;
+    };
+
+    /**
+     * Server instance driving connections as coroutines. Not movable, the
+     * connections are referenced by the suspended coroutines.
+     */
+    class Server
+    {
+        public:
+            class AcceptAwaiter
+            {
+                public:
+                    explicit AcceptAwaiter(Server &server) : server_ (server) {}
+
+                    bool await_ready()
+                    {
+                        std::lock_guard<std::mutex> guard (server_.lock_);
+
+                        return server_.is_accept_ready ();
+                    }
+
+                    bool await_suspend(std::coroutine_handle<> handle)
+                    {
+                        std::lock_guard<std::mutex> guard (server_.lock_);
+
+                        if (server_.is_accept_ready ())
+                        {
+                            return false;
+                        }
+
+                        handle_ = handle;
+                        server_.acceptor_ = this;
+
+                        return true;
+                    }
+
+                    Connection *await_resume()
+                    {
+                        if (delivered_)
+                        {
+                            return result_;
+                        }
+
+                        std::lock_guard<std::mutex> guard (server_.lock_);
+
+                        return server_.pop_accepted ();
+                    }
+
+                private:
+                    friend class Server;
+
+                    Server &server_;
+                    std::coroutine_handle<> handle_;
+                    Connection *result_ = nullptr;
+                    bool delivered_ = false;
+            };
+
+            explicit Server(ServerConfig config)
+                : connections_ (std::make_unique<Connection[]> (config.max_nb_clients)),
+                  connection_count_ (config.max_nb_clients),
+                  server_ (config, Handler { this })
+            {
+            }
+
+            /** Stops the server, pending awaiters complete empty on this thread */
+            ~Server()
+            {
+                server_.reset ();
+                stop ();
+                close_connections ();
+            }
+
+            Server(const Server &) = delete;
+            Server &operator=(const Server &) = delete;
+
+            /** Check if the server is running */
+            explicit operator bool() const { return static_cast<bool> (server_); }
+
+            ServerRef ref() const { return server_; }
+
+            /**
+             * Wait for the next client.
+             *
+             * @return Connection, nullptr once the server stopped
+             */
+            AcceptAwaiter accept() { return AcceptAwaiter (*this); }
+
+        private:
+            struct Handler
+            {
+                Server *self;
+
+                void on_connect(ServerRef server, ClientId id)
+                {
+                    self->connected (server, id);
+                }
+
+                void on_receive(ServerRef server, ClientId id, std::span<const std::byte> data)
+                {
+                    self->connections_[id].mailbox_.deliver (data);
+                }
+
+                void on_disconnect(ServerRef server, ClientId id)
+                {
+                    self->connections_[id].mailbox_.close ();
+                }
+
+                void on_error(ServerRef server)
+                {
+                    self->stop ();
+                    self->close_connections ();
+                }
+            };
+
+            bool is_accept_ready() const
+            {
+                return !accepted_.empty () || stopped_;
+            }
+
+            Connection *pop_accepted()
+            {
+                if (accepted_.empty ())
+                {
+                    return nullptr;
+                }
+
+                Connection *conn = accepted_.front ();
+                accepted_.pop_front ();
+
+                return conn;
+            }
+
+            void connected(ServerRef server, ClientId id)
+            {
+                Connection *conn = &connections_[id];
+                std::unique_lock<std::mutex> guard (lock_);
+
+                conn->handle_ = server.handle ();
+                conn->id_ = id;
+                conn->mailbox_.open ();
+
+                if (acceptor_ == nullptr)
+                {
+                    accepted_.push_back (conn);
+                    return;
+                }
+
+                resume_acceptor (guard, conn);
+            }
+
+            void stop()
+            {
+                std::unique_lock<std::mutex> guard (lock_);
+
+                stopped_ = true;
+                accepted_.clear ();
+
+                if (acceptor_ != nullptr)
+                {
+                    resume_acceptor (guard, nullptr);
+                }
+            }
+
+            /** Detach connections from the instance, pending recv completes empty */
+            void close_connections()
+            {
+                for (uint16_t i = 0; i < connection_count_; ++i)
+                {
+                    connections_[i].handle_ = nullptr;
+                    connections_[i].mailbox_.close ();
+                }
+            }
+
+            void resume_acceptor(std::unique_lock<std::mutex> &guard, Connection *conn)
+            {
+                AcceptAwaiter *acceptor = std::exchange (acceptor_, nullptr);
+                std::coroutine_handle<> handle = acceptor->handle_;
+
+                acceptor->result_ = conn;
+                acceptor->delivered_ = true;
+
+                guard.unlock ();
+                handle.resume ();
+            }
+
+            std::mutex lock_;
+            std::deque<Connection *> accepted_;
+            AcceptAwaiter *acceptor_ = nullptr;
+            bool stopped_ = false;
+            std::unique_ptr<Connection[]> connections_;
+            uint16_t connection_count_;
+
+            // Last member so callbacks never see the others uninitialized
+            net::Server<Handler> server_;
+    };
+}
+
+#endif /* NETWORKING_SERVER_CORO_HPP_*/
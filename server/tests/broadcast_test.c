@@ -0,0 +1,180 @@
+/*
+ * Broadcast channel: size limit, and repair over the connection of the
+ * largest broadcasts missed while disconnected.
+ */
+
+#include "frame.h"
+#include "loopback.h"
+#include "test.h"
+
+#define PORT              6710
+#define BROADCAST_IP      "239.1.2.10"
+#define NB_MISSED         3
+#define MAX_BROADCAST_LEN (MAX_MESSAGE_LEN - sizeof(BroadcastHeader))
+
+typedef struct
+{
+    int received;     ///< Messages received, written last
+    int disconnected; ///< Disconnect notifications
+    int sizes[NB_MISSED + 2];
+    uint8_t messages[NB_MISSED + 2][MAX_MESSAGE_LEN];
+} Receiver;
+
+static uint8_t pattern(int message, uint32_t index)
+{
+    return (uint8_t) (message * 31 + index);
+}
+
+static void on_server_receive(ServerHandler handler, ClientId clientId, void *buffer, ssize_t size)
+{
+    // Echoed behind the broadcast join on the connection
+    server_send_message_to_client (handler, clientId, buffer, size);
+}
+
+static void on_client_receive(ClientHandler handler, char *buffer, int size)
+{
+    Receiver *receiver = (Receiver *) client_get_user_data (handler);
+    int index = receiver->received;
+
+    if (index < NB_MISSED + 2)
+    {
+        memcpy (receiver->messages[index], buffer, size);
+        receiver->sizes[index] = size;
+    }
+
+    __atomic_store_n (&receiver->received, index + 1, __ATOMIC_RELEASE);
+}
+
+static void on_client_disconnect(ClientHandler handler)
+{
+    Receiver *receiver = (Receiver *) client_get_user_data (handler);
+
+    __atomic_fetch_add (&receiver->disconnected, 1, __ATOMIC_RELEASE);
+}
+
+static void broadcast_config(ServerConfig *config, uint16_t port)
+{
+    loopback_server_config (config, port);
+    strcpy (config->broadcast_ip, BROADCAST_IP);
+
+    config->broadcast_port  = port + 2;
+    config->resume_grace_ms = 2000;
+    config->receive_cb      = on_server_receive;
+}
+
+static int test_size_limit(void)
+{
+    static uint8_t message[MAX_MESSAGE_LEN];
+    ServerConfig config;
+    ServerHandler server;
+    Status largest;
+    Status tooLarge;
+
+    broadcast_config (&config, PORT);
+    server = server_init (&config);
+    CHECK (server != NULL);
+
+    // A repair adds its header to the message, within one frame
+    largest  = server_send_message (server, message, MAX_BROADCAST_LEN);
+    tooLarge = server_send_message (server, message, MAX_BROADCAST_LEN + 1);
+
+    // Connections alone carry whole messages
+    server_deinit (server);
+    config.broadcast_ip[0] = 0;
+    server = server_init (&config);
+    CHECK (server != NULL);
+    CHECK (server_send_message (server, message, MAX_MESSAGE_LEN) == E_OK);
+    server_deinit (server);
+
+    CHECK ((largest == E_OK) && (tooLarge == E_ERR_ON_SEND));
+
+    return 0;
+}
+
+static int check_repairs(ServerHandler server, ClientHandler client, Receiver *receiver)
+{
+    static uint8_t message[MAX_BROADCAST_LEN];
+    uint32_t ping = 1;
+
+    CHECK (loopback_connect (client) == E_OK);
+
+    // The echo arrives once the client joined the group
+    CHECK (client_send_message (client, &ping, sizeof(ping)) == E_OK);
+    CHECK (wait_for (&receiver->received, 1));
+
+    CHECK (client_disconnect (client) == E_OK);
+
+    for (int index = 1; index <= NB_MISSED; ++index)
+    {
+        for (uint32_t offset = 0; offset < MAX_BROADCAST_LEN; ++offset)
+        {
+            message[offset] = pattern (index, offset);
+        }
+
+        CHECK (server_send_message (server, message, MAX_BROADCAST_LEN) == E_OK);
+    }
+
+    // Datagrams arriving without a connection are dropped, leaving
+    // the messages to the repairs requested on resumption
+    usleep (100000);
+    CHECK (client_resume (client) == E_OK);
+    CHECK (wait_for (&receiver->received, 1 + NB_MISSED));
+
+    for (int index = 1; index <= NB_MISSED; ++index)
+    {
+        CHECK (receiver->sizes[index] == MAX_BROADCAST_LEN);
+
+        for (uint32_t offset = 0; offset < MAX_BROADCAST_LEN; ++offset)
+        {
+            CHECK (receiver->messages[index][offset] == pattern (index, offset));
+        }
+    }
+
+    // Still connected, only client_disconnect notified
+    CHECK (client_send_message (client, &ping, sizeof(ping)) == E_OK);
+    CHECK (wait_for (&receiver->received, 2 + NB_MISSED));
+    CHECK (receiver->disconnected == 1);
+
+    return 0;
+}
+
+static int test_repair_largest(void)
+{
+    static Receiver receiver;
+    ServerConfig serverConfig;
+    ClientConfig clientConfig;
+    ServerHandler server;
+    ClientHandler client;
+    int status;
+
+    broadcast_config (&serverConfig, PORT + 3);
+    server = server_init (&serverConfig);
+    CHECK (server != NULL);
+
+    loopback_client_config (&clientConfig, PORT + 3);
+    clientConfig.receive_cb        = on_client_receive;
+    clientConfig.disconnect_cb     = on_client_disconnect;
+    clientConfig.user_data         = &receiver;
+    clientConfig.session_resume    = 1;
+    clientConfig.broadcast_channel = 1;
+    client = client_init (&clientConfig);
+
+    status = (client != NULL) ? check_repairs (server, client, &receiver) : 1;
+
+    if (client != NULL)
+    {
+        client_deinit (client);
+    }
+
+    server_deinit (server);
+
+    return status;
+}
+
+int main(void)
+{
+    RUN (test_size_limit);
+    RUN (test_repair_largest);
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Buffer pool: size classes, reference counting, reuse without growth,
+ * and buffers crossing threads.
+ */
+
+#include "buffer_pool.h"
+#include "client_server_cfg.h"
+#include "test.h"
+
+#include <pthread.h>
+
+#define NB_THREADS  4
+#define NB_REFS     100000
+#define NB_HANDOFFS 200
+
+static uint64_t allocated(void)
+{
+    BufferPoolStats stats;
+
+    buffer_pool_get_stats (&stats);
+
+    return stats.allocated;
+}
+
+static int test_classes(void)
+{
+    MessageBuffer *buffers[5];
+
+    buffers[0] = buffer_pool_alloc (0);
+    buffers[1] = buffer_pool_alloc (256);
+    buffers[2] = buffer_pool_alloc (257);
+    buffers[3] = buffer_pool_alloc (MAX_MESSAGE_LEN);
+    buffers[4] = buffer_pool_alloc (MAX_MESSAGE_LEN + 1);
+
+    CHECK ((buffers[0] != NULL) && (buffers[0]->capacity == 256));
+    CHECK ((buffers[1] != NULL) && (buffers[1]->capacity == 256));
+    CHECK ((buffers[2] != NULL) && (buffers[2]->capacity == 1024));
+    CHECK ((buffers[3] != NULL) && (buffers[3]->capacity == MAX_MESSAGE_LEN));
+    CHECK (buffers[4] == NULL);
+
+    for (int index = 0; index < 4; ++index)
+    {
+        CHECK ((buffers[index]->refs == 1) && (buffers[index]->size == 0));
+
+        // The whole capacity is usable
+        buffers[index]->data[buffers[index]->capacity - 1] = 1;
+        buffer_release (buffers[index]);
+    }
+
+    return 0;
+}
+
+static int test_refcount(void)
+{
+    MessageBuffer *buffer = buffer_pool_alloc (100);
+    MessageBuffer *other;
+
+    CHECK (buffer != NULL);
+    buffer->size = 100;
+    buffer_ref (buffer);
+    buffer_ref (buffer);
+    CHECK (buffer->refs == 3);
+
+    buffer_release (buffer);
+    buffer_release (buffer);
+    CHECK (buffer->refs == 1);
+
+    // Still referenced, never handed out again
+    other = buffer_pool_alloc (100);
+    CHECK ((other != NULL) && (other != buffer));
+    buffer_release (other);
+
+    buffer_release (buffer);
+
+    // The last release returns it, freshly reset
+    other = buffer_pool_alloc (100);
+    CHECK (other == buffer);
+    CHECK ((other->refs == 1) && (other->size == 0));
+    buffer_release (other);
+
+    return 0;
+}
+
+static int test_no_growth(void)
+{
+    MessageBuffer *buffers[100];
+    uint64_t before;
+
+    for (int index = 0; index < 100; ++index)
+    {
+        buffers[index] = buffer_pool_alloc (1000);
+    }
+
+    for (int index = 0; index < 100; ++index)
+    {
+        buffer_release (buffers[index]);
+    }
+
+    before = allocated ();
+
+    for (int round = 0; round < 1000; ++round)
+    {
+        for (int index = 0; index < 100; ++index)
+        {
+            buffers[index] = buffer_pool_alloc (1000);
+            CHECK (buffers[index] != NULL);
+        }
+
+        for (int index = 0; index < 100; ++index)
+        {
+            buffer_release (buffers[index]);
+        }
+    }
+
+    CHECK (allocated () == before);
+
+    return 0;
+}
+
+static void *ref_thread(void *param)
+{
+    MessageBuffer *buffer = (MessageBuffer *) param;
+
+    for (int index = 0; index < NB_REFS; ++index)
+    {
+        buffer_ref (buffer);
+        buffer_release (buffer);
+    }
+
+    return NULL;
+}
+
+static int test_concurrent_refs(void)
+{
+    pthread_t threads[NB_THREADS];
+    MessageBuffer *buffer = buffer_pool_alloc (10);
+
+    CHECK (buffer != NULL);
+
+    for (int index = 0; index < NB_THREADS; ++index)
+    {
+        pthread_create (&threads[index], NULL, ref_thread, buffer);
+    }
+
+    for (int index = 0; index < NB_THREADS; ++index)
+    {
+        pthread_join (threads[index], NULL);
+    }
+
+    CHECK (buffer->refs == 1);
+    buffer_release (buffer);
+
+    return 0;
+}
+
+static void *alloc_thread(void *param)
+{
+    MessageBuffer **buffers = (MessageBuffer **) param;
+
+    for (int index = 0; index < NB_HANDOFFS; ++index)
+    {
+        buffers[index] = buffer_pool_alloc (MAX_MESSAGE_LEN);
+    }
+
+    return NULL;
+}
+
+static int test_cross_thread(void)
+{
+    static MessageBuffer *buffers[NB_HANDOFFS];
+    uint64_t before = allocated ();
+    uint64_t settled = 0;
+
+    // Allocated on a short lived thread, released here, as network thread
+    // and application do; released buffers must flow back to the next
+    // thread. The releasing thread caches some, so use settles after a
+    // few rounds, well short of a new buffer per handoff
+    for (int round = 0; round < 30; ++round)
+    {
+        pthread_t thread;
+
+        pthread_create (&thread, NULL, alloc_thread, buffers);
+        pthread_join (thread, NULL);
+
+        for (int index = 0; index < NB_HANDOFFS; ++index)
+        {
+            CHECK (buffers[index] != NULL);
+            buffer_release (buffers[index]);
+        }
+
+        if (round == 9)
+        {
+            settled = allocated ();
+        }
+    }
+
+    CHECK (allocated () == settled);
+    CHECK (settled - before < 2 * NB_HANDOFFS);
+
+    return 0;
+}
+
+int main(void)
+{
+    RUN (test_classes);
+    RUN (test_refcount);
+    RUN (test_no_growth);
+    RUN (test_concurrent_refs);
+    RUN (test_cross_thread);
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Client send queue: while the server does not read, application sends
+ * wait for room and the client network thread keeps receiving, answering
+ * heartbeats and refusing sends it cannot queue.
+ */
+
+#include "loopback.h"
+#include "test.h"
+
+#include <pthread.h>
+
+#define PORT         6720
+#define MESSAGE_LEN  1000
+#define NB_RECEIVED  50
+
+typedef struct
+{
+    ClientHandler client;
+    int sent;         ///< Messages sent by the application thread
+    int is_done;      ///< Application thread returned
+    int received;     ///< Messages received from the server
+    int refused;      ///< Sends from the receive callback refused
+} Sender;
+
+static Sender sender;
+
+static void on_client_receive(ClientHandler handler, char *buffer, int size)
+{
+    static uint8_t message[MESSAGE_LEN];
+
+    // Called on the network thread, must not wait for the queue to drain
+    if (client_send_message (handler, message, sizeof(message)) == E_ERR_ON_SEND)
+    {
+        __atomic_fetch_add (&sender.refused, 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_fetch_add (&sender.received, 1, __ATOMIC_RELEASE);
+}
+
+static void *send_thread(void *param)
+{
+    static uint8_t message[MESSAGE_LEN];
+
+    while (client_send_message (sender.client, message, sizeof(message)) == E_OK)
+    {
+        __atomic_fetch_add (&sender.sent, 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n (&sender.is_done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+/** Wait for the application thread to stop making progress */
+static int wait_blocked(void)
+{
+    int sent = -1;
+
+    for (int waitedMs = 0; waitedMs < LOOPBACK_TIMEOUT_MS; waitedMs += 100)
+    {
+        int now = __atomic_load_n (&sender.sent, __ATOMIC_ACQUIRE);
+
+        if ((now == sent) && (now != 0))
+        {
+            return 1;
+        }
+
+        sent = now;
+        usleep (100000);
+    }
+
+    return 0;
+}
+
+static int check_queue(ServerHandler server)
+{
+    static uint8_t message[16];
+    pthread_t thread;
+
+    CHECK (loopback_connect (sender.client) == E_OK);
+    pthread_create (&thread, NULL, send_thread, NULL);
+
+    // The server reads a burst, then pauses the connection
+    CHECK (wait_blocked ());
+    CHECK (!__atomic_load_n (&sender.is_done, __ATOMIC_ACQUIRE));
+
+    // Pings keep coming meanwhile; their pongs are queued, not waited for
+    for (int index = 0; index < NB_RECEIVED; ++index)
+    {
+        CHECK (server_send_message_to_client (server, 0, message, sizeof(message)) == E_OK);
+        usleep (2000);
+    }
+
+    CHECK (wait_for (&sender.received, NB_RECEIVED));
+    CHECK (sender.refused != 0);
+    CHECK (!__atomic_load_n (&sender.is_done, __ATOMIC_ACQUIRE));
+
+    // Releases the waiting application thread
+    CHECK (client_disconnect (sender.client) == E_OK);
+    CHECK (wait_for (&sender.is_done, 1));
+    pthread_join (thread, NULL);
+
+    return 0;
+}
+
+static int test_server_not_reading(void)
+{
+    ServerConfig serverConfig;
+    ClientConfig clientConfig;
+    ServerHandler server;
+    int status;
+
+    loopback_server_config (&serverConfig, PORT);
+    serverConfig.client_byte_rate      = MESSAGE_LEN;
+    serverConfig.client_byte_burst     = 64 * MESSAGE_LEN;
+    serverConfig.heartbeat_interval_ms = 20;
+    server = server_init (&serverConfig);
+    CHECK (server != NULL);
+
+    loopback_client_config (&clientConfig, PORT);
+    clientConfig.receive_cb = on_client_receive;
+    sender.client = client_init (&clientConfig);
+
+    status = (sender.client != NULL) ? check_queue (server) : 1;
+
+    if (sender.client != NULL)
+    {
+        client_deinit (sender.client);
+    }
+
+    server_deinit (server);
+
+    return status;
+}
+
+int main(void)
+{
+    RUN (test_server_not_reading);
+
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Coroutine layer: accept, receive and send coroutines on both ends of a
+ * loopback connection are resumed on the network threads, and a mailbox
+ * reopened for a new connection never hands over the previous one's
+ * messages.
+ */
+
+#include "client_coro.hpp"
+#include "loopback.h"
+#include "server_coro.hpp"
+#include "test.h"
+
+#include <cstring>
+#include <thread>
+
+#define PORT        6750
+#define NB_MESSAGES 50
+
+typedef struct
+{
+    int accepted;        ///< Connections accepted by the server
+    int echoed;          ///< Messages echoed by the server sessions
+    int sessions_ended;  ///< Server sessions whose recv completed empty
+    int listen_ended;    ///< Accept loop completed empty
+    int received;        ///< Echoes received by the client
+    int out_of_order;    ///< Echoes not following the previous one
+    int client_ended;    ///< Client recv completed empty
+    int off_thread;      ///< Resumptions away from the test thread
+} Activity;
+
+static Activity activity;
+static std::thread::id testThread;
+
+static std::span<const std::byte> bytes(const uint32_t &value)
+{
+    return std::as_bytes (std::span (&value, 1));
+}
+
+static uint32_t value(std::span<const std::byte> data)
+{
+    uint32_t result = 0;
+
+    std::memcpy (&result, data.data (), (data.size () < sizeof(result)) ? data.size () : sizeof(result));
+
+    return result;
+}
+
+static void count_thread()
+{
+    if (std::this_thread::get_id () != testThread)
+    {
+        __atomic_fetch_add (&activity.off_thread, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static net::co::Task session(net::co::Connection &conn)
+{
+    while (auto data = co_await conn.recv ())
+    {
+        count_thread ();
+        __atomic_fetch_add (&activity.echoed, 1, __ATOMIC_RELEASE);
+        co_await conn.send (*data);
+    }
+
+    __atomic_fetch_add (&activity.sessions_ended, 1, __ATOMIC_RELEASE);
+}
+
+static net::co::Task listen(net::co::Server &server)
+{
+    while (net::co::Connection *conn = co_await server.accept ())
+    {
+        __atomic_fetch_add (&activity.accepted, 1, __ATOMIC_RELEASE);
+        session (*conn);
+    }
+
+    __atomic_fetch_add (&activity.listen_ended, 1, __ATOMIC_RELEASE);
+}
+
+/** Connect, then send each message once the previous one came back */
+static net::co::Task play(net::co::Client &client)
+{
+    auto servers = co_await client.discover (500);
+
+    if (servers.empty () || (client.connect (servers[0].id) != E_OK))
+    {
+        co_return;
+    }
+
+    uint32_t expected = 0;
+
+    for (uint32_t index = 0; index < NB_MESSAGES; ++index)
+    {
+        if ((co_await client.send (bytes (index))) != E_OK)
+        {
+            break;
+        }
+
+        auto data = co_await client.recv ();
+
+        if (!data)
+        {
+            break;
+        }
+
+        count_thread ();
+
+        if (value (*data) != expected++)
+        {
+            activity.out_of_order++;
+        }
+
+        __atomic_fetch_add (&activity.received, 1, __ATOMIC_RELEASE);
+    }
+
+    // Stays suspended until the connection goes
+    while (co_await client.recv ())
+    {
+    }
+
+    __atomic_fetch_add (&activity.client_ended, 1, __ATOMIC_RELEASE);
+}
+
+static ServerConfig server_config(uint16_t port)
+{
+    ServerConfig config;
+
+    loopback_server_config (&config, port);
+
+    return config;
+}
+
+static ClientConfig client_config(uint16_t port)
+{
+    ClientConfig config;
+
+    loopback_client_config (&config, port);
+
+    return config;
+}
+
+static int test_echo()
+{
+    std::memset (&activity, 0, sizeof(activity));
+    testThread = std::this_thread::get_id ();
+
+    {
+        net::co::Server server (server_config (PORT));
+        net::co::Client client (client_config (PORT));
+
+        CHECK (server && client);
+        listen (server);
+        play (client);
+
+        CHECK (wait_for (&activity.received, NB_MESSAGES));
+        CHECK (activity.out_of_order == 0);
+        CHECK ((activity.accepted == 1) && (activity.echoed == NB_MESSAGES));
+
+        // Server sessions and client receives both ran on network threads
+        CHECK (activity.off_thread == 2 * NB_MESSAGES);
+
+        CHECK (client.disconnect () == E_OK);
+        CHECK (wait_for (&activity.client_ended, 1));
+        CHECK (wait_for (&activity.sessions_ended, 1));
+        CHECK (activity.listen_ended == 0);
+    }
+
+    // Stopping the server completed the pending accept
+    CHECK (activity.listen_ended == 1);
+
+    return 0;
+}
+
+static int test_reconnect()
+{
+    std::memset (&activity, 0, sizeof(activity));
+    testThread = std::this_thread::get_id ();
+
+    net::co::Server server (server_config (PORT + 3));
+    net::co::Client client (client_config (PORT + 3));
+
+    CHECK (server && client);
+    listen (server);
+
+    // The second connection takes the same id, and so the same mailboxes
+    for (int round = 1; round <= 2; ++round)
+    {
+        play (client);
+
+        CHECK (wait_for (&activity.received, round * NB_MESSAGES));
+        CHECK (activity.accepted == round);
+
+        CHECK (client.disconnect () == E_OK);
+        CHECK (wait_for (&activity.client_ended, round));
+        CHECK (wait_for (&activity.sessions_ended, round));
+    }
+
+    CHECK (activity.out_of_order == 0);
+    CHECK (activity.echoed == 2 * NB_MESSAGES);
+
+    return 0;
+}
+
+static net::co::Task receive_one(net::co::Mailbox::Awaiter awaiter, int *result)
+{
+    auto data = co_await awaiter;
+
+    __atomic_store_n (result, data ? (int) value (*data) : -1, __ATOMIC_RELEASE);
+}
+
+static net::co::Task receive_all(net::co::Mailbox &box, int *received)
+{
+    while (auto data = co_await box.receive ())
+    {
+        count_thread ();
+        __atomic_fetch_add (received, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static int test_generations()
+{
+    net::co::Mailbox box;
+    uint32_t stale = 1;
+    uint32_t fresh = 2;
+    int result = 0;
+    int received = 0;
+
+    std::memset (&activity, 0, sizeof(activity));
+    testThread = std::this_thread::get_id ();
+
+    // Left over by the previous generation
+    box.open ();
+    box.deliver (bytes (stale));
+
+    // Started before the reopen, completes empty without the new message
+    net::co::Mailbox::Awaiter awaiter = box.receive ();
+
+    box.open ();
+    box.deliver (bytes (fresh));
+    receive_one (awaiter, &result);
+    CHECK (result == -1);
+
+    // The new generation starts with its own message only
+    receive_one (box.receive (), &result);
+    CHECK (result == (int) fresh);
+
+    // Suspended here, resumed by the delivering thread
+    receive_all (box, &received);
+
+    std::thread deliverer ([&box]
+    {
+        for (uint32_t index = 0; index < NB_MESSAGES; ++index)
+        {
+            box.deliver (bytes (index));
+        }
+
+        box.close ();
+    });
+
+    deliverer.join ();
+
+    CHECK (received == NB_MESSAGES);
+    CHECK (activity.off_thread == NB_MESSAGES);
+
+    return 0;
+}
+
+int main()
+{
+    RUN (test_echo);
+    RUN (test_reconnect);
+    RUN (test_generations);
+
+    return 0;
+}
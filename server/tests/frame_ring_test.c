@@ -0,0 +1,172 @@
+/*
+ * Frame ring: frames read back intact across wraparound, eviction keeps
+ * as many recent frames as fit, oversized frames and clear.
+ */
+
+#include "frame_ring.h"
+#include "frame.h"
+#include "test.h"
+
+#include <string.h>
+
+#define RING_CAPACITY 97
+#define NB_FRAMES     2000
+
+static uint32_t sizes[NB_FRAMES + 1];
+
+static uint8_t pattern(uint64_t sequence, uint32_t index)
+{
+    return (uint8_t) (sequence * 31 + index);
+}
+
+static void append(FrameRing *ring, uint64_t sequence, uint32_t length)
+{
+    uint8_t header[FRAME_HEADER_LEN];
+    uint8_t payload[MAX_MESSAGE_LEN];
+
+    for (uint32_t index = 0; index < length; ++index)
+    {
+        payload[index] = pattern (sequence, index);
+    }
+
+    frame_encode_header (header, FRAME_DATA, length);
+    frame_ring_append (ring, header, payload, length);
+}
+
+/** Read every buffered frame back and compare with what was appended */
+static int check_contents(const FrameRing *ring)
+{
+    static uint8_t frame[FRAME_HEADER_LEN + MAX_MESSAGE_LEN];
+    uint8_t header[FRAME_HEADER_LEN];
+    size_t offset = 0;
+
+    for (uint64_t sequence = ring->first; sequence <= ring->last; ++sequence)
+    {
+        uint32_t length = sizes[sequence];
+        uint32_t size = frame_ring_read (ring, &offset, frame);
+
+        CHECK (size == FRAME_HEADER_LEN + length);
+        frame_encode_header (header, FRAME_DATA, length);
+        CHECK (memcmp (frame, header, FRAME_HEADER_LEN) == 0);
+
+        for (uint32_t index = 0; index < length; ++index)
+        {
+            CHECK (frame[FRAME_HEADER_LEN + index] == pattern (sequence, index));
+        }
+    }
+
+    CHECK (offset == ring->length);
+
+    return 0;
+}
+
+static int test_wraparound(void)
+{
+    static uint8_t storage[RING_CAPACITY];
+    FrameRing ring;
+
+    frame_ring_init (&ring, storage, sizeof(storage));
+    CHECK ((ring.first == 1) && (ring.last == 0) && (ring.length == 0));
+
+    for (uint64_t sequence = 1; sequence <= NB_FRAMES; ++sequence)
+    {
+        size_t kept = 0;
+
+        // Sizes from empty to half the ring, so frames straddle the end
+        sizes[sequence] = (uint32_t) ((sequence * 7) % 45);
+        append (&ring, sequence, sizes[sequence]);
+
+        CHECK (ring.last == sequence);
+        CHECK (ring.length <= RING_CAPACITY);
+
+        for (uint64_t index = ring.first; index <= ring.last; ++index)
+        {
+            kept += FRAME_HEADER_LEN + sizes[index];
+        }
+
+        CHECK (kept == ring.length);
+
+        // Only evicts what the new frame needed
+        if (ring.first > 1)
+        {
+            CHECK (kept + FRAME_HEADER_LEN + sizes[ring.first - 1] > RING_CAPACITY);
+        }
+
+        if (check_contents (&ring) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int test_skip(void)
+{
+    static uint8_t storage[RING_CAPACITY];
+    static uint8_t frame[FRAME_HEADER_LEN + MAX_MESSAGE_LEN];
+    FrameRing ring;
+    size_t offset = 0;
+
+    frame_ring_init (&ring, storage, sizeof(storage));
+
+    for (uint64_t sequence = 1; sequence <= 20; ++sequence)
+    {
+        sizes[sequence] = (uint32_t) sequence;
+        append (&ring, sequence, sizes[sequence]);
+    }
+
+    // Skipping frames lands on the next one, as replay does
+    for (uint64_t sequence = ring.first; sequence < ring.last; ++sequence)
+    {
+        CHECK (frame_ring_read (&ring, &offset, NULL) == FRAME_HEADER_LEN + sizes[sequence]);
+    }
+
+    CHECK (frame_ring_read (&ring, &offset, frame) == FRAME_HEADER_LEN + 20);
+    CHECK (frame[FRAME_HEADER_LEN + 19] == pattern (20, 19));
+    CHECK (offset == ring.length);
+
+    return 0;
+}
+
+static int test_oversized(void)
+{
+    static uint8_t storage[RING_CAPACITY];
+    FrameRing ring;
+
+    frame_ring_init (&ring, storage, sizeof(storage));
+
+    for (uint64_t sequence = 1; sequence <= 3; ++sequence)
+    {
+        sizes[sequence] = 10;
+        append (&ring, sequence, sizes[sequence]);
+    }
+
+    // Takes a sequence but nothing before it stays available
+    sizes[4] = RING_CAPACITY;
+    append (&ring, 4, sizes[4]);
+    CHECK ((ring.first == 5) && (ring.last == 4) && (ring.length == 0));
+
+    sizes[5] = 10;
+    append (&ring, 5, sizes[5]);
+    CHECK ((ring.first == 5) && (ring.last == 5));
+
+    if (check_contents (&ring) != 0)
+    {
+        return 1;
+    }
+
+    frame_ring_clear (&ring);
+    CHECK ((ring.first == 1) && (ring.last == 0) && (ring.length == 0));
+
+    return 0;
+}
+
+int main(void)
+{
+    RUN (test_wraparound);
+    RUN (test_skip);
+    RUN (test_oversized);
+
+    return 0;
+}
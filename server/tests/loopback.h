@@ -0,0 +1,68 @@
+#ifndef NETWORKING_LOOPBACK_H_
+#define NETWORKING_LOOPBACK_H_
+
+/*
+ * Server and client talking over the loopback interface, for the tests
+ * that exercise whole connections. Each test program uses its own ports.
+ */
+
+#include "client.h"
+#include "server.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define LOOPBACK_GROUP      "224.0.0.26"
+#define LOOPBACK_TIMEOUT_MS 2000
+
+/** Advertise on port, accept clients on port + 1 */
+static inline void loopback_server_config(ServerConfig *config, uint16_t port)
+{
+    memset (config, 0, sizeof(*config));
+    strcpy ((char *) config->ip, LOOPBACK_GROUP);
+    strcpy (config->name, "Loopback");
+
+    config->advertise_port = port;
+    config->game_port      = port + 1;
+    config->max_nb_clients = 4;
+}
+
+static inline void loopback_client_config(ClientConfig *config, uint16_t port)
+{
+    memset (config, 0, sizeof(*config));
+    strcpy ((char *) config->ip, LOOPBACK_GROUP);
+
+    config->port           = port;
+    config->max_nb_servers = 1;
+}
+
+/** Discover the server advertising on the configured port and connect to it */
+static inline Status loopback_connect(ClientHandler client)
+{
+    ServerDetails server;
+
+    if (client_list_servers (client, &server, 1, 500) != 1)
+    {
+        return E_NOT_MANAGED;
+    }
+
+    return client_connect (client, server.id);
+}
+
+/** Wait for a counter updated by a network thread to reach count, 0 on timeout */
+static inline int wait_for(const int *counter, int count)
+{
+    for (int waitedMs = 0; waitedMs < LOOPBACK_TIMEOUT_MS; waitedMs += 5)
+    {
+        if (__atomic_load_n (counter, __ATOMIC_ACQUIRE) >= count)
+        {
+            return 1;
+        }
+
+        usleep (5000);
+    }
+
+    return __atomic_load_n (counter, __ATOMIC_ACQUIRE) >= count;
+}
+
+#endif /* NETWORKING_LOOPBACK_H_*/
@@ -0,0 +1,136 @@
+/*
+ * Message schema: wire layout, round trips between the C++ and C
+ * declarations of the same message, view validation and dispatch.
+ */
+
+#include "message_schema.h"
+#include "message_schema.hpp"
+#include "test.h"
+
+#include <array>
+#include <cstring>
+
+#define PLAYER_MOVE_FIELDS(FIELD, M) \
+    FIELD(M, uint32_t, player) \
+    FIELD(M, int16_t,  x) \
+    FIELD(M, int16_t,  y)
+
+NET_MESSAGE(CPlayerMove, 1, PLAYER_MOVE_FIELDS)
+
+using PlayerMove = net::Message<1, uint32_t, int16_t, int16_t>;
+using Chat = net::Message<2, uint64_t, uint8_t>;
+enum PlayerMoveField { player, x, y };
+
+static_assert (PlayerMove::size == 10);
+static_assert (PlayerMove::size == CPlayerMove_SIZE);
+static_assert (PlayerMove::offset<player> == 2);
+static_assert (PlayerMove::offset<y> == 8);
+static_assert (Chat::size == 11);
+
+static std::span<const std::byte> bytes(const uint8_t *data, std::size_t size)
+{
+    return { reinterpret_cast<const std::byte *> (data), size };
+}
+
+static int test_wire_layout()
+{
+    std::array<std::byte, PlayerMove::size> buffer;
+    static const uint8_t expected[] = { 1, 0, 0x04, 0x03, 0x02, 0x01, 0xfd, 0xff, 12, 0 };
+
+    CHECK (PlayerMove::encode (buffer, 0x01020304, -3, 12) == PlayerMove::size);
+    CHECK (std::memcmp (buffer.data (), expected, sizeof(expected)) == 0);
+
+    return 0;
+}
+
+static int test_cpp_to_c()
+{
+    std::array<std::byte, PlayerMove::size> buffer;
+    CPlayerMove_view view;
+
+    PlayerMove::encode (buffer, 7, -3, 12);
+
+    CHECK (CPlayerMove_view_init (&view, buffer.data (), buffer.size ()) == 0);
+    CHECK (CPlayerMove_player (view) == 7);
+    CHECK (CPlayerMove_x (view) == -3);
+    CHECK (CPlayerMove_y (view) == 12);
+
+    return 0;
+}
+
+static int test_c_to_cpp()
+{
+    uint8_t buffer[CPlayerMove_SIZE];
+    CPlayerMove move = { 0xdeadbeef, -32768, 32767 };
+
+    CHECK (CPlayerMove_encode (buffer, sizeof(buffer), &move) == CPlayerMove_SIZE);
+
+    auto view = PlayerMove::View::from (bytes (buffer, sizeof(buffer)));
+
+    CHECK (view.has_value ());
+    CHECK (view->get<player> () == 0xdeadbeef);
+    CHECK (view->get<x> () == -32768);
+    CHECK (view->get<y> () == 32767);
+
+    return 0;
+}
+
+static int test_validation()
+{
+    std::array<std::byte, PlayerMove::size + 4> buffer {};
+    std::array<std::byte, PlayerMove::size - 1> small;
+
+    CHECK (PlayerMove::encode (small, 1, 2, 3) == 0);
+    CHECK (PlayerMove::encode (buffer, 1, 2, 3) == PlayerMove::size);
+
+    // Longer buffers are accepted, fields may be appended later
+    CHECK (PlayerMove::View::from (buffer).has_value ());
+    CHECK (!PlayerMove::View::from (std::span (buffer).first (PlayerMove::size - 1)).has_value ());
+    CHECK (!Chat::View::from (buffer).has_value ());
+    CHECK (!net::message_type (std::span (buffer).first (1)).has_value ());
+
+    return 0;
+}
+
+struct Handler
+{
+    int moves = 0;
+    int chats = 0;
+    uint64_t last_chat = 0;
+
+    void operator()(PlayerMove::View view) { moves += view.get<x> (); }
+    void operator()(Chat::View view) { ++chats; last_chat = view.get<0> (); }
+};
+
+static int test_dispatch()
+{
+    using Dispatch = net::Dispatcher<PlayerMove, Chat>;
+    std::array<std::byte, 16> buffer {};
+    Handler handler;
+
+    PlayerMove::encode (buffer, 1, 5, 0);
+    CHECK (Dispatch::dispatch (buffer, handler));
+    CHECK (Chat::encode (buffer, 1ULL << 40, 9) == Chat::size);
+    CHECK (Dispatch::dispatch (std::span (buffer).first (Chat::size), handler));
+    CHECK ((handler.moves == 5) && (handler.chats == 1) && (handler.last_chat == (1ULL << 40)));
+
+    // Truncated, unknown and empty messages reach no handler
+    CHECK (!Dispatch::dispatch (std::span (buffer).first (Chat::size - 1), handler));
+    buffer[0] = std::byte { 3 };
+    CHECK (!Dispatch::dispatch (buffer, handler));
+    CHECK (!Dispatch::dispatch ({}, handler));
+    CHECK ((handler.moves == 5) && (handler.chats == 1));
+
+    return 0;
+}
+
+int main()
+{
+    RUN (test_wire_layout);
+    RUN (test_cpp_to_c);
+    RUN (test_c_to_cpp);
+    RUN (test_validation);
+    RUN (test_dispatch);
+
+    return 0;
+}
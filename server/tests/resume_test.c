@@ -0,0 +1,162 @@
+/*
+ * Resumable sessions: messages sent while the connection is down are
+ * replayed in order on resumption; past the grace period the session
+ * ends and resuming opens a new one.
+ */
+
+#include "loopback.h"
+#include "test.h"
+
+#define PORT        6730
+#define GRACE_MS    300
+#define NB_BEFORE   100
+#define NB_MISSED   200
+
+typedef struct
+{
+    int connected;    ///< Server connect notifications
+    int disconnected; ///< Server disconnect notifications
+    int received;     ///< Messages received by the client
+    int out_of_order; ///< Messages not following the previous one
+} Session;
+
+static Session session;
+
+static void on_connect(ServerHandler handler, ClientId clientId)
+{
+    __atomic_fetch_add (&session.connected, 1, __ATOMIC_RELEASE);
+}
+
+static void on_disconnect(ServerHandler handler, ClientId clientId)
+{
+    __atomic_fetch_add (&session.disconnected, 1, __ATOMIC_RELEASE);
+}
+
+static void on_client_receive(ClientHandler handler, char *buffer, int size)
+{
+    uint32_t sequence;
+
+    memcpy (&sequence, buffer, sizeof(sequence));
+
+    if ((size != sizeof(sequence)) || (sequence != (uint32_t) session.received))
+    {
+        session.out_of_order++;
+    }
+
+    __atomic_fetch_add (&session.received, 1, __ATOMIC_RELEASE);
+}
+
+static int send_range(ServerHandler server, uint32_t first, uint32_t last)
+{
+    for (uint32_t sequence = first; sequence < last; ++sequence)
+    {
+        CHECK (server_send_message_to_client (server, 0, &sequence, sizeof(sequence)) == E_OK);
+    }
+
+    return 0;
+}
+
+/** Start a server and a connected client with resumable sessions */
+static int open_session(uint16_t port, ServerHandler *server, ClientHandler *client)
+{
+    ServerConfig serverConfig;
+    ClientConfig clientConfig;
+
+    memset (&session, 0, sizeof(session));
+
+    loopback_server_config (&serverConfig, port);
+    serverConfig.resume_grace_ms        = GRACE_MS;
+    serverConfig.client_connected_cb    = on_connect;
+    serverConfig.client_disconnected_cb = on_disconnect;
+    *server = server_init (&serverConfig);
+    CHECK (*server != NULL);
+
+    loopback_client_config (&clientConfig, port);
+    clientConfig.receive_cb     = on_client_receive;
+    clientConfig.session_resume = 1;
+    *client = client_init (&clientConfig);
+    CHECK (*client != NULL);
+
+    CHECK (loopback_connect (*client) == E_OK);
+    CHECK (wait_for (&session.connected, 1));
+
+    return 0;
+}
+
+static int test_replay(void)
+{
+    ServerHandler server;
+    ClientHandler client;
+
+    if (open_session (PORT, &server, &client) != 0)
+    {
+        return 1;
+    }
+
+    CHECK (client_resume (client) == E_NOT_INITIALIZED);
+
+    CHECK (send_range (server, 0, NB_BEFORE) == 0);
+    CHECK (wait_for (&session.received, NB_BEFORE));
+
+    // Some are sent before the server notices, the rest once detached
+    CHECK (client_disconnect (client) == E_OK);
+    CHECK (send_range (server, NB_BEFORE, NB_BEFORE + NB_MISSED / 2) == 0);
+    usleep (50000);
+    CHECK (send_range (server, NB_BEFORE + NB_MISSED / 2, NB_BEFORE + NB_MISSED) == 0);
+
+    CHECK (client_resume (client) == E_OK);
+    CHECK (wait_for (&session.received, NB_BEFORE + NB_MISSED));
+
+    // And the session goes on
+    CHECK (send_range (server, NB_BEFORE + NB_MISSED, NB_BEFORE + NB_MISSED + 1) == 0);
+    CHECK (wait_for (&session.received, NB_BEFORE + NB_MISSED + 1));
+
+    CHECK (session.out_of_order == 0);
+    CHECK (session.received == NB_BEFORE + NB_MISSED + 1);
+    CHECK ((session.connected == 1) && (session.disconnected == 0));
+
+    client_deinit (client);
+    server_deinit (server);
+
+    return 0;
+}
+
+static int test_grace_expiry(void)
+{
+    ServerHandler server;
+    ClientHandler client;
+    uint32_t sequence = 0;
+
+    if (open_session (PORT + 3, &server, &client) != 0)
+    {
+        return 1;
+    }
+
+    CHECK (client_disconnect (client) == E_OK);
+
+    // Still held within the grace period
+    usleep (GRACE_MS * 1000 / 2);
+    CHECK (session.disconnected == 0);
+    CHECK (wait_for (&session.disconnected, 1));
+
+    // The slot is free, resuming opens a new session
+    CHECK (server_send_message_to_client (server, 0, &sequence, sizeof(sequence)) != E_OK);
+    CHECK (client_resume (client) == E_NOT_MANAGED);
+    CHECK (wait_for (&session.connected, 2));
+
+    usleep (50000);
+    CHECK ((session.received == 0) && (session.disconnected == 1));
+
+    client_deinit (client);
+    server_deinit (server);
+
+    return 0;
+}
+
+int main(void)
+{
+    RUN (test_replay);
+    RUN (test_grace_expiry);
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Snapshot codec: random round trips split over small packets, delta
+ * size on unchanged and sparse states, malformed deltas.
+ */
+
+#include "snapshot.h"
+#include "test.h"
+
+#include <string.h>
+
+#define MAX_STATE 3000
+#define ROUNDS    2000
+
+static uint32_t seed = 12345;
+
+static uint32_t next_random(void)
+{
+    // xorshift32, deterministic across runs
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    return seed;
+}
+
+/** Encode state in packets of at most capacity bytes and decode each one */
+static int round_trip(
+    const uint8_t *state,
+    uint32_t size,
+    const uint8_t *baseline,
+    uint32_t baselineSize,
+    size_t capacity)
+{
+    static uint8_t rebuilt[MAX_STATE];
+    static uint8_t packet[MAX_STATE * 2 + 16];
+    uint32_t encoded = 0;
+    uint32_t decoded = 0;
+
+    memset (rebuilt, 0xAA, sizeof(rebuilt));
+
+    do
+    {
+        size_t length = snapshot_encode (packet, capacity, state, size, baseline, baselineSize, &encoded);
+
+        CHECK (length <= capacity);
+        CHECK (snapshot_decode (rebuilt, size, baseline, baselineSize, &decoded, packet, length) == 0);
+        CHECK (decoded == encoded);
+    } while (encoded < size);
+
+    CHECK (memcmp (rebuilt, state, size) == 0);
+
+    return 0;
+}
+
+static int test_random_round_trip(void)
+{
+    static uint8_t baseline[MAX_STATE];
+    static uint8_t state[MAX_STATE];
+
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        uint32_t size = next_random () % MAX_STATE;
+        uint32_t baselineSize = next_random () % MAX_STATE;
+        uint32_t changes = next_random () % 64;
+        size_t capacity = 16 + next_random () % 200;
+        int hasBaseline = (next_random () % 4) != 0;
+
+        for (uint32_t index = 0; index < MAX_STATE; ++index)
+        {
+            baseline[index] = (uint8_t) next_random ();
+        }
+
+        // Mostly the baseline, zeroes past its end, with scattered changes
+        for (uint32_t index = 0; index < size; ++index)
+        {
+            state[index] = (hasBaseline && (index < baselineSize)) ? baseline[index] : 0;
+        }
+
+        for (uint32_t change = 0; (change < changes) && (size != 0); ++change)
+        {
+            uint32_t start = next_random () % size;
+            uint32_t length = 1 + next_random () % 40;
+
+            for (uint32_t index = start; (index < start + length) && (index < size); ++index)
+            {
+                state[index] = (uint8_t) next_random ();
+            }
+        }
+
+        if (round_trip (state, size, hasBaseline ? baseline : NULL, baselineSize, capacity) != 0)
+        {
+            fprintf (stderr, "round %d: size %u baseline %u capacity %zu\n", round, size, baselineSize, capacity);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int test_delta_size(void)
+{
+    static uint8_t baseline[4096];
+    static uint8_t state[4096];
+    uint8_t packet[64];
+    uint32_t offset = 0;
+
+    for (uint32_t index = 0; index < sizeof(baseline); ++index)
+    {
+        baseline[index] = (uint8_t) next_random ();
+    }
+
+    memcpy (state, baseline, sizeof(state));
+
+    // Unchanged: a single token
+    CHECK (snapshot_encode (packet, sizeof(packet), state, sizeof(state), baseline, sizeof(baseline), &offset) == 3);
+    CHECK (offset == sizeof(state));
+
+    // Two bytes changed: two tokens and the literals
+    state[100] ^= 1;
+    state[3000] ^= 1;
+    offset = 0;
+    CHECK (snapshot_encode (packet, sizeof(packet), state, sizeof(state), baseline, sizeof(baseline), &offset) <= 12);
+    CHECK (offset == sizeof(state));
+
+    if (round_trip (state, sizeof(state), baseline, sizeof(baseline), sizeof(packet)) != 0)
+    {
+        return 1;
+    }
+
+    // No baseline, all zeroes
+    memset (state, 0, sizeof(state));
+    offset = 0;
+    CHECK (snapshot_encode (packet, sizeof(packet), state, sizeof(state), NULL, 0, &offset) == 3);
+
+    return 0;
+}
+
+static int test_malformed(void)
+{
+    uint8_t state[16];
+    uint32_t offset = 0;
+    static const uint8_t truncated[] = { 0x80 };
+    static const uint8_t overlong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01, 0x00 };
+    static const uint8_t pastState[] = { 17, 0 };
+    static const uint8_t pastDelta[] = { 0, 4, 1, 2 };
+    static const uint8_t valid[] = { 2, 2, 7, 9 };
+
+    CHECK (snapshot_decode (state, sizeof(state), NULL, 0, &offset, truncated, sizeof(truncated)) == -1);
+    CHECK (snapshot_decode (state, sizeof(state), NULL, 0, &offset, overlong, sizeof(overlong)) == -1);
+    CHECK (snapshot_decode (state, sizeof(state), NULL, 0, &offset, pastState, sizeof(pastState)) == -1);
+    CHECK (snapshot_decode (state, sizeof(state), NULL, 0, &offset, pastDelta, sizeof(pastDelta)) == -1);
+
+    // Offset past the state
+    offset = 17;
+    CHECK (snapshot_decode (state, sizeof(state), NULL, 0, &offset, valid, sizeof(valid)) == -1);
+
+    offset = 0;
+    CHECK (snapshot_decode (state, sizeof(state), NULL, 0, &offset, valid, sizeof(valid)) == 0);
+    CHECK ((offset == 4) && (state[0] == 0) && (state[1] == 0) && (state[2] == 7) && (state[3] == 9));
+
+    return 0;
+}
+
+int main(void)
+{
+    RUN (test_random_round_trip);
+    RUN (test_delta_size);
+    RUN (test_malformed);
+
+    return 0;
+}
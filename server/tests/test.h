@@ -0,0 +1,33 @@
+#ifndef NETWORKING_TEST_H_
+#define NETWORKING_TEST_H_
+
+/*
+ * Minimal checks for the test programs under tests/, run by make test.
+ * A failed check reports its location and fails the current test.
+ */
+
+#include <stdio.h>
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1; \
+        } \
+    } while (0)
+
+#define RUN(test) \
+    do \
+    { \
+        if (test () != 0) \
+        { \
+            fprintf (stderr, "%s: FAILED\n", #test); \
+            return 1; \
+        } \
+        \
+        printf ("%s: ok\n", #test); \
+    } while (0)
+
+#endif /* NETWORKING_TEST_H_*/
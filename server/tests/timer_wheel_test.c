@@ -0,0 +1,191 @@
+/*
+ * Timer wheel: exact expiry across level boundaries, cascades from any
+ * starting tick, cancel, and rescheduling from the callback.
+ */
+
+#include "timer_wheel.h"
+#include "test.h"
+
+#include <stddef.h>
+
+#define NB_DELAYS 14
+
+static const uint32_t delays[NB_DELAYS] =
+{
+    1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 262143, 262144, 262145, 300000
+};
+
+typedef struct
+{
+    TimerEntry timer;
+    TimerWheel *wheel;
+    uint64_t *now;
+    uint64_t fired_ms;
+    uint32_t count;
+    uint32_t period_ms;
+} Probe;
+
+static void on_probe(TimerEntry *timer, void *ctx)
+{
+    Probe *probe = (Probe *) ctx;
+
+    probe->fired_ms = *probe->now;
+    probe->count++;
+
+    if (probe->period_ms != 0)
+    {
+        timer_wheel_schedule (probe->wheel, timer, probe->period_ms);
+    }
+}
+
+static int test_exact_expiry(void)
+{
+    static const uint64_t starts[] = { 0, 1, 63, 4000, 262100 };
+    static TimerWheel wheel;
+    Probe probes[NB_DELAYS];
+    uint64_t now = 0;
+
+    for (size_t start = 0; start < sizeof(starts) / sizeof(starts[0]); ++start)
+    {
+        timer_wheel_init (&wheel, 1, 0);
+
+        // Cascades depend on the tick timers are inserted at
+        for (now = 0; now <= starts[start]; ++now)
+        {
+            timer_wheel_advance (&wheel, now);
+        }
+
+        now = starts[start];
+
+        for (int index = 0; index < NB_DELAYS; ++index)
+        {
+            Probe *probe = &probes[index];
+
+            timer_init (&probe->timer, on_probe, probe);
+            probe->now = &now;
+            probe->count = 0;
+            probe->period_ms = 0;
+            timer_wheel_schedule (&wheel, &probe->timer, delays[index]);
+        }
+
+        CHECK (wheel.count == NB_DELAYS);
+
+        while (wheel.count != 0)
+        {
+            timer_wheel_advance (&wheel, ++now);
+        }
+
+        for (int index = 0; index < NB_DELAYS; ++index)
+        {
+            CHECK (probes[index].count == 1);
+            CHECK (probes[index].fired_ms == starts[start] + delays[index]);
+        }
+    }
+
+    return 0;
+}
+
+static int test_jump(void)
+{
+    static TimerWheel wheel;
+    Probe probes[NB_DELAYS];
+    uint64_t now = 400000;
+
+    timer_wheel_init (&wheel, 1, 0);
+
+    for (int index = 0; index < NB_DELAYS; ++index)
+    {
+        timer_init (&probes[index].timer, on_probe, &probes[index]);
+        probes[index].now = &now;
+        probes[index].count = 0;
+        probes[index].period_ms = 0;
+        timer_wheel_schedule (&wheel, &probes[index].timer, delays[index]);
+    }
+
+    // One late advance runs everything due
+    timer_wheel_advance (&wheel, now);
+
+    CHECK (wheel.count == 0);
+
+    for (int index = 0; index < NB_DELAYS; ++index)
+    {
+        CHECK (probes[index].count == 1);
+        CHECK (!timer_is_pending (&probes[index].timer));
+    }
+
+    return 0;
+}
+
+static int test_cancel(void)
+{
+    static TimerWheel wheel;
+    Probe kept;
+    Probe cancelled;
+    uint64_t now = 0;
+
+    timer_wheel_init (&wheel, 1, 0);
+    timer_init (&kept.timer, on_probe, &kept);
+    timer_init (&cancelled.timer, on_probe, &cancelled);
+    kept.now = cancelled.now = &now;
+    kept.count = cancelled.count = 0;
+    kept.period_ms = cancelled.period_ms = 0;
+
+    timer_wheel_schedule (&wheel, &kept.timer, 5000);
+    timer_wheel_schedule (&wheel, &cancelled.timer, 5000);
+    timer_wheel_cancel (&wheel, &cancelled.timer);
+    timer_wheel_cancel (&wheel, &cancelled.timer);
+
+    CHECK (wheel.count == 1);
+    CHECK (!timer_is_pending (&cancelled.timer));
+
+    // A rescheduled timer moves instead of firing twice
+    timer_wheel_schedule (&wheel, &kept.timer, 10);
+
+    while (wheel.count != 0)
+    {
+        timer_wheel_advance (&wheel, ++now);
+    }
+
+    CHECK (kept.count == 1);
+    CHECK (kept.fired_ms == 10);
+    CHECK (cancelled.count == 0);
+    CHECK (timer_wheel_next_timeout (&wheel, now) == -1);
+
+    return 0;
+}
+
+static int test_periodic(void)
+{
+    static TimerWheel wheel;
+    Probe probe;
+    uint64_t now = 0;
+
+    timer_wheel_init (&wheel, 1, 0);
+    timer_init (&probe.timer, on_probe, &probe);
+    probe.wheel = &wheel;
+    probe.now = &now;
+    probe.count = 0;
+    probe.period_ms = 10;
+    timer_wheel_schedule (&wheel, &probe.timer, 10);
+
+    for (now = 1; now <= 1000; ++now)
+    {
+        timer_wheel_advance (&wheel, now);
+    }
+
+    CHECK (probe.count == 100);
+    CHECK (probe.fired_ms == 1000);
+    CHECK (timer_wheel_next_timeout (&wheel, 1000) == 10);
+
+    return 0;
+}
+
+int main(void)
+{
+    RUN (test_exact_expiry);
+    RUN (test_jump);
+    RUN (test_cancel);
+    RUN (test_periodic);
+
+    return 0;
+}
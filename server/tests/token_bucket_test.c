@@ -0,0 +1,124 @@
+/*
+ * Token bucket: burst, refill, wait estimates, oversized requests and
+ * long pauses.
+ */
+
+#include "token_bucket.h"
+#include "test.h"
+
+static int test_burst(void)
+{
+    TokenBucket bucket;
+
+    token_bucket_init (&bucket, 100, 10, 0);
+
+    for (int index = 0; index < 10; ++index)
+    {
+        CHECK (token_bucket_consume (&bucket, 1, 0));
+    }
+
+    CHECK (!token_bucket_consume (&bucket, 1, 0));
+
+    // 100 per second, one token every 10 ms
+    CHECK (!token_bucket_consume (&bucket, 1, 9999));
+    CHECK (token_bucket_consume (&bucket, 1, 10000));
+    CHECK (!token_bucket_consume (&bucket, 1, 10000));
+
+    return 0;
+}
+
+static int test_wait(void)
+{
+    TokenBucket bucket;
+
+    token_bucket_init (&bucket, 100, 10, 0);
+    CHECK (token_bucket_wait_ms (&bucket, 10, 0) == 0);
+    CHECK (token_bucket_consume (&bucket, 10, 0));
+
+    CHECK (token_bucket_wait_ms (&bucket, 1, 0) == 10);
+    CHECK (token_bucket_wait_ms (&bucket, 5, 0) == 50);
+    CHECK (token_bucket_wait_ms (&bucket, 1, 5000) == 5);
+
+    // Rounded up, never early
+    CHECK (token_bucket_wait_ms (&bucket, 1, 5001) == 5);
+    CHECK (token_bucket_wait_ms (&bucket, 1, 10000) == 0);
+
+    return 0;
+}
+
+static int test_oversized(void)
+{
+    TokenBucket bucket;
+
+    token_bucket_init (&bucket, 100, 10, 0);
+
+    // Capped to the burst: granted on a full bucket, which it empties
+    CHECK (token_bucket_consume (&bucket, 1000, 0));
+    CHECK (!token_bucket_consume (&bucket, 1, 0));
+    CHECK (token_bucket_wait_ms (&bucket, 1000, 0) == 100);
+    CHECK (!token_bucket_consume (&bucket, 1000, 99999));
+    CHECK (token_bucket_consume (&bucket, 1000, 100000));
+
+    return 0;
+}
+
+static int test_long_pause(void)
+{
+    TokenBucket bucket;
+
+    token_bucket_init (&bucket, 4000000000U, 0, 0);
+    CHECK (bucket.burst == 4000000000U);
+    CHECK (token_bucket_consume (&bucket, 4000000000U, 0));
+
+    // Refill saturates at the burst instead of overflowing
+    CHECK (token_bucket_consume (&bucket, 4000000000U, 1000000000000ULL));
+    CHECK (!token_bucket_consume (&bucket, 1, 1000000000000ULL));
+
+    return 0;
+}
+
+static int test_sustained_rate(void)
+{
+    TokenBucket bucket;
+    uint32_t granted = 0;
+
+    token_bucket_init (&bucket, 1000, 1, 0);
+
+    // Polled every 100 us for one second, after the initial token
+    for (uint64_t nowUs = 0; nowUs <= 1000000; nowUs += 100)
+    {
+        granted += token_bucket_consume (&bucket, 1, nowUs);
+    }
+
+    CHECK (granted == 1001);
+
+    return 0;
+}
+
+static int test_unlimited(void)
+{
+    TokenBucket bucket;
+
+    token_bucket_init (&bucket, 0, 0, 0);
+
+    for (int index = 0; index < 1000; ++index)
+    {
+        CHECK (token_bucket_consume (&bucket, 1000, 0));
+    }
+
+    CHECK (token_bucket_wait_ms (&bucket, 1000, 0) == 0);
+
+    return 0;
+}
+
+int main(void)
+{
+    RUN (test_burst);
+    RUN (test_wait);
+    RUN (test_oversized);
+    RUN (test_long_pause);
+    RUN (test_sustained_rate);
+    RUN (test_unlimited);
+
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * C++ wrappers: handler types bound at compile time receive the events
+ * they implement, member functions, plain lambdas and batch handlers
+ * alike, and survive moves of the owning instance.
+ */
+
+#include "client.hpp"
+#include "loopback.h"
+#include "server.hpp"
+#include "test.h"
+
+#include <cstring>
+#include <type_traits>
+
+#define PORT        6740
+#define NB_MESSAGES 100
+
+static std::span<const std::byte> bytes(const uint32_t &value)
+{
+    return std::as_bytes (std::span (&value, 1));
+}
+
+static uint32_t value(std::span<const std::byte> data)
+{
+    uint32_t result = 0;
+
+    std::memcpy (&result, data.data (), (data.size () < sizeof(result)) ? data.size () : sizeof(result));
+
+    return result;
+}
+
+/** Echoes every message back to its sender */
+struct Game
+{
+    int connected = 0;
+    int disconnected = 0;
+    int received = 0;
+    ClientId last_client = 0;
+
+    void on_connect(net::ServerRef, ClientId clientId)
+    {
+        last_client = clientId;
+        __atomic_fetch_add (&connected, 1, __ATOMIC_RELEASE);
+    }
+
+    void on_receive(net::ServerRef server, ClientId clientId, std::span<const std::byte> data)
+    {
+        __atomic_fetch_add (&received, 1, __ATOMIC_RELEASE);
+        server.send_to (clientId, data);
+    }
+
+    void on_disconnect(net::ServerRef, ClientId)
+    {
+        __atomic_fetch_add (&disconnected, 1, __ATOMIC_RELEASE);
+    }
+};
+
+struct Session
+{
+    int received = 0;
+    int disconnected = 0;
+    uint32_t sum = 0;
+
+    void on_receive(net::ClientRef, std::span<const std::byte> data)
+    {
+        sum += value (data);
+        __atomic_fetch_add (&received, 1, __ATOMIC_RELEASE);
+    }
+
+    void on_disconnect(net::ClientRef)
+    {
+        __atomic_fetch_add (&disconnected, 1, __ATOMIC_RELEASE);
+    }
+};
+
+static_assert (!std::is_copy_constructible_v<net::Server<Game>>);
+static_assert (std::is_nothrow_move_constructible_v<net::Server<Game>>);
+static_assert (!std::is_copy_constructible_v<net::Client<Session>>);
+
+struct BatchGame
+{
+    int received = 0;
+    int batches = 0;
+
+    void on_receive_batch(net::ServerRef server, std::span<const ServerMessage> messages)
+    {
+        ++batches;
+        __atomic_fetch_add (&received, (int) messages.size (), __ATOMIC_RELEASE);
+
+        for (const ServerMessage &message : messages)
+        {
+            server.send_to (message.client_id, std::span (static_cast<const std::byte *> (message.buffer), message.size));
+        }
+    }
+};
+
+struct BatchSession
+{
+    int received = 0;
+
+    void on_receive_batch(net::ClientRef, std::span<const ClientMessage> messages)
+    {
+        __atomic_fetch_add (&received, (int) messages.size (), __ATOMIC_RELEASE);
+    }
+};
+
+static ServerConfig server_config(uint16_t port)
+{
+    ServerConfig config;
+
+    loopback_server_config (&config, port);
+
+    return config;
+}
+
+static ClientConfig client_config(uint16_t port)
+{
+    ClientConfig config;
+
+    loopback_client_config (&config, port);
+
+    return config;
+}
+
+static int test_members()
+{
+    net::Server<Game> initial (server_config (PORT), Game {});
+    net::Client<Session> client (client_config (PORT), Session {});
+
+    CHECK (initial && client);
+
+    // The handler stays bound to the instance through moves
+    net::Server<Game> server (std::move (initial));
+
+    CHECK (server && !initial);
+    CHECK (loopback_connect (client.handle ()) == E_OK);
+    CHECK (wait_for (&server.handler ().connected, 1));
+
+    for (uint32_t index = 1; index <= NB_MESSAGES; ++index)
+    {
+        CHECK (client.send (bytes (index)) == E_OK);
+    }
+
+    CHECK (wait_for (&client.handler ().received, NB_MESSAGES));
+    CHECK (server.handler ().received == NB_MESSAGES);
+    CHECK (client.handler ().sum == NB_MESSAGES * (NB_MESSAGES + 1) / 2);
+
+    // Sent by the application through the owning instance
+    CHECK (server.send_to (server.handler ().last_client, bytes (1000)) == E_OK);
+    CHECK (wait_for (&client.handler ().received, NB_MESSAGES + 1));
+
+    CHECK (client.disconnect () == E_OK);
+    CHECK (client.handler ().disconnected == 1);
+    CHECK (wait_for (&server.handler ().disconnected, 1));
+
+    return 0;
+}
+
+static int test_lambdas()
+{
+    int serverReceived = 0;
+    int clientReceived = 0;
+    uint32_t ping = 7;
+
+    auto echo = [&serverReceived](net::ServerRef server, ClientId clientId, std::span<const std::byte> data)
+    {
+        __atomic_fetch_add (&serverReceived, 1, __ATOMIC_RELEASE);
+        server.send_to (clientId, data);
+    };
+
+    auto receive = [&clientReceived, ping](net::ClientRef, std::span<const std::byte> data)
+    {
+        if (value (data) == ping)
+        {
+            __atomic_fetch_add (&clientReceived, 1, __ATOMIC_RELEASE);
+        }
+    };
+
+    net::Server<decltype (echo)> server (server_config (PORT + 3), echo);
+    net::Client<decltype (receive)> client (client_config (PORT + 3), receive);
+
+    CHECK (server && client);
+    CHECK (loopback_connect (client.handle ()) == E_OK);
+    CHECK (client.send (bytes (ping)) == E_OK);
+    CHECK (wait_for (&clientReceived, 1));
+    CHECK (serverReceived == 1);
+
+    return 0;
+}
+
+static int test_batches()
+{
+    net::Server<BatchGame> server (server_config (PORT + 6), BatchGame {});
+    net::Client<BatchSession> client (client_config (PORT + 6), BatchSession {});
+
+    CHECK (server && client);
+    CHECK (loopback_connect (client.handle ()) == E_OK);
+
+    for (uint32_t index = 0; index < NB_MESSAGES; ++index)
+    {
+        CHECK (client.send (bytes (index)) == E_OK);
+    }
+
+    CHECK (wait_for (&client.handler ().received, NB_MESSAGES));
+    CHECK (server.handler ().received == NB_MESSAGES);
+    CHECK ((server.handler ().batches >= 1) && (server.handler ().batches <= NB_MESSAGES));
+
+    return 0;
+}
+
+int main()
+{
+    RUN (test_members);
+    RUN (test_lambdas);
+    RUN (test_batches);
+
+    return 0;
+}